@@ -28,3 +28,13 @@ MACHINE=mips
 # libprocstat
 CFLAGS+=-DGC_USE_LIBPROCSTAT
 LDADD+=-lprocstat -lelf -lkvm -lutil
+
+# heap profiler stacks (gc_set_prof_rate)
+LDADD+=-lexecinfo
+
+# concurrent marking (gc_set_concurrent)
+CFLAGS+=-DGC_USE_PTHREAD
+LDADD+=-lpthread
+
+# superpage-aligned heaps (GC_SUPERPAGESZ); worthwhile for large heaps
+#CFLAGS+=-DGC_USE_SUPERPAGES
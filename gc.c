@@ -9,10 +9,14 @@
 
 #include "gc.h"
 #include "gc_collect.h"
+#include "gc_conc.h"
 #include "gc_debug.h"
+#include "gc_heap.h"
+#include "gc_roots.h"
 #include "gc_stack.h"
+#include "gc_stats.h"
 
-_gc_cap void		*gc_malloc_entry(size_t sz);
+_gc_cap void		*gc_malloc_entry(size_t sz, int leaf);
 
 _gc_cap struct gc_state	*gc_state_c;
 
@@ -154,6 +158,31 @@ gc_first_bit(uint64_t x)
 	return (c);
 }
 
+/*
+ * Allocates btbl memory, superpage-aligned with GC_USE_SUPERPAGES if it
+ * is big enough; sets *super iff so.
+ */
+static _gc_cap void *
+gc_alloc_btbl_mem(size_t sz, int *super)
+{
+#ifdef GC_USE_SUPERPAGES
+	_gc_cap void *ptr;
+#endif
+
+	*super = 0;
+#ifdef GC_USE_SUPERPAGES
+	if (sz >= GC_SUPERPAGESZ) {
+		ptr = gc_alloc_super(sz);
+		if (ptr != NULL) {
+			*super = 1;
+			return (ptr);
+		}
+		gc_warn("no superpage reservation for %zu bytes", sz);
+	}
+#endif
+	return (gc_alloc_internal(sz));
+}
+
 void
 gc_alloc_btbl(_gc_cap struct gc_btbl *btbl, size_t slotsz, size_t nslots,
     int flags)
@@ -162,7 +191,11 @@ gc_alloc_btbl(_gc_cap struct gc_btbl *btbl, size_t slotsz, size_t nslots,
 	size_t memsz;
 	size_t mapsz;
 	size_t tagsz;
+	size_t dcsz;
+	size_t lfsz;
+	size_t totsz;
 	size_t npages;
+	int super;
 
 	/* Round up nslots to next multiple of 2. */
 	nslots = (nslots + (size_t)1) & ~(size_t)1;
@@ -171,30 +204,67 @@ gc_alloc_btbl(_gc_cap struct gc_btbl *btbl, size_t slotsz, size_t nslots,
 	memset((void *)btbl, 0, sizeof(struct gc_btbl));
 
 	memsz = slotsz * nslots;
-	mapsz = nslots / 2;
+	/* Keep the tags and decommit bits that follow the map aligned. */
+	mapsz = (nslots / 2 + sizeof(uint64_t) - 1) &
+	    ~(sizeof(uint64_t) - 1);
 	npages = memsz / GC_PAGESZ;
 	tagsz = npages * sizeof(*btbl->bt_tags);
+	dcsz = GC_BIT_NWORDS(npages) * sizeof(uint64_t);
 
-	btbl->bt_base = gc_alloc_internal(memsz);
-	if (btbl->bt_base == NULL)
-		gc_error("gc_alloc_internal(%zu)", memsz);
+	btbl->bt_base = gc_heap_commit(btbl, memsz);
+	if (btbl->bt_base != NULL) {
+#ifdef GC_USE_SUPERPAGES
+		if (memsz >= GC_SUPERPAGESZ)
+			flags |= GC_BTBL_FLAG_SUPER;
+#endif
+	} else {
+		if (!gc_state_c->gs_hp_spill)
+			gc_state_c->gs_heaps->ht_nspill++;
+		gc_state_c->gs_hp_spill = 1;
+		btbl->bt_base = gc_alloc_btbl_mem(memsz, &super);
+		if (btbl->bt_base == NULL)
+			gc_error("gc_alloc_internal(%zu)", memsz);
+		if (super)
+			flags |= GC_BTBL_FLAG_SUPER;
+	}
 	gc_fill_free_mem(btbl->bt_base);
 
-	/* Contiguously allocate map and tags. */
-	btbl->bt_map = gc_alloc_internal(mapsz + tagsz);
+	/*
+	 * Contiguously allocate map, tags, decommit, dirty and no-tags
+	 * bits (per page), and leaf bits (per slot).
+	 */
+	lfsz = GC_BIT_NWORDS(nslots) * sizeof(uint64_t);
+	totsz = mapsz + tagsz + 3 * dcsz + lfsz;
+	btbl->bt_map = gc_alloc_btbl_mem(totsz, &super);
 	if (btbl->bt_map == NULL) {
 		/* XXX: TODO: Free btbl->base. */
-		gc_error("gc_alloc_internal(%zu)", mapsz + tagsz);
+		gc_error("gc_alloc_internal(%zu)", totsz);
 	}
-	memset((void *)btbl->bt_map, 0, mapsz + tagsz);
+	if (super)
+		flags |= GC_BTBL_FLAG_SUPERMAP;
+	memset((void *)btbl->bt_map, 0, totsz);
+	btbl->bt_leaf = gc_cheri_incbase(
+	    btbl->bt_map, mapsz + tagsz + 3 * dcsz);
+	btbl->bt_leaf = gc_cheri_setlen(btbl->bt_leaf, lfsz);
+	btbl->bt_notags = gc_cheri_incbase(
+	    btbl->bt_map, mapsz + tagsz + 2 * dcsz);
+	btbl->bt_notags = gc_cheri_setlen(btbl->bt_notags, dcsz);
+	btbl->bt_cards = gc_cheri_incbase(
+	    btbl->bt_map, mapsz + tagsz + dcsz);
+	btbl->bt_cards = gc_cheri_setlen(btbl->bt_cards, dcsz);
+	btbl->bt_decommit = gc_cheri_incbase(
+	    btbl->bt_map, mapsz + tagsz);
+	btbl->bt_decommit = gc_cheri_setlen(btbl->bt_decommit, dcsz);
 	btbl->bt_tags = gc_cheri_incbase(
 	    btbl->bt_map, mapsz);
+	btbl->bt_tags = gc_cheri_setlen(btbl->bt_tags, tagsz);
 	btbl->bt_map = gc_cheri_ptr(
-	    (void *)btbl->bt_map, mapsz);
+	    (void *)btbl->bt_map, nslots / 2);
 
 	btbl->bt_slotsz = slotsz;
 	btbl->bt_nslots = nslots;
 	btbl->bt_flags = flags;
+	btbl->bt_sweep = nslots;
 	btbl->bt_valid = 1;
 
 	gc_debug("allocated a block table with %zu slots of size %zu each",
@@ -204,14 +274,56 @@ gc_alloc_btbl(_gc_cap struct gc_btbl *btbl, size_t slotsz, size_t nslots,
 	gc_debug("allocated btbl base: %s", gc_cap_str(btbl->bt_base));
 }
 
+void
+gc_free_btbl(_gc_cap struct gc_btbl *btbl)
+{
+	uint64_t base;
+	size_t npages, mapsz, tagsz, dcsz, lfsz, totsz, memsz;
+
+	if (!btbl->bt_valid)
+		return;
+	/* As laid out by gc_alloc_btbl. */
+	npages = btbl->bt_slotsz * btbl->bt_nslots / GC_PAGESZ;
+	mapsz = (btbl->bt_nslots / 2 + sizeof(uint64_t) - 1) &
+	    ~(sizeof(uint64_t) - 1);
+	tagsz = npages * sizeof(*btbl->bt_tags);
+	dcsz = GC_BIT_NWORDS(npages) * sizeof(uint64_t);
+	lfsz = GC_BIT_NWORDS(btbl->bt_nslots) * sizeof(uint64_t);
+	totsz = mapsz + tagsz + 3 * dcsz + lfsz;
+	/* gc_alloc_super mapped whole superpages. */
+	if (btbl->bt_flags & GC_BTBL_FLAG_SUPERMAP)
+		totsz = GC_SUPER_ROUND(totsz);
+	munmap((void *)btbl->bt_map, totsz);
+	base = gc_cheri_getbase(btbl->bt_base);
+	if (base < gc_state_c->gs_hp_base || base >= gc_state_c->gs_hp_top) {
+		memsz = gc_cheri_getlen(btbl->bt_base);
+		if (btbl->bt_flags & GC_BTBL_FLAG_SUPER)
+			memsz = GC_SUPER_ROUND(memsz);
+		munmap((void *)btbl->bt_base, memsz);
+	}
+	btbl->bt_valid = 0;
+}
+
 int
 gc_init(void)
 {
-	/*_gc_cap struct gc_vm_ent *ve;*/
+
+	if (gc_init_lazy() != 0)
+		return (1);
+	return (gc_init_heap());
+}
+
+int
+gc_init_lazy(void)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	size_t i, n;
 
 	gc_debug_indent_level = 0;
 
 	gc_debug("gc_init enter");
+	/* Further heaps (gc_heap_new) share the first one's table. */
+	ht = gc_state_c != NULL ? gc_state_c->gs_heaps : NULL;
 	gc_state_c = gc_alloc_internal(sizeof(struct gc_state));
 	if (gc_state_c == NULL) {
 		gc_error("gc_alloc_internal(%zu)", sizeof(struct gc_state));
@@ -219,12 +331,45 @@ gc_init(void)
 	}
 
 	memset((void *)gc_state_c, 0, sizeof(struct gc_state));
+	gc_state_c->gs_poison = GC_POISON_DEFAULT;
+	gc_state_c->gs_release_min = GC_RELEASE_MIN_DEFAULT;
+	gc_state_c->gs_quarantine = GC_QUARANTINE_DEFAULT;
 	gc_state_c->gs_regs_c = gc_cheri_ptr((void *)&gc_state_c->gs_regs,
 	    sizeof(gc_state_c->gs_regs));
 	gc_state_c->gs_gts_c = gc_cheri_ptr((void *)&gc_state_c->gs_gts,
 	    sizeof(gc_state_c->gs_gts));
 	gc_state_c->gs_mark_state = GC_MS_NONE;
+	if (gc_heap_register(ht) != GC_SUCC)
+		return (1);
+#ifdef GC_USE_PTHREAD
+	pthread_mutex_init((pthread_mutex_t *)&gc_state_c->gs_lock, NULL);
+	pthread_cond_init((pthread_cond_t *)&gc_state_c->gs_conc_cv, NULL);
+	gc_state_c->gs_conc_trigger = GC_CONC_TRIGGER_DEFAULT;
+#endif
+
+	if (gc_heap_reserve() != GC_SUCC)
+		gc_warn("no heap reservation; btbls are mapped separately");
+	gc_heap_index();
+	gc_state_c->gs_stack_bottom = gc_get_stack_bottom();
+	n = gc_get_static_regions();
+	if (n == 0)
+		gc_warn("no static regions found; globals are not roots");
+	gc_debug("found %zu static region(s)", n);
+	for (i = 0; i < gc_state_c->gs_nstatic; i++)
+		if (gc_roots_add(gc_state_c->gs_static[i]) != GC_SUCC)
+			gc_warn("static region not scanned: %s",
+			    gc_cap_str(gc_state_c->gs_static[i]));
+
+	gc_debug("gc_init_lazy success");
+	return (0);
+}
+
+int
+gc_init_heap(void)
+{
+	/*_gc_cap struct gc_vm_ent *ve;*/
 
+	gc_debug("committing the heap");
 	/* 4096*16384 => 64MB heap. */
 	/* XXX: 4096*6 => 20kB heap. */
 	gc_alloc_btbl((_gc_cap struct gc_btbl *)&gc_state_c->gs_btbl_small,
@@ -250,9 +395,6 @@ gc_init(void)
 	    (void *)&gc_state_c->gs_sweep_stack,
 	    sizeof(gc_state_c->gs_sweep_stack));
 
-	gc_state_c->gs_stack_bottom = gc_get_stack_bottom();
-	gc_state_c->gs_static_region = gc_get_static_region();
-
 	if (gc_vm_tbl_alloc(&gc_state_c->gs_vt,
 	    GC_PAGESZ / sizeof(struct gc_vm_ent)) != 0) {
 		gc_error("gc_vm_tbl_alloc");
@@ -283,8 +425,9 @@ gc_init(void)
 	gc_print_vm_tbl(&gc_state_c->gs_vt);
 	//gc_cmdln();
 	
+	gc_state_c->gs_ready = 1;
 
-	gc_debug("gc_init success");
+	gc_debug("gc_init_heap success");
 	return (0);
 }
 
@@ -306,6 +449,7 @@ gc_alloc_free_blk(_gc_cap struct gc_btbl *btbl,
 					btbl->bt_slotsz);
 				GC_BTBL_SETTYPE(byte, j, type);
 				btbl->bt_map[i] = byte;
+				gc_btbl_recommit(btbl, idx, 1);
 				return (0);
 			}
 		}
@@ -350,6 +494,8 @@ gc_alloc_free_blks(_gc_cap struct gc_btbl *btbl,
 						gc_btbl_set_map(btbl,
 						    fidx, fidx,
 						    GC_BTBL_USED);
+						gc_btbl_recommit(btbl, fidx,
+						    nblk);
 						return (0);
 					}
 				}
@@ -405,6 +551,114 @@ gc_btbl_set_map(_gc_cap struct gc_btbl *btbl, int start, int end, uint8_t value)
 	}
 }
 
+int
+gc_btbl_page_is_free(_gc_cap struct gc_btbl *btbl, size_t page_indx)
+{
+	size_t indx, first, last;
+	uint8_t type;
+
+	first = (page_indx * GC_PAGESZ) / btbl->bt_slotsz;
+	last = ((page_indx + 1) * GC_PAGESZ - 1) / btbl->bt_slotsz;
+	for (indx = first; indx <= last; indx++) {
+		type = GC_BTBL_GETTYPE(btbl->bt_map[GC_BTBL_MAPINDX(indx)],
+		    indx);
+		if (type != GC_BTBL_FREE)
+			return (0);
+	}
+	return (1);
+}
+
+void
+gc_btbl_release(_gc_cap struct gc_btbl *btbl, size_t minpages)
+{
+	size_t npages, i, run, start, end;
+
+	if (btbl->bt_decommit == NULL || minpages == 0)
+		return;
+
+	npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
+	run = 0;
+	for (i = 0; i <= npages; i++) {
+		if (i < npages && gc_btbl_page_is_free(btbl, i)) {
+			run++;
+			continue;
+		}
+		start = i - run;
+		end = i;
+		/* Only whole superpages (or the unpromotable tail). */
+		if (btbl->bt_flags & GC_BTBL_FLAG_SUPER) {
+			start = (start + GC_SUPER_NPAGES - 1) &
+			    ~(GC_SUPER_NPAGES - 1);
+			if (end != npages)
+				end &= ~(GC_SUPER_NPAGES - 1);
+		}
+		if (end > start && end - start >= minpages)
+			gc_btbl_decommit(btbl, start, end - start);
+		run = 0;
+	}
+}
+
+void
+gc_btbl_decommit(_gc_cap struct gc_btbl *btbl, size_t first_page,
+    size_t npages)
+{
+	char *base;
+	size_t i, start, end;
+
+	base = (char *)gc_cheri_getbase(btbl->bt_base);
+	end = first_page + npages;
+	i = first_page;
+	while (i < end) {
+		/* Skip pages that were released by an earlier sweep. */
+		if (GC_BIT_ISSET(btbl->bt_decommit, i)) {
+			i++;
+			continue;
+		}
+		for (start = i; i < end &&
+		    !GC_BIT_ISSET(btbl->bt_decommit, i); i++)
+			GC_BIT_SET(btbl->bt_decommit, i);
+		if (madvise(base + start * GC_PAGESZ, (i - start) * GC_PAGESZ,
+		    GC_RELEASE_ADVICE) != 0) {
+			gc_warn("madvise failed for %zu page(s) at %p",
+			    i - start, base + start * GC_PAGESZ);
+			/* Not released: recommit must not count them. */
+			for (; start < i; start++)
+				GC_BIT_CLR(btbl->bt_decommit, start);
+			continue;
+		}
+#ifdef GC_COLLECT_STATS
+		gc_state_c->gs_nrelease += i - start;
+#endif
+		gc_debug("released %zu page(s) at %p", i - start,
+		    base + start * GC_PAGESZ);
+	}
+}
+
+void
+gc_btbl_recommit(_gc_cap struct gc_btbl *btbl, size_t indx, size_t nslots)
+{
+	size_t i, first, last;
+
+	if (btbl->bt_decommit == NULL)
+		return;
+
+	/*
+	 * Released pages are still mapped; the kernel recommits them
+	 * when they are first touched, so only the bookkeeping is
+	 * needed here.
+	 */
+	first = GC_SLOT_IDX_TO_PAGE_IDX(btbl, indx);
+	last = GC_SLOT_IDX_TO_PAGE_IDX(btbl, indx + nslots - 1);
+	for (i = first; i <= last; i++) {
+		if (GC_BIT_ISSET(btbl->bt_decommit, i)) {
+			GC_BIT_CLR(btbl->bt_decommit, i);
+#ifdef GC_COLLECT_STATS
+			gc_state_c->gs_nrelease--;
+#endif
+		}
+	}
+}
+
 int
 gc_set_mark_big(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 {
@@ -423,6 +677,10 @@ gc_set_mark_big(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 		return (type);
 	else if (gc_ty_is_used(type))
 	{
+		/* Big objects are old; minor collections don't trace them. */
+		if ((bt->bt_flags & GC_BTBL_FLAG_MANAGED) &&
+		    gc_minor_skip(bt, NULL))
+			return (gc_ty_set_marked(type));
 		byte = bt->bt_map[GC_BTBL_MAPINDX(indx)];
 		GC_BTBL_SETTYPE(byte, indx, gc_ty_set_marked(type));
 		bt->bt_map[GC_BTBL_MAPINDX(indx)] = byte;
@@ -435,6 +693,7 @@ gc_set_mark_big(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 		}
 #endif
 		gc_debug("set mark for big object at index %zu", indx);
+		gc_trace(GC_TRACE_MARK, gc_cheri_getbase(ptr), indx, 0);
 		return (type);
 	}
 	GC_NOTREACHABLE_ERROR();
@@ -463,6 +722,8 @@ gc_set_mark_small(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 
 		if (((blk->bk_free >> indx) & 1) != 0)
 			return (gc_ty_set_free(type)); /* free; don't mark */
+		if (gc_minor_skip(bt, blk))
+			return (gc_ty_set_marked(type)); /* old; not traced */
 		if (((blk->bk_marks >> indx) & 1) != 0)
 			return (gc_ty_set_marked(type)); /* already marked */
 		blk->bk_marks |= 1ULL << indx;
@@ -475,6 +736,8 @@ gc_set_mark_small(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 		}
 #endif
 		gc_debug("set mark for small object at index %zu", indx);
+		gc_trace(GC_TRACE_MARK, gc_cheri_getbase(ptr), indx,
+		    blk->bk_objsz);
 		return (type);
 	}
 	GC_NOTREACHABLE_ERROR();
@@ -494,25 +757,19 @@ gc_set_mark_bt(_gc_cap void *ptr, _gc_cap struct gc_btbl *bt)
 int
 gc_set_mark(_gc_cap void *ptr)
 {
-	int rc;
+	_gc_cap struct gc_btbl *bt;
 	_gc_cap struct gc_vm_ent *ve;
 	uint64_t base;
 
 	ptr = gc_cheri_setoffset(ptr, 0); /* sanitize */
 
-	/* Try small region. */
-	rc = gc_set_mark_small(ptr, &gc_state_c->gs_btbl_small);
-	if (!gc_ty_is_unmanaged(rc))
-		return (rc);
-
-	/* Try big region. */
-	rc = gc_set_mark_big(ptr, &gc_state_c->gs_btbl_big);
-	if (!gc_ty_is_unmanaged(rc))
-		return (rc);
+	bt = gc_get_managed_btbl(gc_cheri_getbase(ptr));
+	if (bt != NULL)
+		return (gc_set_mark_bt(ptr, bt));
 
 	/*
-	 * In neither; must be unmanaged by the GC, but potentially
-	 * trackable in the VM mappings, so we try those.
+	 * Not in a managed btbl; must be unmanaged by the GC, but
+	 * potentially trackable in the VM mappings, so we try those.
 	 */
 	//gc_debug("note: pointer %s is in neither big nor small region", gc_cap_str(ptr));
 	base = gc_cheri_getbase(ptr);
@@ -594,10 +851,19 @@ gc_get_block(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk **out_blk,
 int
 gc_follow_free(_gc_cap struct gc_blk **blk)
 {
-
-	for (; *blk != NULL; *blk = (*blk)->bk_next)
+	_gc_cap struct gc_btbl *btbl;
+	_gc_cap struct gc_blk *next;
+
+	for (; *blk != NULL; *blk = next) {
+		next = (*blk)->bk_next;
+		/* Promoted nursery blocks are on the lists of gs_btbl_small. */
+		btbl = gc_get_managed_btbl(gc_cheri_getbase(*blk));
+		/* Skip the block if sweeping took it off this list. */
+		if (gc_sweep_blk(btbl, *blk) != 0)
+			continue;
 		if ((*blk)->bk_free != (uint64_t)0) /* at least one bit free */
 			return (0);
+	}
 	return (1);
 }
 
@@ -621,6 +887,12 @@ gc_extern_collect(void)
 	/*len = (uintptr_t)(void *)gc_state_c->gs_stack_bottom -
 	    (uintptr_t)GC_ALIGN(&len);
 	gc_state_c->gs_stack = gc_cheri_ptr(GC_ALIGN(&len), len);*/
+	GC_LOCK();
+	/* The VM table of a lazily created heap isn't set up yet. */
+	if (GC_INIT_HEAP() != GC_SUCC) {
+		GC_UNLOCK();
+		return;
+	}
 	gc_state_c->gs_stack = gc_vm_get_stack(&gc_state_c->gs_vt);
 	gc_debug("set stack to %s\n", gc_cap_str(gc_state_c->gs_stack));
 	c16 = gc_state_c->gs_regs_c;
@@ -630,6 +902,29 @@ gc_extern_collect(void)
 	GC_SAVE_REGS(16);
 	gc_collect();
 	GC_RESTORE_REGS(16);
+	GC_UNLOCK();
+	GC_INVALIDATE_UNUSED_REGS;
+}
+
+void
+gc_revoke_commit(void)
+{
+	_gc_cap void *c16;
+
+	GC_LOCK();
+	if (GC_INIT_HEAP() != GC_SUCC) {
+		GC_UNLOCK();
+		return;
+	}
+	gc_state_c->gs_stack = gc_vm_get_stack(&gc_state_c->gs_vt);
+	c16 = gc_state_c->gs_regs_c;
+	__asm__ __volatile__ (
+		"cmove $c16, %0" : : "C"(c16) : "memory", "$c16"
+	);
+	GC_SAVE_REGS(16);
+	gc_revoke_commit_entry();
+	GC_RESTORE_REGS(16);
+	GC_UNLOCK();
 	GC_INVALIDATE_UNUSED_REGS;
 }
 
@@ -646,6 +941,36 @@ gc_malloc(size_t sz)
 	/*len = (uintptr_t)gc_state_c->gs_stack_bottom -
 	    (uintptr_t)GC_ALIGN(fp);
 	gc_state_c->gs_stack = gc_cheri_ptr(GC_ALIGN(fp), len);*/
+	GC_LOCK();
+	if (GC_INIT_HEAP() != GC_SUCC) {
+		GC_UNLOCK();
+		return (NULL);
+	}
+	gc_state_c->gs_stack = gc_vm_get_stack(&gc_state_c->gs_vt);
+	gc_debug("set stack to %s\n", gc_cap_str(gc_state_c->gs_stack));
+	c16 = gc_state_c->gs_regs_c;
+	__asm__ __volatile__ (
+		"cmove $c16, %0" : : "C"(c16) : "memory", "$c16"
+	);
+	GC_SAVE_REGS(16);
+	c3 = gc_malloc_entry(sz, 0);
+	GC_RESTORE_REGS(16);
+	GC_UNLOCK();
+	GC_INVALIDATE_UNUSED_REGS;
+	return (c3);
+}
+
+_gc_cap void *
+gc_malloc_atomic(size_t sz)
+{
+	_gc_cap void *c3;
+	_gc_cap void *c16;
+
+	GC_LOCK();
+	if (GC_INIT_HEAP() != GC_SUCC) {
+		GC_UNLOCK();
+		return (NULL);
+	}
 	gc_state_c->gs_stack = gc_vm_get_stack(&gc_state_c->gs_vt);
 	gc_debug("set stack to %s\n", gc_cap_str(gc_state_c->gs_stack));
 	c16 = gc_state_c->gs_regs_c;
@@ -653,22 +978,29 @@ gc_malloc(size_t sz)
 		"cmove $c16, %0" : : "C"(c16) : "memory", "$c16"
 	);
 	GC_SAVE_REGS(16);
-	c3 = gc_malloc_entry(sz);
+	c3 = gc_malloc_entry(sz, 1);
 	GC_RESTORE_REGS(16);
+	GC_UNLOCK();
 	GC_INVALIDATE_UNUSED_REGS;
 	return (c3);
 }
 
 _gc_cap void *
-gc_malloc_entry(size_t sz)
+gc_malloc_entry(size_t sz, int leaf)
 {
 	_gc_cap struct gc_blk *blk;
 	_gc_cap void *hp;
 	_gc_cap void *ptr;
 	uint64_t off;
-	int error, roundsz, logsz, hdrbits, indx;
-	int collected;
+	int error, roundsz, logsz, indx;
+	int collected, collected_minor;
+
+	if (GC_INIT_HEAP() != GC_SUCC)
+		return (NULL);
+	gc_conc_poll();
+	gc_stats_poll();
 	collected = 0;
+	collected_minor = 0;
 retry:
 
 	gc_debug("servicing allocation request of %zu bytes", sz);
@@ -693,17 +1025,8 @@ retry:
 			gc_debug("couldn't bump the pointer; searching for free blocks");
 			error = gc_alloc_free_blks(&gc_state_c->gs_btbl_big,
 			    &blk, roundsz);
-			if (error != 0) {
-				if (collected) {
-					gc_error("out of memory");
-					return (NULL);
-				} else {
-					gc_debug("OOM, collecting...");
-					gc_collect();
-					collected = 1;
-					goto retry;
-				}
-			}
+			if (error != 0)
+				goto oom;
 			gc_debug("found free blocks starting at %s", gc_cap_str(blk));
 			ptr = blk;
 		} else {
@@ -718,10 +1041,23 @@ retry:
 				gc_btbl_set_map(&gc_state_c->gs_btbl_big,
 				    indx + 1, indx + roundsz / GC_BIGSZ - 1,
 				    GC_BTBL_CONT);
+			gc_btbl_recommit(&gc_state_c->gs_btbl_big, indx,
+			    roundsz / GC_BIGSZ);
 		}
 		ptr = gc_cheri_setoffset(ptr, 0);
 		ptr = gc_cheri_setlen(ptr, sz);
 		gc_fill_used_mem(ptr, roundsz);
+		indx = (gc_cheri_getbase(ptr) -
+		    gc_cheri_getbase(gc_state_c->gs_btbl_big.bt_base)) /
+		    GC_BIGSZ;
+		if (leaf)
+			GC_BIT_SET(gc_state_c->gs_btbl_big.bt_leaf, indx);
+		else
+			GC_BIT_CLR(gc_state_c->gs_btbl_big.bt_leaf, indx);
+		/* Don't let the lazy sweeper free it when it gets there. */
+		if (gc_state_c->gs_sweep_pending &&
+		    indx >= gc_state_c->gs_btbl_big.bt_sweep)
+			gc_set_mark(ptr);
 	} else {
 		roundsz = GC_ROUND_POW2(sz);
 		logsz = GC_LOG2(roundsz);
@@ -730,46 +1066,61 @@ retry:
 #endif
 		gc_debug("request %zu is small (rounded %zu, log %zu)",
 		    sz, roundsz, logsz);
-		blk = gc_state_c->gs_heap[logsz];
-		error = gc_follow_free(&blk); 
-		if (error != 0) {
-			gc_debug("allocating new block");
-			error = gc_alloc_free_blk(&gc_state_c->gs_btbl_small,
-			    &blk, GC_BTBL_USED);
-			if (error != 0) {
-				if (collected) {
-					gc_error("out of memory");
-					return (NULL);
-				} else {
-					gc_debug("OOM, collecting...");
-					gc_collect();
-					collected = 1;
-					goto retry;
-				}
-			}
-			gc_debug("first free block: %s", gc_cap_str(blk));
-			blk->bk_objsz = roundsz;
-			blk->bk_marks = 0;
-			blk->bk_revoked = 0;
-			blk->bk_free = ((1ULL << (GC_PAGESZ / roundsz)) - 1ULL);
+		ptr = NULL;
+		if (leaf) {
 			/*
-			 * Account for the space taken up by the block
-			 * header.
+			 * Pointer-free objects can't reference young
+			 * ones, so they go straight to the old heap.
 			 */
-			hdrbits = (GC_BLK_HDRSZ + roundsz - 1) / roundsz;
-			blk->bk_free &= ~((1ULL << hdrbits) - 1ULL);
-			gc_debug("free bits: 0x%llx, shifted: 0x%llx",
-			    blk->bk_free, 1ULL << (GC_PAGESZ / roundsz));
-			gc_ins_blk(blk,
+			ptr = gc_malloc_small(&gc_state_c->gs_btbl_small,
+			    (_gc_cap struct gc_blk **)
+			    &gc_state_c->gs_leaf[logsz][0], sz, roundsz,
+			    GC_BLK_FLAG_LEAF);
+			if (ptr == NULL)
+				goto oom;
+		} else if (gc_state_c->gs_gen_mode == GC_GEN_NURSERY) {
+			ptr = gc_malloc_small(&gc_state_c->gs_btbl_nursery,
 			    (_gc_cap struct gc_blk **)
-			    &gc_state_c->gs_heap[logsz]);
+			    &gc_state_c->gs_nursery[logsz][0], sz, roundsz, 0);
+			/*
+			 * Only young blocks can be freed by a minor
+			 * collection. Promoted blocks keep their nursery
+			 * slots until a full collection frees them, so
+			 * once a nursery's worth has been allocated into
+			 * the old generation, do one to win them back.
+			 */
+			if (ptr == NULL && !collected_minor && !collected &&
+			    gc_nursery_young()) {
+				gc_debug("nursery full, minor collection...");
+				gc_collect_minor();
+				collected_minor = 1;
+				goto retry;
+			}
+			if (ptr == NULL && !collected_minor && !collected &&
+			    gc_state_c->gs_allocbytes >=
+			    GC_NURSERY_NSLOTS * GC_PAGESZ) {
+				gc_debug("nursery full of promoted blocks, "
+				    "collecting...");
+				gc_collect();
+				collected = 1;
+				goto retry;
+			}
 		}
-		indx = GC_FIRST_BIT(blk->bk_free);
-		blk->bk_free &= ~(1ULL << indx);
-		ptr = gc_cheri_incbase(blk, indx * roundsz);
-		ptr = gc_cheri_setlen(ptr, sz);
-		gc_fill_used_mem(ptr, roundsz);
+		if (ptr == NULL)
+			ptr = gc_malloc_small(&gc_state_c->gs_btbl_small,
+			    (_gc_cap struct gc_blk **)
+			    &gc_state_c->gs_heap[logsz][0], sz, roundsz, 0);
+		if (ptr == NULL)
+			goto oom;
 	}
+	if (leaf)
+		ptr = gc_cheri_andperm(ptr, ~CHERI_PERM_STORE_CAP);
+	gc_state_c->gs_allocbytes += roundsz;
+	if (gc_state_c->gs_prof_rate != 0)
+		gc_prof_alloc(ptr, roundsz);
+	/* Allocate black while marking concurrently. */
+	if (gc_state_c->gs_mark_state == GC_MS_MARK)
+		gc_set_mark(ptr);
 #ifdef GC_COLLECT_STATS
 	if (ptr != NULL) {
 		gc_state_c->gs_nalloc++;
@@ -777,6 +1128,83 @@ retry:
 	}
 #endif
 	gc_debug("returning %s", gc_cap_str(ptr));
+	gc_trace(GC_TRACE_ALLOC, gc_cheri_getbase(ptr), sz, roundsz);
+	return (ptr);
+
+oom:
+	/* Garbage may be waiting for the lazy sweeper. */
+	if (gc_state_c->gs_sweep_pending) {
+		gc_debug("OOM, finishing the sweep...");
+		gc_sweep_finish();
+		goto retry;
+	}
+	/* With sticky marks, a minor collection may free anything young. */
+	if (gc_state_c->gs_gen_mode == GC_GEN_STICKY && !collected_minor &&
+	    !collected) {
+		gc_debug("OOM, minor collection...");
+		gc_collect_minor();
+		collected_minor = 1;
+		goto retry;
+	}
+	if (collected) {
+		gc_error("out of memory");
+		return (NULL);
+	}
+	gc_debug("OOM, collecting...");
+	gc_collect();
+	collected = 1;
+	goto retry;
+}
+
+_gc_cap void *
+gc_malloc_small(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk **list,
+    size_t sz, size_t roundsz, uint32_t flags)
+{
+	_gc_cap struct gc_blk *blk;
+	_gc_cap void *ptr;
+	int error, hdrbits, indx, b;
+
+	/* Fullest non-full blocks first. */
+	error = 1;
+	for (b = GC_OCC_NBKT - 1; b >= 0 && error != 0; b--) {
+		blk = list[b];
+		error = gc_follow_free(&blk);
+	}
+	if (error == 0) {
+		/* The block may be a promoted nursery block. */
+		btbl = gc_get_managed_btbl(gc_cheri_getbase(blk));
+	} else {
+		gc_debug("allocating new block");
+		error = gc_alloc_free_blk(btbl, &blk, GC_BTBL_USED);
+		if (error != 0)
+			return (NULL);
+		gc_debug("first free block: %s", gc_cap_str(blk));
+		gc_trace(GC_TRACE_NEWBLK, gc_cheri_getbase(blk),
+		    roundsz, 0);
+		blk->bk_objsz = roundsz;
+		blk->bk_marks = 0;
+		blk->bk_revoked = 0;
+		blk->bk_reuse = 0;
+		blk->bk_flags = flags;
+		blk->bk_epoch = gc_state_c->gs_epoch; /* nothing to sweep */
+		blk->bk_occ = 0;
+		blk->bk_free = ((1ULL << (GC_PAGESZ / roundsz)) - 1ULL);
+		/*
+		 * Account for the space taken up by the block
+		 * header.
+		 */
+		hdrbits = (GC_BLK_HDRSZ + roundsz - 1) / roundsz;
+		blk->bk_free &= ~((1ULL << hdrbits) - 1ULL);
+		gc_debug("free bits: 0x%llx, shifted: 0x%llx",
+		    blk->bk_free, 1ULL << (GC_PAGESZ / roundsz));
+		gc_ins_blk(blk, &list[0]);
+	}
+	indx = GC_FIRST_BIT(blk->bk_free);
+	blk->bk_free &= ~(1ULL << indx);
+	gc_blk_rebucket(btbl, blk);
+	ptr = gc_cheri_incbase(blk, indx * roundsz);
+	ptr = gc_cheri_setlen(ptr, sz);
+	gc_fill_used_mem(ptr, roundsz);
 	return (ptr);
 }
 
@@ -790,17 +1218,285 @@ gc_rm_blk(_gc_cap struct gc_blk *blk, _gc_cap struct gc_blk **list)
 		blk->bk_next->bk_prev = blk->bk_prev;
 	if (blk->bk_prev != NULL)
 		blk->bk_prev->bk_next = blk->bk_next;
+	blk->bk_next = NULL;
+	blk->bk_prev = NULL;
+}
+
+_gc_cap struct gc_blk **
+gc_blk_list(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+	size_t logsz;
+
+	logsz = GC_LOG2(blk->bk_objsz);
+	if (blk->bk_flags & GC_BLK_FLAG_LEAF)
+		return ((_gc_cap struct gc_blk **)
+		    &gc_state_c->gs_leaf[logsz][blk->bk_occ]);
+	if (gc_is_young(btbl, blk))
+		return ((_gc_cap struct gc_blk **)
+		    &gc_state_c->gs_nursery[logsz][blk->bk_occ]);
+	return ((_gc_cap struct gc_blk **)
+	    &gc_state_c->gs_heap[logsz][blk->bk_occ]);
+}
+
+uint32_t
+gc_blk_occ(_gc_cap struct gc_blk *blk)
+{
+	size_t nslot, hdrbits, nfree;
+
+	if (blk->bk_free == 0)
+		return (GC_OCC_FULL);
+	nslot = GC_PAGESZ / blk->bk_objsz;
+	if (nslot > 64)
+		nslot = 64;
+	hdrbits = (GC_BLK_HDRSZ + blk->bk_objsz - 1) / blk->bk_objsz;
+	nslot -= hdrbits;
+	nfree = __builtin_popcountll(blk->bk_free);
+	return ((nslot - nfree) * GC_OCC_NBKT / nslot);
+}
+
+void
+gc_blk_rebucket(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+	uint32_t occ;
+
+	occ = gc_blk_occ(blk);
+	if (occ == blk->bk_occ)
+		return;
+	gc_rm_blk(blk, gc_blk_list(btbl, blk));
+	blk->bk_occ = occ;
+	gc_ins_blk(blk, gc_blk_list(btbl, blk));
+}
+
+int
+gc_is_young(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+
+	if (!(btbl->bt_flags & GC_BTBL_FLAG_NURSERY) || blk == NULL)
+		return (0);
+	return (!(blk->bk_flags & GC_BLK_FLAG_OLD));
+}
+
+void
+gc_blk_promote(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+
+	gc_rm_blk(blk, gc_blk_list(btbl, blk));
+	blk->bk_flags |= GC_BLK_FLAG_OLD;
+	gc_ins_blk(blk, gc_blk_list(btbl, blk));
+}
+
+int
+gc_nursery_young(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < GC_LOG_BIGSZ; i++)
+		for (j = 0; j < GC_OCC_NLIST; j++)
+			if (gc_state_c->gs_nursery[i][j] != NULL)
+				return (1);
+	return (0);
+}
+
+int
+gc_is_leaf(_gc_cap struct gc_btbl *btbl, size_t big_indx,
+    _gc_cap struct gc_blk *blk)
+{
+
+	if (btbl == NULL || !(btbl->bt_flags & GC_BTBL_FLAG_MANAGED))
+		return (0);
+	if (btbl->bt_flags & GC_BTBL_FLAG_SMALL)
+		return (blk != NULL && (blk->bk_flags & GC_BLK_FLAG_LEAF));
+	return (GC_BIT_ISSET(btbl->bt_leaf, big_indx));
+}
+
+int
+gc_minor_skip(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+
+	/* In GC_GEN_STICKY mode, the mark bits alone tell the ages apart. */
+	if (!gc_state_c->gs_minor ||
+	    gc_state_c->gs_gen_mode != GC_GEN_NURSERY)
+		return (0);
+	return (!gc_is_young(btbl, blk));
+}
+
+int
+gc_btbl_contains(_gc_cap struct gc_btbl *btbl, uint64_t addr)
+{
+	uint64_t base;
+
+	if (!btbl->bt_valid)
+		return (0);
+	base = gc_cheri_getbase(btbl->bt_base);
+	return (addr >= base && addr < base + gc_cheri_getlen(btbl->bt_base));
+}
+
+_gc_cap struct gc_btbl *
+gc_get_managed_btbl(uint64_t addr)
+{
+	_gc_cap struct gc_btbl *btbl;
+
+	if (addr >= gc_state_c->gs_hp_base && addr < gc_state_c->gs_hp_top) {
+		btbl = gc_state_c->gs_chunk[(addr - gc_state_c->gs_hp_base) >>
+		    GC_LOG_CHUNKSZ];
+		/* The end of a btbl's last chunk is unused. */
+		if (btbl != NULL && !gc_btbl_contains(btbl, addr))
+			btbl = NULL;
+		return (btbl);
+	}
+	if (!gc_state_c->gs_hp_spill)
+		return (NULL);
+	if (gc_btbl_contains(&gc_state_c->gs_btbl_small, addr))
+		return (&gc_state_c->gs_btbl_small);
+	if (gc_btbl_contains(&gc_state_c->gs_btbl_big, addr))
+		return (&gc_state_c->gs_btbl_big);
+	if (gc_btbl_contains(&gc_state_c->gs_btbl_nursery, addr))
+		return (&gc_state_c->gs_btbl_nursery);
+	return (NULL);
+}
+
+/* Adds an unmanaged page to the remembered set (gs_wb_pages). */
+static void
+gc_wb_unmanaged(uint64_t page)
+{
+	_gc_cap uint64_t *pages;
+	size_t sz;
+
+	/* Runs of stores to the same page are common. */
+	if (gc_state_c->gs_wb_n != 0 &&
+	    gc_state_c->gs_wb_pages[gc_state_c->gs_wb_n - 1] == page)
+		return;
+	if (gc_state_c->gs_wb_n == gc_state_c->gs_wb_sz) {
+		sz = gc_state_c->gs_wb_sz != 0 ?
+		    2 * gc_state_c->gs_wb_sz : GC_PAGESZ / sizeof(uint64_t);
+		pages = gc_alloc_internal(sz * sizeof(uint64_t));
+		if (pages == NULL) {
+			gc_state_c->gs_wb_ovf = 1;
+			return;
+		}
+		if (gc_state_c->gs_wb_sz != 0) {
+			memcpy((void *)pages, (void *)gc_state_c->gs_wb_pages,
+			    gc_state_c->gs_wb_n * sizeof(uint64_t));
+			munmap((void *)gc_state_c->gs_wb_pages,
+			    gc_state_c->gs_wb_sz * sizeof(uint64_t));
+		}
+		gc_state_c->gs_wb_pages = pages;
+		gc_state_c->gs_wb_sz = sz;
+	}
+	gc_state_c->gs_wb_pages[gc_state_c->gs_wb_n++] = page;
+}
+
+void
+gc_wb(_gc_cap void *slot, _gc_cap void *val)
+{
+	_gc_cap struct gc_btbl *btbl;
+	uint64_t addr, base;
+
+	if (!gc_cheri_gettag(val))
+		return;
+	/* Only old-to-young references need remembering. */
+	if (gc_state_c->gs_gen_mode == GC_GEN_NURSERY &&
+	    !gc_btbl_contains(&gc_state_c->gs_btbl_nursery,
+	    gc_cheri_getbase(val)))
+		return;
+	addr = gc_cheri_getbase(slot) + gc_cheri_getoffset(slot);
+	btbl = gc_get_managed_btbl(addr);
+	if (btbl == NULL) {
+		GC_LOCK();
+		gc_wb_unmanaged(addr & ~(uint64_t)GC_PAGEMASK);
+		GC_UNLOCK();
+		return;
+	}
+	if (btbl->bt_cards == NULL)
+		return;
+	base = gc_cheri_getbase(btbl->bt_base);
+	GC_BIT_SET(btbl->bt_cards, (addr - base) / GC_PAGESZ);
+}
+
+int
+gc_set_gen_mode(int mode)
+{
+
+	GC_LOCK();
+	/* Can't change the rules halfway through a collection. */
+	if (gc_state_c->gs_mark_state != GC_MS_NONE) {
+		GC_UNLOCK();
+		return (GC_ERROR);
+	}
+	gc_sweep_finish();
+	/* Other modes expect all mark bits clear between collections. */
+	if (gc_state_c->gs_gen_mode == GC_GEN_STICKY && mode != GC_GEN_STICKY)
+		gc_clear_marks();
+	/*
+	 * Nothing maintains the remembered set for young blocks in the
+	 * other modes, so they can't be left young for a later return
+	 * to GC_GEN_NURSERY.
+	 */
+	if (gc_state_c->gs_gen_mode == GC_GEN_NURSERY &&
+	    mode != GC_GEN_NURSERY)
+		gc_promote_nursery();
+	if (mode == GC_GEN_NURSERY && !gc_state_c->gs_btbl_nursery.bt_valid)
+		gc_alloc_btbl(&gc_state_c->gs_btbl_nursery, GC_PAGESZ,
+		    GC_NURSERY_NSLOTS, GC_BTBL_FLAG_SMALL |
+		    GC_BTBL_FLAG_MANAGED | GC_BTBL_FLAG_NURSERY);
+	gc_state_c->gs_gen_mode = mode;
+	GC_UNLOCK();
+	return (GC_SUCC);
 }
 
 void
 gc_free(_gc_cap void *ptr)
 {
+	_gc_cap void *c16;
+
+	GC_LOCK();
+	if (GC_INIT_HEAP() != GC_SUCC) {
+		GC_UNLOCK();
+		return;
+	}
+	gc_state_c->gs_stack = gc_vm_get_stack(&gc_state_c->gs_vt);
+	c16 = gc_state_c->gs_regs_c;
+	__asm__ __volatile__ (
+		"cmove $c16, %0" : : "C"(c16) : "memory", "$c16"
+	);
+	GC_SAVE_REGS(16);
+	gc_free_entry(ptr);
+	GC_RESTORE_REGS(16);
+	GC_UNLOCK();
+	GC_INVALIDATE_UNUSED_REGS;
+}
+
+void
+gc_free_entry(_gc_cap void *ptr)
+{
+	int rc;
 
-	gc_error("unimplemented: gc_free");
+	rc = gc_get_obj(ptr, NULL, NULL, NULL, NULL, NULL);
+	if (gc_ty_is_unmanaged(rc) || gc_ty_is_free(rc) ||
+	    gc_ty_is_revoked(rc)) {
+		gc_warn("gc_free: not an allocated object: %s",
+		    gc_cap_str(ptr));
+		return;
+	}
+	/* Quarantine the object until the batch is big enough. */
+	(void)gc_revoke_entry(ptr, 1);
+	if (gc_state_c->gs_rv_bytes >= gc_state_c->gs_quarantine)
+		gc_revoke_commit_entry();
 }
 
 int
 gc_revoke(_gc_cap void *ptr)
+{
+	int rc;
+
+	GC_LOCK();
+	rc = gc_revoke_entry(ptr, 0);
+	GC_UNLOCK();
+	return (rc);
+}
+
+int
+gc_revoke_entry(_gc_cap void *ptr, int quar)
 {
 	int rc;
 	_gc_cap struct gc_btbl *bt;
@@ -819,16 +1515,22 @@ gc_revoke(_gc_cap void *ptr)
 	    gc_cheri_ptr(&sidx, sizeof(sidx)));
 	if (gc_ty_is_unmanaged(rc))
 		return (rc);
+	gc_trace(GC_TRACE_REVOKE, gc_cheri_getbase(obj), bidx, rc);
 
 	if (bt->bt_flags & GC_BTBL_FLAG_SMALL) {
 		blk->bk_revoked |= 1ULL << sidx;
+		blk->bk_reuse &= ~(1ULL << sidx);
 	} else {
 		i = GC_BTBL_MAPINDX(bidx);
-		j = GC_BTBL_BYTINDX(bidx);
+		j = bidx;
 		type = GC_BTBL_GETTYPE(bt->bt_map[i], j);
+		type &= ~GC_BTBL_REUSE_MASK;
 		type = gc_ty_set_revoked(type);
 		GC_BTBL_SETTYPE(bt->bt_map[i], j, type);
 	}
+	if (gc_revoke_queue(gc_cheri_getbase(obj), gc_cheri_getlen(obj),
+	    quar) != 0)
+		gc_error("couldn't queue revocation of %s", gc_cap_str(obj));
 
 	return (rc);
 }
@@ -836,8 +1538,74 @@ gc_revoke(_gc_cap void *ptr)
 void
 gc_reuse(_gc_cap void *ptr)
 {
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_blk *blk;
+	size_t bidx, sidx;
+	int rc;
+	uint8_t byte;
+
+	GC_LOCK();
+	rc = gc_get_obj(ptr, NULL,
+	    gc_cheri_ptr(&bt, sizeof(bt)),
+	    gc_cheri_ptr(&bidx, sizeof(bidx)),
+	    gc_cheri_ptr(&blk, sizeof(blk)),
+	    gc_cheri_ptr(&sidx, sizeof(sidx)));
+	/* Revoked objects are already on their way out. */
+	if (gc_ty_is_unmanaged(rc) || gc_ty_is_free(rc) ||
+	    gc_ty_is_revoked(rc)) {
+		GC_UNLOCK();
+		return;
+	}
+	if (bt->bt_flags & GC_BTBL_FLAG_SMALL)
+		blk->bk_reuse |= 1ULL << sidx;
+	else {
+		byte = bt->bt_map[GC_BTBL_MAPINDX(bidx)];
+		GC_BTBL_SETTYPE(byte, bidx, GC_BTBL_GETTYPE(byte, bidx) |
+		    GC_BTBL_REUSE_MASK);
+		bt->bt_map[GC_BTBL_MAPINDX(bidx)] = byte;
+	}
+	GC_UNLOCK();
+}
+
+int
+gc_set_poison(int mode)
+{
+	int old;
+
+	old = gc_state_c->gs_poison;
+	gc_state_c->gs_poison = mode;
+	return (old);
+}
+
+int
+gc_zero_pages(void *addr, size_t len)
+{
+	void *ptr;
+
+	/* The kernel supplies zero pages lazily on first touch. */
+	ptr = mmap(addr, len, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+	return (ptr != addr);
+}
+
+size_t
+gc_set_quarantine(size_t bytes)
+{
+	size_t old;
+
+	old = gc_state_c->gs_quarantine;
+	gc_state_c->gs_quarantine = bytes;
+	return (old);
+}
+
+size_t
+gc_set_release_min(size_t minpages)
+{
+	size_t old;
 
-	gc_error("unimplemented: gc_reuse");
+	old = gc_state_c->gs_release_min;
+	gc_state_c->gs_release_min = minpages;
+	return (old);
 }
 
 _gc_cap void *
@@ -850,6 +1618,98 @@ gc_alloc_internal(size_t sz)
 	return (ptr != NULL ? gc_cheri_ptr(ptr, sz) : NULL);
 }
 
+/*
+ * Maps len bytes aligned to align (a power of 2) by mapping an extra
+ * align bytes and trimming. Returns NULL iff error.
+ */
+static char *
+gc_mmap_aligned(size_t len, size_t align, int prot)
+{
+	char *ptr, *aligned;
+
+	ptr = mmap(NULL, len + align, prot, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (ptr == MAP_FAILED)
+		return (NULL);
+	aligned = (char *)(((uintptr_t)ptr + align - 1) &
+	    ~(uintptr_t)(align - 1));
+	if (aligned != ptr)
+		munmap(ptr, aligned - ptr);
+	munmap(aligned + len, ptr + align - aligned);
+	return (aligned);
+}
+
+_gc_cap void *
+gc_alloc_super(size_t sz)
+{
+	char *aligned;
+	size_t len;
+
+	len = GC_SUPER_ROUND(sz);
+	gc_debug("internal allocator: request %zu bytes (superpages)", len);
+#ifdef MAP_ALIGNED_SUPER
+	aligned = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_ALIGNED_SUPER, -1, 0);
+	if (aligned == MAP_FAILED)
+		return (NULL);
+#else
+	aligned = gc_mmap_aligned(len, GC_SUPERPAGESZ,
+	    PROT_READ | PROT_WRITE);
+	if (aligned == NULL)
+		return (NULL);
+#endif
+#ifdef MADV_HUGEPAGE
+	if (madvise(aligned, len, MADV_HUGEPAGE) != 0)
+		gc_warn("madvise(MADV_HUGEPAGE) failed at %p", aligned);
+#endif
+	return (gc_cheri_ptr(aligned, sz));
+}
+
+int
+gc_heap_reserve(void)
+{
+	char *ptr;
+
+	ptr = gc_mmap_aligned(GC_HEAP_RESERVE, GC_CHUNKSZ, PROT_NONE);
+	if (ptr == NULL)
+		return (GC_ERROR);
+	gc_state_c->gs_hp_base = (uint64_t)(uintptr_t)ptr;
+	gc_state_c->gs_hp_top = gc_state_c->gs_hp_base + GC_HEAP_RESERVE;
+	gc_state_c->gs_hp_next = gc_state_c->gs_hp_base;
+	gc_debug("reserved %zu bytes for the heap at %p",
+	    GC_HEAP_RESERVE, ptr);
+	return (GC_SUCC);
+}
+
+_gc_cap void *
+gc_heap_commit(_gc_cap struct gc_btbl *btbl, size_t sz)
+{
+	uint64_t addr;
+	size_t len, i;
+
+	len = (sz + GC_CHUNKSZ - 1) & ~(GC_CHUNKSZ - 1);
+	if (gc_state_c->gs_hp_base == 0 ||
+	    gc_state_c->gs_hp_top - gc_state_c->gs_hp_next < len)
+		return (NULL);
+	addr = gc_state_c->gs_hp_next;
+	/* The rest of the last chunk stays inaccessible. */
+	if (mprotect((void *)addr, GC_ROUND_PAGESZ(sz),
+	    PROT_READ | PROT_WRITE) != 0) {
+		gc_warn("mprotect failed for %zu bytes at %p",
+		    sz, (void *)addr);
+		return (NULL);
+	}
+#if defined(GC_USE_SUPERPAGES) && defined(MADV_HUGEPAGE)
+	if (madvise((void *)addr, GC_ROUND_PAGESZ(sz), MADV_HUGEPAGE) != 0)
+		gc_warn("madvise(MADV_HUGEPAGE) failed at %p", (void *)addr);
+#endif
+	gc_state_c->gs_hp_next += len;
+	for (i = (addr - gc_state_c->gs_hp_base) >> GC_LOG_CHUNKSZ;
+	    i < (gc_state_c->gs_hp_next - gc_state_c->gs_hp_base) >>
+	    GC_LOG_CHUNKSZ; i++)
+		gc_state_c->gs_chunk[i] = btbl;
+	return (gc_cheri_ptr((void *)addr, sz));
+}
+
 int
 gc_get_obj_big(_gc_cap void *ptr,
     _gc_cap struct gc_btbl *bt,
@@ -970,53 +1830,38 @@ gc_get_obj(_gc_cap void *ptr,
     _gc_cap struct gc_blk * _gc_cap *out_blk,
     _gc_cap size_t *out_sml_indx)
 {
-	int rc;
-	_gc_cap struct gc_vm_ent *ve;
-	uint64_t base;
+	_gc_cap struct gc_btbl *bt;
 
 	ptr = gc_cheri_setoffset(ptr, 0); /* sanitize */
 
+	bt = gc_get_managed_btbl(gc_cheri_getbase(ptr));
 	if (out_btbl != NULL)
-		*out_btbl = NULL;
-
-	/* Try small region. */
-	rc = gc_get_obj_small(ptr, &gc_state_c->gs_btbl_small,
-	    out_ptr, out_big_indx, out_blk, out_sml_indx);
-	if (out_btbl != NULL)
-		*out_btbl = &gc_state_c->gs_btbl_small;
-	if (!gc_ty_is_unmanaged(rc))
-		return (rc);
-
-	/* Try big region. */
-	rc = gc_get_obj_big(ptr, &gc_state_c->gs_btbl_big,
-	    out_ptr, out_big_indx);
-	if (out_btbl != NULL)
-		*out_btbl = &gc_state_c->gs_btbl_big;
-	if (!gc_ty_is_unmanaged(rc))
-		return (rc);
+		*out_btbl = bt;
+	if (bt != NULL)
+		return (gc_get_obj_bt(ptr, bt, out_ptr, out_big_indx,
+		    out_blk, out_sml_indx));
 
-	gc_debug("gc_get_obj: pointer %s is in neither big nor small region", gc_cap_str(ptr));
-	/* Don't do this because not sure of size of object. */
 	/*
-	 * In neither; must be unmanaged by the GC, but potentially
-	 * trackable in the VM mappings, so we try those.
+	 * Unmanaged. The VM mappings' btbls aren't consulted, as they
+	 * don't record object sizes.
 	 */
-	/*
-	base = gc_cheri_getbase(ptr);
-	ve = gc_vm_tbl_find(&gc_state_c->gs_vt, base);
-	if (ve == NULL)
-		return (GC_BTBL_UNMANAGED);
-	gc_debug("note: found a VM ent for it: " GC_DEBUG_VE_FMT, GC_DEBUG_VE_PRI(ve));
-	gc_debug("note: found a btbl for it: %s", gc_cap_str(ve->ve_bt));
-	rc = gc_get_obj_bt(ptr, ve->ve_bt, out_ptr, out_big_indx,
-	    out_blk, out_sml_indx);
-	if (out_btbl != NULL)
-		*out_btbl = ve->ve_bt;
-	return (rc);*/
-	(void)ve;
-	(void)base;
+	gc_debug("gc_get_obj: pointer %s is in no managed btbl",
+	    gc_cap_str(ptr));
 	return (GC_BTBL_UNMANAGED);
+}
 
+void
+gc_btbl_set_notags(_gc_cap struct gc_btbl *btbl, size_t page_indx)
+{
+
+	if (btbl->bt_notags == NULL)
+		return;
+	if (btbl->bt_tags[page_indx].tg_v &&
+	    btbl->bt_tags[page_indx].tg_lo == 0 &&
+	    btbl->bt_tags[page_indx].tg_hi == 0)
+		GC_BIT_SET(btbl->bt_notags, page_indx);
+	else
+		GC_BIT_CLR(btbl->bt_notags, page_indx);
 }
 
 struct gc_tags
@@ -1030,6 +1875,7 @@ gc_get_or_update_tags(_gc_cap struct gc_btbl *btbl, size_t page_indx)
 		page = gc_cheri_setlen(page, GC_PAGESZ);
 		page = gc_cheri_setoffset(page, 0);
 		btbl->bt_tags[page_indx] = gc_get_page_tags(page);
+		gc_btbl_set_notags(btbl, page_indx);
 	}
 
 	return (btbl->bt_tags[page_indx]);
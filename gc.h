@@ -7,14 +7,23 @@
 #ifndef _GC_H_
 #define _GC_H_
 
+#ifdef GC_USE_PTHREAD
+#include <pthread.h>
+#endif
 #include <stdlib.h>
 
 #include "gc_cheri.h"
+#include "gc_event.h"
+#include "gc_evac.h"
+#include "gc_prof.h"
+#include "gc_revoke.h"
 #include "gc_scan.h"
 #include "gc_stack.h"
 #include "gc_ts.h"
 #include "gc_vm.h"
 
+struct gc_stats;
+
 struct gc_blk {
 	_gc_cap struct gc_blk	*bk_next;	/* next block in the list */
 	_gc_cap struct gc_blk	*bk_prev;	/* prev block in the list */
@@ -22,8 +31,43 @@ struct gc_blk {
 	uint64_t		 bk_marks;	/* mark bits for each object */
 	uint64_t		 bk_free;	/* free bits for each object */
 	uint64_t		 bk_revoked;	/* revoked flag for each object */
+	uint64_t		 bk_reuse;	/* gc_reuse hint for each object */
+	uint32_t		 bk_flags;	/* GC_BLK_FLAG_* */
+	uint32_t		 bk_epoch;	/* gs_epoch when last swept */
+	uint32_t		 bk_occ;	/* occupancy list (GC_OCC_*) */
 };
 
+/*
+ * Each size class keeps its used blocks on GC_OCC_NLIST lists, by
+ * occupancy: list b < GC_OCC_NBKT holds blocks with between
+ * b / GC_OCC_NBKT and (b + 1) / GC_OCC_NBKT of their object slots in
+ * use, and list GC_OCC_FULL holds full blocks. The allocator takes
+ * objects from the fullest non-full blocks first, so that sparse
+ * blocks are left to drain and be freed by the sweep. Blocks move
+ * between lists as they fill (gc_malloc_small) and as they are swept
+ * (gc_blk_rebucket).
+ */
+#define	GC_OCC_NBKT		4
+#define	GC_OCC_FULL		GC_OCC_NBKT
+#define	GC_OCC_NLIST		(GC_OCC_NBKT + 1)
+
+/*
+ * The block lives in the nursery btbl but has been promoted to the
+ * old generation (see GC_GEN_NURSERY).
+ */
+#define	GC_BLK_FLAG_OLD		0x00000001
+/*
+ * The block only stores objects allocated by gc_malloc_atomic; it is
+ * on the gs_leaf lists and its objects are never scanned.
+ */
+#define	GC_BLK_FLAG_LEAF	0x00000002
+/*
+ * Used during evacuation (see gc_evac.h): the block is referenced from
+ * somewhere its objects can't be moved from, or is being emptied.
+ */
+#define	GC_BLK_FLAG_PINNED	0x00000004
+#define	GC_BLK_FLAG_EVAC	0x00000008
+
 /*
  * Block table.
  *
@@ -63,6 +107,35 @@ struct gc_blk {
  * Note that the tags are indexed by page, whereas the map is
  * indexed by slot.
  *
+ * For managed btbls, bt_cards holds one dirty bit per page, set by
+ * the capability store barrier (gc_wb) in the generational modes. The
+ * dirty pages of the old generation form the remembered set scanned by
+ * minor collections.
+ *
+ * For managed btbls, bt_notags holds one bit per page, set when the
+ * cached tags for the page are valid and all zero. It is kept in sync
+ * with bt_tags (see gc_btbl_set_notags), so the marker can skip runs
+ * of capability-free pages a word at a time.
+ *
+ * For managed btbls, bt_leaf holds one bit per slot, set when the
+ * object starting at that slot was allocated by gc_malloc_atomic. Only
+ * the bit of the first slot of a used object is meaningful. Small
+ * blocks use GC_BLK_FLAG_LEAF instead.
+ *
+ * For managed btbls, bt_decommit holds one bit per page, set when the
+ * page has been returned to the OS after a sweep (see
+ * gc_btbl_release). Such pages are always free in the map; the bit is
+ * cleared again when a slot on the page is allocated, and the kernel
+ * recommits the page lazily on first touch.
+ *
+ * For the btbls of the VM table (ve_bt), bt_scanned holds one bit per
+ * page, set when the marker scans the page as part of an unmanaged
+ * object, so that each page is scanned at most once however many
+ * references lead to it (and cycles of unmanaged objects terminate).
+ * The bits belong to the root push numbered bt_scan_epoch; they are
+ * cleared lazily, the first time the btbl is used after gs_scan_epoch
+ * moves on.
+ *
  * flags & GC_BTBL_FLAG_SMALL:
  * The data blocks store small objects.
  * Four-bit entry for each page from the base.
@@ -89,9 +162,23 @@ struct gc_btbl {
 	int		 bt_flags;	/* flags */
 	_gc_cap uint8_t	*bt_map;	/* size: bt_nslots/4 */
 	_gc_cap struct gc_tags	*bt_tags;	/* array of tags for each page */
+	_gc_cap uint64_t	*bt_decommit;	/* page released bits, or NULL */
+	_gc_cap uint64_t	*bt_cards;	/* page dirty bits, or NULL */
+	_gc_cap uint64_t	*bt_notags;	/* page tag-free bits, or NULL */
+	_gc_cap uint64_t	*bt_leaf;	/* slot pointer-free bits, or NULL */
+	_gc_cap uint64_t	*bt_scanned;	/* page scanned bits, or NULL */
+	uint32_t	 bt_scan_epoch;	/* gs_scan_epoch of bt_scanned */
+	size_t		 bt_sweep;	/* lazy sweep cursor (slot index) */
+	int		 bt_freecont;	/* lazy sweep is freeing CONT slots */
 	int		 bt_valid;	/* used by gc_vm.c */
 };
 
+/* Operations on bitmaps stored as arrays of uint64_t. */
+#define	GC_BIT_ISSET(map, i)	(((map)[(i) / 64] >> ((i) % 64)) & 1)
+#define	GC_BIT_SET(map, i)	((map)[(i) / 64] |= 1ULL << ((i) % 64))
+#define	GC_BIT_CLR(map, i)	((map)[(i) / 64] &= ~(1ULL << ((i) % 64)))
+#define	GC_BIT_NWORDS(n)	(((n) + 63) / 64)
+
 /* Construct an index into the map. */
 #define	GC_BTBL_MKINDX(i, j)	((i) * 2 + (j))
 
@@ -144,6 +231,9 @@ struct gc_btbl {
 #define GC_STACKSZ		(4*GC_PAGESZ)
 
 #define GC_BLK_HDRSZ		(sizeof(struct gc_blk))
+/* Tag bits (of gc_tags.tg_lo) covering the block header. */
+#define GC_BLK_HDR_TAGS		\
+	((1ULL << ((GC_BLK_HDRSZ + GC_TAG_GRAN - 1) / GC_TAG_GRAN)) - 1ULL)
 
 /*
  * The btbl map has entries of the form 0byyxx.
@@ -157,6 +247,8 @@ struct gc_btbl {
 #define GC_BTBL_TYPE_MASK	((uint8_t)0x3)
 #define GC_BTBL_UNMANAGED	((uint8_t)0xF)	/* obj unmanaged */
 #define GC_BTBL_REVOKED_MASK	((uint8_t)0x4)	/* obj revoked flag */
+/* gc_reuse hint flag; never set with GC_BTBL_REVOKED_MASK (see above). */
+#define GC_BTBL_REUSE_MASK	((uint8_t)0x8)
 
 /*
  * The objects stored in this btbl are small: that is, small enough
@@ -171,6 +263,158 @@ struct gc_btbl {
  */
 #define GC_BTBL_FLAG_MANAGED	0x00000002
 
+/*
+ * The btbl is the nursery: fresh small objects are allocated here in
+ * GC_GEN_NURSERY mode. Blocks without GC_BLK_FLAG_OLD are young.
+ */
+#define GC_BTBL_FLAG_NURSERY	0x00000004
+
+/*
+ * The btbl's memory is a GC_SUPERPAGESZ-aligned reservation that the
+ * kernel may back with superpages (see gc_alloc_super). Page release
+ * then only returns whole superpages, and gc_fill_zero never remaps,
+ * as either would demote the superpage to base pages.
+ */
+#define GC_BTBL_FLAG_SUPER	0x00000008
+
+/*
+ * The btbl's map (and the tags and bits that follow it) came from
+ * gc_alloc_super, so its mapping is longer than bt_map's bounds.
+ */
+#define GC_BTBL_FLAG_SUPERMAP	0x00000010
+
+/*
+ * Generational modes (gs_gen_mode).
+ *
+ * GC_GEN_NONE
+ * Every collection is a full collection.
+ *
+ * GC_GEN_NURSERY
+ * Small objects are allocated in the nursery btbl. When the nursery
+ * is full, a minor collection (gc_collect_minor) marks only young
+ * blocks, tracing from the roots and from the remembered set (the
+ * dirty pages of the old generation). A young block with survivors
+ * is then promoted in place: it is flagged GC_BLK_FLAG_OLD and moves
+ * from the nursery size-class lists to the old ones (gs_heap). Big
+ * objects always belong to the old generation.
+ *
+ * GC_GEN_STICKY
+ * Non-moving generations by sticky mark bits: sweeps leave the mark
+ * bits of surviving objects set, so marked objects are old and
+ * unmarked ones are young. A minor collection traces from the roots
+ * and the dirty pages into unmarked objects only and frees those left
+ * unmarked; a full collection clears all mark bits first. Every
+ * GC_MINOR_PER_MAJOR minor collections, a full one is done instead to
+ * reclaim old garbage.
+ *
+ * In the generational modes, clients must store capabilities into
+ * collector-allocated objects, and into unmanaged memory other than
+ * the stack and the registered root ranges, with GC_STORE_CAP. The
+ * pages of unmanaged memory written this way are remembered in
+ * gs_wb_pages and scanned by minor collections; a young object
+ * referenced only through unmanaged memory written without the
+ * barrier (e.g., by memcpy) is freed by the next minor collection.
+ *
+ * Leaving GC_GEN_NURSERY promotes every young block, as stores made
+ * in the other modes do not maintain the remembered set for them.
+ * Promoted blocks stay in the nursery btbl until a full collection
+ * frees them; while no young blocks are left, small allocations that
+ * don't fit in the nursery go to the old generation without a minor
+ * collection, and once a nursery's worth has gone there since the
+ * last collection, a full collection is done to reclaim the slots.
+ */
+#define GC_GEN_NONE		0
+#define GC_GEN_NURSERY		1
+#define GC_GEN_STICKY		2
+
+/* Maximum number of minor collections between full collections. */
+#define GC_MINOR_PER_MAJOR	16
+
+/* Number of GC_PAGESZ blocks in the nursery. */
+#define GC_NURSERY_NSLOTS	64
+
+/*
+ * Poisoning modes (gs_poison), selecting how gc_fill_used_mem and
+ * gc_fill_free_mem initialize object memory.
+ *
+ * GC_POISON_NONE
+ * Memory is never touched. Fresh objects contain whatever was there
+ * before, including stale capabilities, so this is only safe for
+ * clients that initialize every capability-sized slot themselves.
+ *
+ * GC_POISON_ZERO
+ * Fresh objects are zeroed once, at allocation. Swept memory is not
+ * written. Large runs of whole pages are zeroed by remapping them
+ * (see gc_zero_pages) rather than by stores.
+ *
+ * GC_POISON_PATTERN
+ * Fresh objects are filled with GC_MAGIC_INIT_USE (and the rounding
+ * slack with GC_MAGIC_INIT_INTERNAL); swept memory is filled with
+ * GC_MAGIC_INIT_FREE. Doubles allocation and sweep memory traffic.
+ *
+ * PATTERN is the default, so freed memory stays poisoned as it always
+ * has been. Build with -DGC_POISON_DEFAULT=GC_POISON_ZERO, or call
+ * gc_set_poison, to trade that for cheaper allocation.
+ */
+#define GC_POISON_NONE		0
+#define GC_POISON_ZERO		1
+#define GC_POISON_PATTERN	2
+
+#ifndef GC_POISON_DEFAULT
+#define GC_POISON_DEFAULT	GC_POISON_PATTERN
+#endif
+
+/*
+ * Runs of at least this many bytes of whole pages are zeroed by
+ * remapping instead of by stores.
+ */
+#define GC_ZERO_MAP_MIN		(16 * GC_PAGESZ)
+
+/*
+ * After a btbl is swept, runs of at least gs_release_min free pages
+ * are returned to the OS with madvise(GC_RELEASE_ADVICE). Zero
+ * disables page release.
+ */
+#ifndef GC_RELEASE_MIN_DEFAULT
+#define GC_RELEASE_MIN_DEFAULT	8
+#endif
+#define GC_RELEASE_ADVICE	MADV_FREE
+
+/*
+ * With GC_USE_SUPERPAGES, btbl memory (heap, and map and tags) of at
+ * least GC_SUPERPAGESZ bytes is reserved superpage-aligned, to cut TLB
+ * misses while marking and sweeping large heaps.
+ */
+#define GC_SUPERPAGESZ		((size_t)2 * 1024 * 1024)
+#define GC_SUPER_NPAGES		(GC_SUPERPAGESZ / GC_PAGESZ)
+/* Length actually mapped by gc_alloc_super for sz bytes. */
+#define GC_SUPER_ROUND(sz)	\
+	(((sz) + GC_SUPERPAGESZ - 1) & ~(GC_SUPERPAGESZ - 1))
+
+/*
+ * Managed heap reservation.
+ *
+ * gc_init reserves GC_HEAP_RESERVE bytes of address space (PROT_NONE),
+ * aligned to GC_CHUNKSZ, and gc_alloc_btbl commits the memory of each
+ * managed btbl from it, starting on a fresh chunk. gs_chunk records the
+ * btbl of every chunk, so finding the btbl of an address is a range
+ * compare and an array index. A btbl that doesn't fit (or every btbl,
+ * if the reservation failed) is mapped on its own, as before, and is
+ * then found by testing each btbl's bounds (gs_hp_spill).
+ *
+ * Chunks are superpage-aligned, so that GC_USE_SUPERPAGES also applies
+ * to committed btbls.
+ */
+#define GC_LOG_CHUNKSZ		21
+#define GC_CHUNKSZ		((size_t)1 << GC_LOG_CHUNKSZ)
+#ifndef GC_HEAP_RESERVE
+#define GC_HEAP_RESERVE		((size_t)1024 * 1024 * 1024)
+#endif
+#define GC_HEAP_NCHUNK		(GC_HEAP_RESERVE / GC_CHUNKSZ)
+
+/* Maximum number of static regions (gs_static). */
+#define GC_NSTATIC		64
+
 #define GC_MS_NONE	0	/* not collecting */
 #define GC_MS_MARK	1	/* marking */
 #define GC_MS_SWEEP	2	/* sweeping */
@@ -185,12 +429,38 @@ struct gc_state {
 	 */
 	int			 gs_enter_cmdln_on_log;
 
+	/* Poisoning mode (GC_POISON_*). */
+	int			 gs_poison;
+	/* Minimum run of free pages to release after sweep (0: never). */
+	size_t			 gs_release_min;
+
 	/* Small objects: allocated from pools, individual block headers. */
-	_gc_cap struct gc_blk	*gs_heap[GC_LOG_BIGSZ];
+	_gc_cap struct gc_blk	*gs_heap[GC_LOG_BIGSZ][GC_OCC_NLIST];
 	_gc_cap struct gc_blk	*gs_heap_free;
+	/* Small pointer-free objects (GC_BLK_FLAG_LEAF blocks). */
+	_gc_cap struct gc_blk	*gs_leaf[GC_LOG_BIGSZ][GC_OCC_NLIST];
 	struct gc_btbl		 gs_btbl_small;
 	/* Large objects: allocated by bump-the-pointer, no block headers. */
 	struct gc_btbl		 gs_btbl_big;
+	/* Generational mode (GC_GEN_*). */
+	int			 gs_gen_mode;
+	/* Non-zero while a minor collection is in progress. */
+	int			 gs_minor;
+	/* Minor collections since the last full collection. */
+	int			 gs_nminor;
+	/* Young small objects; only valid in GC_GEN_NURSERY mode. */
+	_gc_cap struct gc_blk	*gs_nursery[GC_LOG_BIGSZ][GC_OCC_NLIST];
+	struct gc_btbl		 gs_btbl_nursery;
+	/*
+	 * Remembered set for unmanaged memory: the pages that GC_STORE_CAP
+	 * has stored capabilities into since the last collection (gs_wb_n
+	 * entries used, gs_wb_sz allocated). gs_wb_ovf is set if the table
+	 * could not grow; the next minor collection is then a full one.
+	 */
+	_gc_cap uint64_t	*gs_wb_pages;
+	size_t			 gs_wb_n;
+	size_t			 gs_wb_sz;
+	int			 gs_wb_ovf;
 	/* Saved register and stack state; see gc_cheri.h. */
 	_gc_cap void		*gs_regs[GC_NUM_SAVED_REGS];
 	/* Points to gs_regs with correct bound. */
@@ -203,8 +473,20 @@ struct gc_state {
 	_gc_cap void		*gs_stack;
 	/* Capability to stack bottom; initialized once only. */
 	_gc_cap void		*gs_stack_bottom;
-	/* Capability to static data bottom; initialized once only. */
-	_gc_cap void		*gs_static_region;
+	/*
+	 * Writable (data and bss) segments of the program and of every
+	 * shared object loaded at gc_init; initialized once only.
+	 */
+	_gc_cap void		*gs_static[GC_NSTATIC];
+	size_t			 gs_nstatic;
+	/* Root ranges (see gc_roots.h): entries used and allocated. */
+	_gc_cap struct gc_root	*gs_roots;
+	size_t			 gs_nroots;
+	size_t			 gs_roots_sz;
+	/* Non-zero if root pages are write-protected once scanned. */
+	int			 gs_root_wp;
+	/* All heaps, this one included (see gc_heap.h). */
+	_gc_cap struct gc_heap_tbl	*gs_heaps;
 	/* Collector mark/sweep state. */
 	int			 gs_mark_state;
 	/* Mark stack. */
@@ -217,6 +499,73 @@ struct gc_state {
 	_gc_cap struct gc_stack	*gs_sweep_stack_c;
 	/* Table of memory mappings. */
 	struct gc_vm_tbl	 gs_vt;
+	/* Bytes allocated since the last collection began. */
+	size_t			 gs_allocbytes;
+	/*
+	 * Non-zero while a concurrent mark is in progress; GC_STORE_CAP
+	 * then records overwritten capabilities (see gc_conc.h).
+	 */
+	int			 gs_satb;
+	/* Concurrent collection modes (GC_CONC_*). */
+	int			 gs_conc;
+	/*
+	 * Non-zero while a lazy sweep is in progress. Small blocks whose
+	 * bk_epoch differs from gs_epoch have not been swept yet; other
+	 * btbls are swept up to bt_sweep.
+	 */
+	int			 gs_sweep_pending;
+	uint32_t		 gs_epoch;
+	/* Incremented by each root push; see bt_scanned. */
+	uint32_t		 gs_scan_epoch;
+	/* Revocation batch (see gc_revoke.h): entries used and allocated. */
+	_gc_cap struct gc_revoke_ent	*gs_rv;
+	size_t			 gs_rv_n;
+	size_t			 gs_rv_sz;
+	/* Bytes gc_free has put in the batch, and the commit threshold. */
+	size_t			 gs_rv_bytes;
+	size_t			 gs_quarantine;
+	/* Heap profile (see gc_prof.h), or NULL if never enabled. */
+	_gc_cap struct gc_prof	*gs_prof;
+	/* Sampling rate in bytes (0: off), and bytes until next sample. */
+	size_t			 gs_prof_rate;
+	size_t			 gs_prof_left;
+	/* Collection events and pause times (see gc_event.h). */
+	struct gc_event_log	 gs_ev;
+	/* Where gc_set_stats_signal snapshots are written. */
+	int			 gs_stats_fd;
+	/*
+	 * Evacuate sparse blocks in full collections (see gc_evac.h), and
+	 * whether the current collection does.
+	 */
+	int			 gs_evac;
+	int			 gs_evac_now;
+	/* Forwarding table: entries used and allocated. */
+	_gc_cap struct gc_evac_ent	*gs_fw;
+	size_t			 gs_fw_n;
+	size_t			 gs_fw_sz;
+	/* Non-zero once gc_init_heap has succeeded. */
+	int			 gs_ready;
+	/* Heap reservation: [gs_hp_base, gs_hp_top), next free chunk. */
+	uint64_t		 gs_hp_base;
+	uint64_t		 gs_hp_top;
+	uint64_t		 gs_hp_next;
+	/* Non-zero if some managed btbl lies outside the reservation. */
+	int			 gs_hp_spill;
+	/* btbl committed in each chunk of the reservation, or NULL. */
+	_gc_cap struct gc_btbl	*gs_chunk[GC_HEAP_NCHUNK];
+#ifdef GC_USE_PTHREAD
+	/* Held by the collector thread and by mutators inside the GC. */
+	pthread_mutex_t		 gs_lock;
+	/* Wakes the collector thread. */
+	pthread_cond_t		 gs_conc_cv;
+	pthread_t		 gs_conc_thr;
+	/* Asks the collector thread to exit. */
+	int			 gs_conc_stop;
+	/* Set by the collector thread when the mark stack drains. */
+	int			 gs_conc_done;
+	/* Allocation volume that starts a concurrent mark. */
+	size_t			 gs_conc_trigger;
+#endif
 #ifdef GC_COLLECT_STATS
 	/* Number of objects currently allocated (roughly). */
 	size_t			 gs_nalloc;
@@ -232,10 +581,14 @@ struct gc_state {
 	size_t			 gs_nsweepbytes;
 	/* Total number of collections */
 	size_t			 gs_ntcollect;
+	/* Total number of minor collections */
+	size_t			 gs_ntminor;
 	/* Total number of allocation requests of each small size */
 	size_t			 gs_ntalloc[GC_LOG_BIGSZ];
 	/* Total number of allocation requests of large sizes */
 	size_t			 gs_ntbigalloc;
+	/* Number of pages currently released to the OS. */
+	size_t			 gs_nrelease;
 #endif /* GC_COLLECT_STATS */
 };
 
@@ -302,6 +655,30 @@ int	gc_ty_is_unmanaged(uint8_t ty);
 uint8_t	gc_ty_set_unmanaged(uint8_t ty);
 
 int		 gc_init(void);
+/*
+ * Like gc_init, but only sets up the collector's state and reserves
+ * the heap's address space. The heap, the mark and sweep stacks and
+ * the VM table are allocated (and the VM map queried) by gc_init_heap,
+ * called on the first allocation or collection. Returns non-zero iff
+ * error.
+ */
+int		 gc_init_lazy(void);
+int		 gc_init_heap(void);
+/*
+ * Creates a heap of its own, to be used after gc_heap_switch and
+ * collected apart from the others; see gc_heap.h. Returns NULL iff
+ * error.
+ */
+_gc_cap struct gc_state	*gc_heap_new(void);
+/* Makes the heap current; returns the previous one, or NULL iff error. */
+_gc_cap struct gc_state	*gc_heap_switch(_gc_cap struct gc_state *_heap);
+/*
+ * Releases all the memory of a heap other than the default and current
+ * ones. Returns non-zero iff error.
+ */
+int		 gc_heap_destroy(_gc_cap struct gc_state *_heap);
+/* Returns non-zero iff the heap isn't set up and can't be. */
+#define	GC_INIT_HEAP()	(gc_state_c->gs_ready ? GC_SUCC : gc_init_heap())
 
 /*
  * Force collection. Saves regs, stack and calls gc_collect.
@@ -309,20 +686,217 @@ int		 gc_init(void);
 void		 gc_extern_collect(void);
 
 _gc_cap void	*gc_malloc(size_t _sz);
+/*
+ * Allocates an object that will never hold capabilities. The object
+ * comes from GC_BLK_FLAG_LEAF blocks or bt_leaf big slots, and the
+ * returned capability lacks CHERI_PERM_STORE_CAP. The marker sets its
+ * mark bit but never scans its contents.
+ */
+_gc_cap void	*gc_malloc_atomic(size_t _sz);
+/*
+ * Allocates an object of size _sz from the given small-object btbl,
+ * using (and extending) the given size class's GC_OCC_NLIST lists.
+ * New blocks get the given GC_BLK_FLAG_* flags. Returns NULL if the
+ * btbl has no free block.
+ */
+_gc_cap void	*gc_malloc_small(_gc_cap struct gc_btbl *_btbl,
+		    _gc_cap struct gc_blk **_list, size_t _sz, size_t _roundsz,
+		    uint32_t _flags);
+/*
+ * Explicitly free an object. The object is revoked and quarantined;
+ * once gs_quarantine bytes are in quarantine, gc_revoke_commit
+ * invalidates all references to them and frees them.
+ */
 void		 gc_free(_gc_cap void *_p);
+void		 gc_free_entry(_gc_cap void *_p);
 /*
- * Immediately revoke all access to the given capability.
+ * Revoke all access to the given capability.
  * This requires finding all outstanding references and invalidating
- * them before returning the object to the memory pool.
+ * them before returning the object to the memory pool: the object is
+ * queued in the revocation batch, and this happens for the whole batch
+ * at the next gc_revoke_commit (or, failing that, at the next full
+ * collection).
  */
 int		 gc_revoke(_gc_cap void *_p);
+/*
+ * Used by gc_revoke and gc_free; requires gs_lock. _quar is non-zero
+ * for gc_free, whose objects count towards gs_quarantine.
+ */
+int		 gc_revoke_entry(_gc_cap void *_p, int _quar);
+/*
+ * Invalidate all references to the objects revoked since the last
+ * commit, in a single pass over memory, and free the objects.
+ */
+void		 gc_revoke_commit(void);
 /*
  * Eventually re-use the given capability.
  * This returns the capability to the memory pool only when the last
- * reference to it is deleted.
+ * reference to it is deleted. The object is only flagged (bk_reuse, or
+ * GC_BTBL_REUSE_MASK for big objects); the first sweep to find it
+ * unreachable frees it without poisoning its memory or revoking
+ * references to it. The hint is not trusted: a hinted object that is
+ * still reachable is traced and kept as usual. The slot can't go back
+ * to its size class at once, as only a trace shows that the last
+ * reference is gone; use gc_free for that.
  */
 void		 gc_reuse(_gc_cap void *_p);
+/*
+ * Selects the poisoning mode (GC_POISON_*) for subsequent allocations
+ * and sweeps. Returns the previous mode.
+ */
+int		 gc_set_poison(int _mode);
+/*
+ * Selects the generational mode (GC_GEN_*), allocating the nursery if
+ * necessary. Returns non-zero iff error.
+ */
+int		 gc_set_gen_mode(int _mode);
+
+/*
+ * Capability store barrier.
+ *
+ * Stores val into *slot. During a concurrent mark, the overwritten
+ * capability is first recorded (snapshot-at-the-beginning); in the
+ * generational modes, the page containing slot is then recorded in
+ * the remembered set. Note that slot is evaluated several times.
+ */
+#define	GC_STORE_CAP(slot, val) do {					\
+		if (gc_state_c->gs_satb)				\
+			gc_satb(*(slot));				\
+		*(slot) = (val);					\
+		if (gc_state_c->gs_gen_mode != GC_GEN_NONE)		\
+			gc_wb((slot), *(slot));				\
+	} while (0)
+
+/* Used by GC_STORE_CAP. */
+void		 gc_wb(_gc_cap void *_slot, _gc_cap void *_val);
+void		 gc_satb(_gc_cap void *_old);
+
+/*
+ * Selects the concurrent collection modes:
+ *
+ * GC_CONC_MARK
+ * Full collections are marked on a background collector thread.
+ *
+ * GC_CONC_SWEEP
+ * Sweeping is lazy: mutators resume as soon as marking completes, and
+ * the collector thread sweeps block by block in the background. The
+ * allocator sweeps a block itself before allocating from it if the
+ * collector thread has not reached it yet.
+ *
+ * The collector thread is started when either mode is selected, and
+ * stopped when neither is. Returns non-zero iff error. Without
+ * GC_USE_PTHREAD, only GC_CONC_SWEEP is accepted, and then only the
+ * allocator and the next collection sweep.
+ */
+int		 gc_set_concurrent(int _modes);
+#define	GC_CONC_MARK	0x00000001
+#define	GC_CONC_SWEEP	0x00000002
+
+/* Locking around the collector's entry points; see gc_conc.h. */
+#ifdef GC_USE_PTHREAD
+#define	GC_LOCK()	pthread_mutex_lock(				\
+			    (pthread_mutex_t *)&gc_state_c->gs_lock)
+#define	GC_UNLOCK()	pthread_mutex_unlock(				\
+			    (pthread_mutex_t *)&gc_state_c->gs_lock)
+#else
+#define	GC_LOCK()	do {} while (0)
+#define	GC_UNLOCK()	do {} while (0)
+#endif
+/*
+ * Sets the number of quarantined bytes that makes gc_free commit the
+ * revocation batch (0: commit on every gc_free). Returns the previous
+ * value.
+ */
+size_t		 gc_set_quarantine(size_t _bytes);
+/*
+ * Sets the minimum run of free pages that is released to the OS after
+ * a sweep (0 disables release). Returns the previous value.
+ */
+size_t		 gc_set_release_min(size_t _minpages);
+/*
+ * Enables (non-zero) or disables evacuation of sparse small blocks in
+ * full collections (see gc_evac.h); off by default. Returns the
+ * previous setting.
+ */
+int		 gc_set_evacuate(int _on);
+/*
+ * Registers (or forgets) the range of the capability as a root, to be
+ * scanned by every collection; see gc_roots.h. The static segments are
+ * registered by gc_init. Return non-zero iff error.
+ */
+int		 gc_add_roots(_gc_cap void *_range);
+int		 gc_remove_roots(_gc_cap void *_range);
+/*
+ * Enables (non-zero) or disables write-protecting the pages of the root
+ * ranges, so that their tags need only be read again once they are
+ * written (see gc_roots.h); off by default. Returns the previous
+ * setting.
+ */
+int		 gc_set_root_wp(int _on);
+/*
+ * Samples an allocation every _bytes allocated bytes for the heap
+ * profile (0 stops sampling; see gc_prof.h). Returns the previous
+ * rate.
+ */
+size_t		 gc_set_prof_rate(size_t _bytes);
+/*
+ * Writes the heap profile to the given file descriptor in pprof's
+ * legacy heap format. Returns non-zero iff error (profiling was never
+ * enabled).
+ */
+int		 gc_prof_dump(int _fd);
+/*
+ * Sets the function called with each completed collection's event
+ * (NULL: none); see gc_event.h.
+ */
+void		 gc_set_event_fn(gc_event_fn *_fn, void *_arg);
+/*
+ * Copies up to _n of the most recent collection events, oldest first,
+ * to _buf. Returns the number copied.
+ */
+size_t		 gc_get_events(struct gc_event *_buf, size_t _n);
+/*
+ * Returns the given percentile (e.g. 99.9) of all stop-the-world
+ * pauses so far, in nanoseconds (0: no pauses yet).
+ */
+uint64_t	 gc_pause_pct(double _pct);
+/*
+ * Fills in a statistics snapshot (see gc_stats.h). Returns non-zero
+ * iff error.
+ */
+int		 gc_get_stats(struct gc_stats *_st);
+/*
+ * Writes a statistics snapshot to the given file descriptor as JSON.
+ * Returns non-zero iff error.
+ */
+int		 gc_stats_json(int _fd);
+/*
+ * On each delivery of the given signal, writes a JSON statistics
+ * snapshot to the given file descriptor (at the next allocation or
+ * collection; see gc_stats.h).
+ * Returns non-zero iff error.
+ */
+int		 gc_set_stats_signal(int _sig, int _fd);
 _gc_cap void	*gc_alloc_internal(size_t _sz);
+/*
+ * Like gc_alloc_internal, but reserves whole GC_SUPERPAGESZ-aligned
+ * superpages (MAP_ALIGNED_SUPER, or by trimming a larger mapping) and
+ * asks for transparent huge pages where the kernel has MADV_HUGEPAGE.
+ * Returns NULL iff error.
+ */
+_gc_cap void	*gc_alloc_super(size_t _sz);
+/* Reserves the managed heap range; returns non-zero iff error. */
+int		 gc_heap_reserve(void);
+/*
+ * Commits _sz bytes for the given btbl from the heap reservation.
+ * Returns NULL if the reservation is full (or error).
+ */
+_gc_cap void	*gc_heap_commit(_gc_cap struct gc_btbl *_btbl, size_t _sz);
+/*
+ * Replaces the given page-aligned range with fresh zero-filled pages.
+ * Returns non-zero iff error (the range is then left unmodified).
+ */
+int		 gc_zero_pages(void *_addr, size_t _len);
 void		 gc_print_map(_gc_cap struct gc_btbl *_btbl);
 size_t		 gc_round_pow2(size_t _x);
 size_t		 gc_log2(size_t _x);
@@ -330,6 +904,8 @@ int		 gc_first_bit(uint64_t _x);
 /* Initializes the given block table and allocates a map for it. */
 void		 gc_alloc_btbl(_gc_cap struct gc_btbl *_btbl, size_t _slotsz,
 		    size_t _nslots, int _flags);
+/* Unmaps the map of a block table, and its memory if not reserved. */
+void		 gc_free_btbl(_gc_cap struct gc_btbl *_btbl);
 /*
  * Allocates a free block from the given block table.
  * Returns non-zero iff error.
@@ -344,6 +920,61 @@ int		 gc_alloc_free_blk(_gc_cap struct gc_btbl *_btbl,
  */
 int		 gc_alloc_free_blks(_gc_cap struct gc_btbl *_btbl,
 		    _gc_cap struct gc_blk **_out_blk, int _len);
+/*
+ * Advances *_blk along its list to the first block with a free object,
+ * lazily sweeping the blocks it passes (each against its own btbl).
+ * Returns non-zero iff there is none.
+ */
+int		 gc_follow_free(_gc_cap struct gc_blk **_blk);
+/* Inserts a block at the head of a size-class list. */
+void		 gc_ins_blk(_gc_cap struct gc_blk *_blk,
+		    _gc_cap struct gc_blk **_list);
+/* Removes a block from a size-class list. */
+void		 gc_rm_blk(_gc_cap struct gc_blk *_blk,
+		    _gc_cap struct gc_blk **_list);
+/*
+ * Returns the size-class list that a used block of the given small
+ * btbl belongs on, given its bk_occ.
+ */
+_gc_cap struct gc_blk	**gc_blk_list(_gc_cap struct gc_btbl *_btbl,
+			    _gc_cap struct gc_blk *_blk);
+/* Returns the occupancy list (GC_OCC_*) for a used block. */
+uint32_t	 gc_blk_occ(_gc_cap struct gc_blk *_blk);
+/* Moves a used block to the list matching its occupancy. */
+void		 gc_blk_rebucket(_gc_cap struct gc_btbl *_btbl,
+		    _gc_cap struct gc_blk *_blk);
+/*
+ * Returns non-zero iff the given used block (or, when _blk is NULL,
+ * the big object) belongs to the young generation.
+ */
+int		 gc_is_young(_gc_cap struct gc_btbl *_btbl,
+		    _gc_cap struct gc_blk *_blk);
+/* Makes a young block old, moving it to the old size-class lists. */
+void		 gc_blk_promote(_gc_cap struct gc_btbl *_btbl,
+		    _gc_cap struct gc_blk *_blk);
+/* Returns non-zero iff the nursery holds young blocks. */
+int		 gc_nursery_young(void);
+/*
+ * Returns non-zero iff the given used object (big slot _big_indx, or
+ * an object in small block _blk) was allocated by gc_malloc_atomic.
+ */
+int		 gc_is_leaf(_gc_cap struct gc_btbl *_btbl, size_t _big_indx,
+		    _gc_cap struct gc_blk *_blk);
+/*
+ * Returns non-zero iff the current minor collection neither traces
+ * nor sweeps objects in the given block (or big object, when _blk is
+ * NULL) because they are old.
+ */
+int		 gc_minor_skip(_gc_cap struct gc_btbl *_btbl,
+		    _gc_cap struct gc_blk *_blk);
+/*
+ * Returns the managed btbl whose memory contains the given address,
+ * or NULL.
+ */
+_gc_cap struct gc_btbl	*gc_get_managed_btbl(uint64_t _addr);
+/* Returns non-zero iff the btbl's memory contains the given address. */
+int		 gc_btbl_contains(_gc_cap struct gc_btbl *_btbl,
+		    uint64_t _addr);
 const char	*binstr(uint8_t _b);
 /*
  * Sets the contents of the map of the block table to the given
@@ -351,6 +982,24 @@ const char	*binstr(uint8_t _b);
  */
 void		 gc_btbl_set_map(_gc_cap struct gc_btbl *_btbl,
 		    int _start, int _end, uint8_t _v);
+/* Returns non-zero iff every slot on the given page is free. */
+int		 gc_btbl_page_is_free(_gc_cap struct gc_btbl *_btbl,
+		    size_t _page_indx);
+/*
+ * Releases every run of at least _minpages free pages in the block
+ * table to the OS, and marks those pages as decommitted.
+ */
+void		 gc_btbl_release(_gc_cap struct gc_btbl *_btbl,
+		    size_t _minpages);
+/* Releases the given pages that are not already decommitted. */
+void		 gc_btbl_decommit(_gc_cap struct gc_btbl *_btbl,
+		    size_t _first_page, size_t _npages);
+/*
+ * Notes that the given slots are about to be used, clearing the
+ * decommitted bits of the pages they span.
+ */
+void		 gc_btbl_recommit(_gc_cap struct gc_btbl *_btbl,
+		    size_t _indx, size_t _nslots);
 /*
  * Sets an object as marked, and returns the *original* type of the
  * object before the mark was set (this can be used to check if the
@@ -469,5 +1118,10 @@ int		 gc_get_obj_big(_gc_cap void *ptr,
  */
 struct gc_tags	 gc_get_or_update_tags(_gc_cap struct gc_btbl *_btbl,
 		    size_t _page_indx);
+/*
+ * Update the bt_notags bit for the given page from its cached tags.
+ */
+void		 gc_btbl_set_notags(_gc_cap struct gc_btbl *_btbl,
+		    size_t _page_indx);
 
 #endif /* !_GC_H_ */
@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <link.h>
 #include <unistd.h>
 
 #include <stdlib.h>
@@ -8,15 +9,6 @@
 #include "gc_debug.h"
 #include "gc.h"
 
-/*
- * Defined by FreeBSD.
- * This is the top of the data section.
- */
-extern char	end;
-
-jmp_buf		gc_jmp_buf;
-void		(*gc_oldfn)(int);
-
 /*
  * This uses an undocumented FreeBSD sysctl.
  * Boehm uses it too.
@@ -45,65 +37,46 @@ gc_get_stack_bottom(void)
 	return (ret);
 }
 
-void
-gc_sigsegv_handler(int p)
+/* Records the writable PT_LOAD segments of one loaded object. */
+static int
+gc_static_phdr(struct dl_phdr_info *info, size_t size, void *arg)
 {
+	const Elf_Phdr *ph;
+	uintptr_t lo, hi;
+	int i;
 
-	longjmp(gc_jmp_buf, 1);
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		ph = &info->dlpi_phdr[i];
+		if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_W))
+			continue;
+		if (gc_state_c->gs_nstatic == GC_NSTATIC) {
+			gc_warn("too many static regions; ignoring the rest");
+			return (1);
+		}
+		lo = (uintptr_t)GC_ALIGN(info->dlpi_addr + ph->p_vaddr);
+		hi = GC_ROUND_ALIGN(info->dlpi_addr + ph->p_vaddr +
+		    ph->p_memsz);
+		gc_state_c->gs_static[gc_state_c->gs_nstatic++] =
+		    gc_cheri_ptr((void *)lo, hi - lo);
+		gc_debug("static region of %s: %s",
+		    info->dlpi_name[0] != '\0' ? info->dlpi_name : "(main)",
+		    gc_cap_str(gc_state_c->gs_static[gc_state_c->gs_nstatic -
+		    1]));
+	}
+	return (0);
 }
 
 /*
- * Determine bottom of data section.
- * Keep decrementing until we segfault.
- * Technically undefined behaviour, and non-portable.
- * We break out of infinite segfaulting by using setjmp/longjmp.
+ * Finds the data and bss of the program and of every shared object
+ * from their program headers, without touching the memory itself.
  */
-_gc_cap void *
-gc_get_static_region (void)
+size_t
+gc_get_static_regions(void)
 {
-	_gc_cap void *ret;
-	char *base;
-	static char *good_base;
-	static char *top;
-	size_t len;
-	int rc;
-	char deref;
 
-	rc = setjmp(gc_jmp_buf);
-	if (!rc) {
-		/* Direct return from setjmp. */
-		top = GC_ALIGN(&end);
-		gc_oldfn = signal(SIGSEGV, gc_sigsegv_handler);
-		if (gc_oldfn == SIG_ERR) {
-			gc_error("SIG_ERR registering handler");
-			return (NULL);
-		}
-		base = top;
-		good_base = NULL;
-		while (base != NULL) {
-			good_base = base;
-			base -= sizeof(_gc_cap void *);
-			deref = *base;
-			/* Force dereference. */
-			__asm__ __volatile__ (
-				"move $1, %0" :: "r"(deref) : "memory", "$1"
-			);
-		}
-	} else {
-		/* Restore previous handler. */
-		gc_oldfn = signal(SIGSEGV, gc_oldfn);
-		if (gc_oldfn == SIG_ERR) {
-			gc_error("SIG_ERR restoring gc_oldfn");
-			return (NULL);
-		}
-		len = top - good_base;
-		ret = gc_cheri_ptr(good_base, len);
-		gc_debug("found bottom of static region: %s", gc_cap_str(ret));
-		return (ret);
-	}
-	/* Never segfaulted. */
-	gc_error("decremented base to 0");
-	return (NULL);
+	gc_state_c->gs_nstatic = 0;
+	(void)dl_iterate_phdr(gc_static_phdr, NULL);
+	return (gc_state_c->gs_nstatic);
 }
 
 _gc_cap void *
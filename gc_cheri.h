@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <machine/cheri.h>
 #include <machine/cheric.h>
-#include <setjmp.h>
 #include <signal.h>
 
 #define	_gc_cap			__capability
@@ -14,6 +13,7 @@
 #define	gc_cheri_gettype(x)	((uint64_t)cheri_gettype(x))
 #define	gc_cheri_gettag(x)	((int)cheri_gettag(x))
 #define	gc_cheri_getsealed(x)	((int)cheri_getsealed(x))
+#define	gc_cheri_getperm(x)	((uint64_t)cheri_getperm(x))
 #define	gc_cheri_incbase	cheri_incbase
 #define	gc_cheri_ptr		cheri_ptr
 #define	gc_cheri_setlen		cheri_setlen
@@ -21,6 +21,7 @@
 #define	gc_cheri_cleartag	cheri_cleartag
 #define	gc_cheri_seal		cheri_seal
 #define	gc_cheri_unseal		cheri_unseal
+#define	gc_cheri_andperm	cheri_andperm
 
 #define	gc_cap_addr(x)		(gc_cheri_ptr((void*)(x), \
 				    sizeof(_gc_cap void *)))
@@ -139,11 +140,8 @@
 _gc_cap void	*gc_get_stack(void);
 _gc_cap void	*gc_get_stack_top(void);
 _gc_cap void	*gc_get_stack_bottom(void);
-_gc_cap void	*gc_get_static_region(void);
-void		 gc_sigsegv_handler(int _p);
-
-extern jmp_buf	gc_jmp_buf;
-extern void	(*gc_oldfn)(int);
+/* Fills in gs_static; returns the number of regions found. */
+size_t		 gc_get_static_regions(void);
 
 _gc_cap void	*gc_unseal(_gc_cap void *_obj);
 
@@ -1,10 +1,13 @@
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "gc.h"
 #include "gc_cmdln.h"
 #include "gc_debug.h"
+#include "gc_stats.h"
 
 struct gc_cmd	gc_cmds[] = {
 	{.c_cmd = (const char *[]){"cont", "c", "", NULL}, .c_fn = &gc_cmd_cont,
@@ -15,16 +18,22 @@ struct gc_cmd	gc_cmds[] = {
 	 .c_desc = "Display help"},
 	{.c_cmd = (const char *[]){"info", "i", NULL}, .c_fn = &gc_cmd_info,
 	 .c_desc = "Display information for page/object"},
+	{.c_cmd = (const char *[]){"json", NULL}, .c_fn = &gc_cmd_json,
+	 .c_desc = "Write statistics as JSON to stdout or a file"},
 	{.c_cmd = (const char *[]){"map", "m", NULL}, .c_fn = &gc_cmd_map,
 	 .c_desc = "Display btbl map"},
 	{.c_cmd = (const char *[]){"next", "n", NULL}, .c_fn = &gc_cmd_next,
 	 .c_desc = "Step one \"logical\" step"},
+	{.c_cmd = (const char *[]){"prof", NULL}, .c_fn = &gc_cmd_prof,
+	 .c_desc = "Dump heap profile, or set sampling rate"},
 	{.c_cmd = (const char *[]){"quit", "q", NULL}, .c_fn = &gc_cmd_quit,
 	 .c_desc = "Quit"},
 	{.c_cmd = (const char *[]){"revoke", NULL}, .c_fn = &gc_cmd_revoke,
 	 .c_desc = "Revoke access to an object"},
 	{.c_cmd = (const char *[]){"stat", "s", NULL}, .c_fn = &gc_cmd_stat,
 	 .c_desc = "Display statistics"},
+	{.c_cmd = (const char *[]){"trace", "t", NULL}, .c_fn = &gc_cmd_trace,
+	 .c_desc = "Dump trace ring, or set trace mask"},
 	{.c_cmd = (const char *[]){"uptags", "ut", NULL}, .c_fn = &gc_cmd_uptags,
 	 .c_desc = "Update tags for page/object"},
 	{.c_cmd = (const char *[]){"vm", NULL}, .c_fn = &gc_cmd_vm,
@@ -69,6 +78,31 @@ gc_cmd_stat(struct gc_cmd *cmd, char **arg)
 	for (i = 0; i < GC_LOG_BIGSZ; i++)
 		printf("ntalloc %d = %zu\n", 1 << i, gc_state_c->gs_ntalloc[i]);
 	printf("ntbigalloc = %zu\n", gc_state_c->gs_ntbigalloc);
+	printf("pauses = %" PRIu64 ", p50 %" PRIu64 " ns, p99 %" PRIu64
+	    " ns, p99.9 %" PRIu64 " ns\n", gc_state_c->gs_ev.el_npause,
+	    gc_ev_pause_pct(50.0), gc_ev_pause_pct(99.0),
+	    gc_ev_pause_pct(99.9));
+	return (0);
+}
+
+int
+gc_cmd_json(struct gc_cmd *cmd, char **arg)
+{
+	int fd;
+
+	if (arg[1] == NULL) {
+		fflush(stdout);
+		gc_stats_write(STDOUT_FILENO);
+		return (0);
+	}
+
+	fd = open(arg[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Can't open %s.\n", arg[1]);
+		return (0);
+	}
+	gc_stats_write(fd);
+	close(fd);
 	return (0);
 }
 
@@ -85,11 +119,14 @@ gc_cmd_map(struct gc_cmd *cmd, char **arg)
 		btbl = &gc_state_c->gs_btbl_big;
 	else if (strcmp(arg[1], "s") == 0)
 		btbl = &gc_state_c->gs_btbl_small;
+	else if (strcmp(arg[1], "n") == 0 &&
+	    gc_state_c->gs_btbl_nursery.bt_valid)
+		btbl = &gc_state_c->gs_btbl_nursery;
 	else
 		error = 1;
 
 	if (error)
-		printf("map: b (big) or s (small)\n");
+		printf("map: b (big), s (small) or n (nursery)\n");
 	else
 		gc_print_map(btbl);
 
@@ -243,6 +280,35 @@ gc_cmd_uptags(struct gc_cmd *cmd, char **arg)
 	return (0);
 }
 
+int
+gc_cmd_trace(struct gc_cmd *cmd, char **arg)
+{
+
+	if (arg[1] == NULL) {
+		gc_trace_dump(GC_TRACESZ);
+		return (0);
+	}
+
+	gc_trace_mask = strtoul(arg[1], NULL, 0);
+	printf("Trace mask set to 0x%x\n", gc_trace_mask);
+	return (0);
+}
+
+int
+gc_cmd_prof(struct gc_cmd *cmd, char **arg)
+{
+
+	if (arg[1] == NULL) {
+		if (gc_prof_write(1) != 0)
+			printf("Profiling was never enabled.\n");
+		return (0);
+	}
+
+	gc_prof_set_rate(strtoul(arg[1], NULL, 0));
+	printf("Sampling rate set to %zu\n", gc_state_c->gs_prof_rate);
+	return (0);
+}
+
 int
 gc_cmd_vm(struct gc_cmd *cmd, char **arg)
 {
@@ -361,6 +427,7 @@ gc_cmdln(void)
 	gc_state_c->gs_enter_cmdln_on_log = 0;
 
 	for (;;) {
+		gc_stats_poll();
 		gc_cmdin(buf, sizeof(buf));
 		gc_cmdarg(buf, arg, sizeof(arg)/sizeof(*arg));
 		rc = gc_cmdrn(arg);
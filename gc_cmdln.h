@@ -32,5 +32,8 @@ gc_cmd_fn	gc_cmd_quit;
 gc_cmd_fn	gc_cmd_vm;
 gc_cmd_fn	gc_cmd_revoke;
 gc_cmd_fn	gc_cmd_gc;
+gc_cmd_fn	gc_cmd_trace;
+gc_cmd_fn	gc_cmd_prof;
+gc_cmd_fn	gc_cmd_json;
 
 #endif /* !_GC_CMDLN_H_ */
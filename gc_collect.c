@@ -1,24 +1,40 @@
 #include <inttypes.h>
+#include <string.h>
 
 #include "gc.h"
 #include "gc_cheri.h"
 #include "gc_collect.h"
+#include "gc_conc.h"
 #include "gc_debug.h"
+#include "gc_heap.h"
+#include "gc_roots.h"
+#include "gc_stats.h"
 
 void
 gc_collect(void)
 {
 	int rc;
 
+	if (GC_INIT_HEAP() != GC_SUCC)
+		return;
+	gc_stats_poll();
 	switch (gc_state_c->gs_mark_state) {
 	case GC_MS_MARK:
-		gc_resume_marking();
+		/* Don't wait for the collector thread. */
+		if (gc_state_c->gs_satb)
+			gc_conc_finish();
+		else
+			gc_resume_marking();
 		break;
 	case GC_MS_SWEEP:
 		gc_resume_sweeping();
 		break;
 	case GC_MS_NONE:
+		gc_sweep_finish();
 		gc_debug("beginning a new collection");
+		gc_trace(GC_TRACE_COLLECT, 0, 0, 0);
+		gc_ev_begin(GC_EV_FULL);
+		gc_ev_pause_begin();
 #ifdef GC_COLLECT_STATS
 		gc_state_c->gs_nmark = 0;
 		gc_state_c->gs_nmarkbytes = 0;
@@ -29,15 +45,23 @@ gc_collect(void)
 		/* Update the VM info. */
 		if (gc_vm_tbl_update(&gc_state_c->gs_vt) != GC_SUCC) {
 			gc_error("gc_vm_tbl_update");
+			gc_ev_pause_end();
 			return;
 		}
 		gc_print_vm_tbl(&gc_state_c->gs_vt);
+		/* Sticky marks: everything is young again for a full trace. */
+		if (gc_state_c->gs_gen_mode == GC_GEN_STICKY)
+			gc_clear_marks();
+		gc_state_c->gs_nminor = 0;
+		gc_state_c->gs_allocbytes = 0;
 		/* Get the trusted stack. */
 		rc = gc_cheri_get_ts(gc_state_c->gs_gts_c);
 		if (rc != 0) {
 			gc_error("gc_cheri_get_ts error: %d", rc);
+			gc_ev_pause_end();
 			return;
 		}
+		gc_state_c->gs_evac_now = gc_state_c->gs_evac;
 		gc_start_marking();
 		/* Because we're not incremental yet: */
 		/*while (gc_state_c->mark_state != GC_MS_SWEEP)
@@ -48,10 +72,12 @@ gc_collect(void)
 			gc_resume_marking();
 		/* Restore the trusted stack. */
 		rc = gc_cheri_put_ts(gc_state_c->gs_gts_c);
+		gc_ev_pause_end();
 		if (rc != 0) {
 			gc_error("gc_cheri_put_ts error: %d", rc);
-		return;
-	}
+			return;
+		}
+		gc_trace(GC_TRACE_COLLECT, 1, 0, 0);
 
 		break;
 	default:
@@ -61,6 +87,72 @@ gc_collect(void)
 	}
 }
 
+void
+gc_collect_minor(void)
+{
+	int rc;
+
+	/* Finish any collection in progress instead. */
+	if (gc_state_c->gs_mark_state != GC_MS_NONE) {
+		gc_collect();
+		return;
+	}
+	/*
+	 * Periodically reclaim old garbage too, and fall back to a full
+	 * collection if the remembered set is incomplete.
+	 */
+	if (gc_state_c->gs_nminor >= GC_MINOR_PER_MAJOR ||
+	    gc_state_c->gs_wb_ovf) {
+		gc_collect();
+		return;
+	}
+	gc_sweep_finish();
+	gc_state_c->gs_nminor++;
+	gc_state_c->gs_allocbytes = 0;
+
+	gc_debug("beginning a minor collection");
+	gc_trace(GC_TRACE_COLLECT, 0, 1, 0);
+	gc_ev_begin(GC_EV_MINOR);
+	gc_ev_pause_begin();
+#ifdef GC_COLLECT_STATS
+	gc_state_c->gs_nmark = 0;
+	gc_state_c->gs_nmarkbytes = 0;
+	gc_state_c->gs_nsweep = 0;
+	gc_state_c->gs_nsweepbytes = 0;
+	gc_state_c->gs_ntminor++;
+#endif
+	/*
+	 * The VM info is only updated for the remembered unmanaged pages:
+	 * other mappings that appeared since the last full collection can
+	 * only hold young references if they are reachable from the
+	 * roots, and then they are scanned anyway.
+	 */
+	if (gc_state_c->gs_wb_n != 0 &&
+	    gc_vm_tbl_update(&gc_state_c->gs_vt) != GC_SUCC) {
+		gc_error("gc_vm_tbl_update");
+		gc_ev_pause_end();
+		return;
+	}
+	rc = gc_cheri_get_ts(gc_state_c->gs_gts_c);
+	if (rc != 0) {
+		gc_error("gc_cheri_get_ts error: %d", rc);
+		gc_ev_pause_end();
+		return;
+	}
+	gc_state_c->gs_minor = 1;
+	gc_start_marking();
+	while (gc_state_c->gs_mark_state != GC_MS_NONE)
+		gc_resume_marking();
+	gc_state_c->gs_minor = 0;
+	rc = gc_cheri_put_ts(gc_state_c->gs_gts_c);
+	gc_ev_pause_end();
+	if (rc != 0) {
+		gc_error("gc_cheri_put_ts error: %d", rc);
+		return;
+	}
+	gc_trace(GC_TRACE_COLLECT, 1, 1, 0);
+}
+
 int
 gc_is_unlimited(_gc_cap void * obj)
 {
@@ -75,11 +167,178 @@ gc_start_marking(void)
 
 	gc_state_c->gs_mark_state = GC_MS_MARK;
 	gc_push_roots();
+	if (gc_state_c->gs_minor)
+		gc_push_remembered();
+	gc_ev_roots();
 	gc_resume_marking();
 }
 
-int
-gc_push_root(_gc_cap void * _gc_cap *rootp)
+void
+gc_push_remembered_bt(_gc_cap struct gc_btbl *btbl)
+{
+	_gc_cap struct gc_blk *blk;
+	_gc_cap void *page;
+	struct gc_tags tags;
+	size_t i, npages;
+	uint8_t type;
+
+	if (!btbl->bt_valid || btbl->bt_cards == NULL)
+		return;
+	npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
+	for (i = 0; i < npages; i++) {
+		if (btbl->bt_cards[i / 64] == 0) {
+			i |= 63; /* skip clean word */
+			continue;
+		}
+		if (!GC_BIT_ISSET(btbl->bt_cards, i) ||
+		    gc_btbl_page_is_free(btbl, i))
+			continue;
+		page = gc_cheri_ptr((char *)gc_cheri_getbase(btbl->bt_base) +
+		    i * GC_PAGESZ, GC_PAGESZ);
+		if (btbl->bt_flags & GC_BTBL_FLAG_SMALL) {
+			/* Young blocks are traced, not remembered. */
+			type = GC_BTBL_GETTYPE(
+			    btbl->bt_map[GC_BTBL_MAPINDX(i)], i);
+			blk = page;
+			if (gc_ty_is_used(type) && gc_is_young(btbl, blk))
+				continue;
+		}
+		gc_debug("root: dirty page: %s", gc_cap_str(page));
+		/*
+		 * The whole page is scanned, including dead objects in
+		 * it; anything they reference is just floating garbage
+		 * until the next full collection.
+		 */
+		tags = gc_get_page_tags(page);
+		/*
+		 * The block header's list links are not references: with
+		 * sticky marks, tracing them would keep the first objects
+		 * of the neighbouring blocks alive for good.
+		 */
+		if (btbl->bt_flags & GC_BTBL_FLAG_SMALL)
+			tags.tg_lo &= ~GC_BLK_HDR_TAGS;
+		gc_scan_tags(page, tags);
+	}
+}
+
+void
+gc_push_remembered(void)
+{
+
+	gc_push_remembered_bt(&gc_state_c->gs_btbl_small);
+	gc_push_remembered_bt(&gc_state_c->gs_btbl_big);
+	gc_push_remembered_bt(&gc_state_c->gs_btbl_nursery);
+	gc_push_remembered_wb();
+}
+
+void
+gc_push_remembered_wb(void)
+{
+	_gc_cap struct gc_vm_ent *ve;
+	_gc_cap void *page;
+	struct gc_tags tags;
+	uint64_t addr;
+	size_t i;
+
+	for (i = 0; i < gc_state_c->gs_wb_n; i++) {
+		addr = gc_state_c->gs_wb_pages[i];
+		/* The page may have been unmapped since. */
+		ve = gc_vm_tbl_find(&gc_state_c->gs_vt, addr);
+		if (ve == NULL || !(ve->ve_prot & GC_VE_PROT_RD))
+			continue;
+		page = gc_cheri_ptr((void *)addr, GC_PAGESZ);
+		gc_debug("root: written unmanaged page: %s", gc_cap_str(page));
+		tags = gc_get_page_tags(page);
+		gc_scan_tags(page, tags);
+	}
+}
+
+void
+gc_clear_cards(_gc_cap struct gc_btbl *btbl)
+{
+	size_t npages;
+
+	if (!btbl->bt_valid || btbl->bt_cards == NULL)
+		return;
+	npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
+	memset((void *)btbl->bt_cards, 0,
+	    GC_BIT_NWORDS(npages) * sizeof(uint64_t));
+}
+
+void
+gc_clear_remembered(void)
+{
+
+	gc_clear_cards(&gc_state_c->gs_btbl_small);
+	gc_clear_cards(&gc_state_c->gs_btbl_big);
+	gc_clear_cards(&gc_state_c->gs_btbl_nursery);
+	gc_state_c->gs_wb_n = 0;
+	gc_state_c->gs_wb_ovf = 0;
+}
+
+void
+gc_clear_marks_bt(_gc_cap struct gc_btbl *btbl)
+{
+	_gc_cap struct gc_blk *blk;
+	size_t i;
+	uint8_t byte, type;
+
+	if (!btbl->bt_valid)
+		return;
+	for (i = 0; i < btbl->bt_nslots; i++) {
+		byte = btbl->bt_map[GC_BTBL_MAPINDX(i)];
+		type = GC_BTBL_GETTYPE(byte, i);
+		if (btbl->bt_flags & GC_BTBL_FLAG_SMALL) {
+			if (type != GC_BTBL_USED)
+				continue;
+			blk = gc_cheri_ptr((char *)
+			    gc_cheri_getbase(btbl->bt_base) +
+			    i * btbl->bt_slotsz, btbl->bt_slotsz);
+			blk->bk_marks = 0;
+		} else if (gc_ty_is_marked(type)) {
+			GC_BTBL_SETTYPE(byte, i, gc_ty_set_used(type));
+			btbl->bt_map[GC_BTBL_MAPINDX(i)] = byte;
+		}
+	}
+}
+
+void
+gc_clear_marks(void)
+{
+
+	gc_clear_marks_bt(&gc_state_c->gs_btbl_small);
+	gc_clear_marks_bt(&gc_state_c->gs_btbl_big);
+	gc_clear_marks_bt(&gc_state_c->gs_btbl_nursery);
+}
+
+void
+gc_promote_nursery(void)
+{
+	_gc_cap struct gc_btbl *btbl;
+	_gc_cap struct gc_blk *blk;
+	size_t i;
+	uint8_t type;
+
+	btbl = &gc_state_c->gs_btbl_nursery;
+	if (!btbl->bt_valid)
+		return;
+	for (i = 0; i < btbl->bt_nslots; i++) {
+		type = GC_BTBL_GETTYPE(btbl->bt_map[GC_BTBL_MAPINDX(i)], i);
+		if (type != GC_BTBL_USED)
+			continue;
+		blk = gc_cheri_ptr((char *)gc_cheri_getbase(btbl->bt_base) +
+		    i * btbl->bt_slotsz, btbl->bt_slotsz);
+		if (gc_is_young(btbl, blk))
+			gc_blk_promote(btbl, blk);
+	}
+}
+
+/*
+ * Marks a root. Returns non-zero iff it is to be pushed, in which case
+ * *objp is set to the value to push.
+ */
+static int
+gc_mark_root(_gc_cap void * _gc_cap *rootp, _gc_cap void * _gc_cap *objp)
 {
 	int rc;
 
@@ -93,19 +352,46 @@ gc_push_root(_gc_cap void * _gc_cap *rootp)
 		 * invalidate.
 		 */
 		*rootp = gc_cheri_cleartag(*rootp);
-	} else {
-		/* Push whether managed or not. */
-		rc = gc_stack_push(gc_state_c->gs_mark_stack_c, *rootp);
-		if (rc != 0) {
-			gc_error("mark stack overflow");
-			return (1);
-		}
-		if (gc_ty_is_revoked(rc)) {
-			/* But also invalidate, so we can scan children. */
-			*rootp = gc_cheri_cleartag(*rootp);
-		}
+		return (0);
 	}
+	/* Push whether managed or not. */
+	*objp = *rootp;
+	if (gc_ty_is_revoked(rc)) {
+		/* But also invalidate, so we can scan children. */
+		*rootp = gc_cheri_cleartag(*rootp);
+	}
+	return (1);
+}
+
+int
+gc_push_root(_gc_cap void * _gc_cap *rootp)
+{
+	_gc_cap void *obj;
 
+	if (!gc_mark_root(rootp, gc_cap_addr(&obj)))
+		return (0);
+	if (gc_stack_push(gc_state_c->gs_mark_stack_c, obj) != 0) {
+		gc_error("mark stack overflow");
+		return (1);
+	}
+	return (0);
+}
+
+/* Push the saved capabilities of a trusted stack frame in one batch. */
+static int
+gc_push_frame(_gc_cap void * _gc_cap *frame)
+{
+	_gc_cap void *batch[GC_TS_FRAME_NCAP];
+	size_t i, n;
+
+	for (i = 0, n = 0; i < GC_TS_FRAME_NCAP; i++)
+		if (gc_mark_root(&frame[i], gc_cap_addr(&batch[n])))
+			n++;
+	if (gc_stack_push_n(gc_state_c->gs_mark_stack_c,
+	    gc_cheri_ptr(batch, sizeof(batch)), n) != 0) {
+		gc_error("mark stack overflow");
+		return (1);
+	}
 	return (0);
 }
 
@@ -115,9 +401,11 @@ gc_push_roots(void)
 {
 	int i, rc;
 	_gc_cap void * _gc_cap *cap;
-	size_t ncap;
+	size_t j, nframe;
 
 	gc_debug("push roots:");
+	/* Unmanaged pages may have changed since the last push. */
+	gc_state_c->gs_scan_epoch++;
 	for (i = 0; i < GC_NUM_SAVED_REGS; i++) {
 		gc_debug("root: c%d: %s",
 		    i >= 10 ? (i >= 12 ? i - 8 : i - 9) : 17 + i,
@@ -127,12 +415,13 @@ gc_push_roots(void)
 			return;
 	}
 
-	cap = (_gc_cap void * _gc_cap *)gc_state_c->gs_gts_c;
-	ncap = gc_cheri_getlen(gc_state_c->gs_gts_c) /
-	    sizeof(_gc_cap void *);
-	for (i = 0; i < ncap; i++) {
-		gc_debug("root: ts%d: %s", i, gc_cap_str(cap[i]));
-		rc = gc_push_root(&cap[i]);
+	/* Only the live frames; stale ones would keep garbage alive. */
+	cap = gc_ts_frames(gc_state_c->gs_gts_c, &nframe);
+	for (i = 0; i < nframe; i++, cap += GC_TS_FRAME_NCAP) {
+		for (j = 0; j < GC_TS_FRAME_NCAP; j++)
+			gc_debug("root: ts%d.%zu: %s", i, j,
+			    gc_cap_str(cap[j]));
+		rc = gc_push_frame(cap);
 		if (rc != 0)
 			return;
 	}
@@ -141,9 +430,21 @@ gc_push_roots(void)
 	 * Push a capability to the stack to the mark stack.
 	 * This isn't marked as it's not an object that's been allocated
 	 * by the collector.
+	 *
+	 * A concurrent mark scans the stack right away instead, while
+	 * the mutator is stopped: stack writes have no barrier, so a
+	 * reference moved from the stack into a marked object would be
+	 * missed by a later scan.
 	 */
 	gc_debug("root: stack: %s", gc_cap_str(gc_state_c->gs_stack));
-	gc_stack_push(gc_state_c->gs_mark_stack_c, gc_state_c->gs_stack);
+	if (gc_state_c->gs_satb)
+		gc_mark_unmanaged(gc_state_c->gs_stack);
+	else
+		gc_stack_push(gc_state_c->gs_mark_stack_c,
+		    gc_state_c->gs_stack);
+
+	/* Static segments and other registered ranges. */
+	gc_roots_push();
 }
 
 
@@ -151,6 +452,7 @@ void
 gc_scan_tags(_gc_cap void *obj, struct gc_tags tags)
 {
 
+	gc_state_c->gs_ev.el_cur.ev_pages++;
 	gc_scan_tags_64(obj, tags.tg_lo);
 	gc_scan_tags_64(obj + GC_PAGESZ / 2, tags.tg_hi);
 }
@@ -169,12 +471,17 @@ gc_scan_tags_64(_gc_cap void *parent, uint64_t tags)
 		return;
 
 	gc_debug("parent: %s, tags 0x%llx", gc_cap_str(parent), tags);
+	gc_trace(GC_TRACE_SCAN, gc_cheri_getbase(parent), tags, 0);
 	gc_debug_indent(1);
 	for (child_ptr = parent; tags; tags >>= 1, child_ptr++) {
 		if (tags & 1) {
 			raw_obj = *child_ptr;
 			rc = gc_get_obj(gc_unseal(raw_obj), gc_cap_addr(&obj),
 			    gc_cap_addr(&bt), NULL, NULL, NULL);
+			/* Sealed references can't be moved. */
+			if (gc_state_c->gs_evac_now &&
+			    gc_cheri_getsealed(raw_obj))
+				gc_evac_pin(gc_unseal(raw_obj));
 			/* Assert: child has tag bit set! */
 			if (gc_ty_is_unmanaged(rc)) {
 				/* Mark this object and/or check for already marked. */
@@ -201,6 +508,8 @@ gc_scan_tags_64(_gc_cap void *parent, uint64_t tags)
 				}
 				rc = gc_set_mark_bt(obj, bt);
 				/* XXX: assert rc == prev rc? */
+				if (gc_ty_is_marked(rc))
+					continue; /* old, in a minor collection */
 				error = gc_stack_push(
 				    gc_state_c->gs_mark_stack_c, obj);
 				if (error != 0)
@@ -223,7 +532,7 @@ gc_resume_marking(void)
 	int empty, rc;
 	uint8_t type;
 	_gc_cap void *obj;
-	size_t sml_indx, big_indx;
+	size_t sml_indx, big_indx, depth;
 	_gc_cap struct gc_btbl *btbl;
 	_gc_cap struct gc_blk *blk;
 	_gc_cap struct gc_vm_ent *ve;
@@ -232,6 +541,9 @@ gc_resume_marking(void)
 		gc_resume_sweeping();
 		return;
 	}
+	depth = gc_stack_depth(gc_state_c->gs_mark_stack_c);
+	if (depth > gc_state_c->gs_ev.el_cur.ev_stackhw)
+		gc_state_c->gs_ev.el_cur.ev_stackhw = depth;
 	empty = gc_stack_pop(gc_state_c->gs_mark_stack_c,
 	    gc_cheri_ptr(&obj, sizeof(_gc_cap void*)));
 	if (empty) {
@@ -253,8 +565,8 @@ gc_resume_marking(void)
 		 * superset of this capability, and we thus skip it because it's
 		 * marked).
 		 * If the object wasn't allocated by us, we scan it anyway, but
-		 * obviously can't set its mark bit. XXX: Unmanaged cyclic objects
-		 * will throw the GC into an infinite loop...
+		 * obviously can't set its mark bit; gc_mark_children instead
+		 * scans each of its pages at most once (see bt_scanned).
 		 */
 		gc_debug("popped off the mark stack, raw: %s", gc_cap_str(obj));
 		obj = gc_unseal(obj);
@@ -270,6 +582,12 @@ gc_resume_marking(void)
 				gc_debug("warning: popped pointer is near-NULL");
 				return;
 			}
+			/* Other heaps are traced by their own collections. */
+			if (gc_heap_skip(gc_cheri_getbase(obj))) {
+				gc_debug("skipping object of another heap: %s",
+				    gc_cap_str(obj));
+				return;
+			}
 			btbl = NULL;
 			big_indx = 0;
 			blk = NULL;
@@ -281,13 +599,6 @@ gc_resume_marking(void)
 			 */
 			obj = gc_cheri_ptr(GC_ALIGN(gc_cheri_getbase(obj)),
 			    GC_ROUND_ALIGN(gc_cheri_getlen(obj)));
-			/*
-			 * XXX: Need to know if object is "marked" (been scanned
-			 * before) to avoid cycles (could implement as perm bit
-			 * in scan below; this would bound the number of scans
-			 * of the same obj).
-			 */
-
 			ve = gc_vm_tbl_find(&gc_state_c->gs_vt,
 			    gc_cheri_getbase(obj));
 			if (ve == NULL) {
@@ -333,19 +644,94 @@ gc_resume_marking(void)
 	}
 }
 
+/*
+ * Return the number of consecutive pages, starting at page_idx and at
+ * most n, whose cached tags are known to be zero.
+ */
+static size_t
+gc_notags_run(_gc_cap struct gc_btbl *btbl, size_t page_idx, size_t n)
+{
+	size_t k;
+
+	if (btbl->bt_notags == NULL)
+		return (0);
+	for (k = 0; k < n; ) {
+		if ((page_idx + k) % 64 == 0 && n - k >= 64 &&
+		    btbl->bt_notags[(page_idx + k) / 64] == ~0ULL) {
+			k += 64;
+			continue;
+		}
+		if (!GC_BIT_ISSET(btbl->bt_notags, page_idx + k))
+			break;
+		k++;
+	}
+	return (k);
+}
+
+/* Clears the scanned bits of a VM btbl if they are from an old push. */
+static void
+gc_scanned_sync(_gc_cap struct gc_btbl *btbl)
+{
+
+	if (btbl->bt_scan_epoch == gc_state_c->gs_scan_epoch)
+		return;
+	memset((void *)btbl->bt_scanned, 0,
+	    GC_BIT_NWORDS(btbl->bt_nslots) * sizeof(uint64_t));
+	btbl->bt_scan_epoch = gc_state_c->gs_scan_epoch;
+}
+
+void
+gc_mark_unmanaged(_gc_cap void *obj)
+{
+	uintptr_t addr, pagehi;
+	size_t i;
+	struct gc_tags tags;
+	_gc_cap void *page;
+	_gc_cap struct gc_btbl *btbl;
+	_gc_cap struct gc_vm_ent *ve;
+
+	addr = GC_ALIGN_PAGESZ(gc_cheri_getbase(obj));
+	pagehi = GC_ROUND_PAGESZ(gc_cheri_getbase(obj) +
+	    gc_cheri_getlen(obj));
+	ve = NULL;
+	for (; addr < pagehi; addr += GC_PAGESZ) {
+		/*
+		 * Note: pages of the object may have different permissions
+		 * (e.g., the sandbox memory, which contains non-accessible
+		 * guard pages), or may not be mapped at all.
+		 */
+		if (ve == NULL || addr >= ve->ve_end)
+			ve = gc_vm_tbl_find(&gc_state_c->gs_vt, addr);
+		if (ve == NULL || !(ve->ve_prot & GC_VE_PROT_RD)) {
+			gc_debug("warning: not allowed to read page 0x%llx",
+			    (uint64_t)addr);
+			continue;
+		}
+		btbl = ve->ve_bt;
+		if (btbl != NULL && btbl->bt_scanned != NULL) {
+			gc_scanned_sync(btbl);
+			i = (addr - gc_cheri_getbase(btbl->bt_base)) /
+			    GC_PAGESZ;
+			if (GC_BIT_ISSET(btbl->bt_scanned, i))
+				continue;
+			GC_BIT_SET(btbl->bt_scanned, i);
+		}
+		page = gc_cheri_ptr((void *)addr, GC_PAGESZ);
+		tags = gc_get_page_tags(page);
+		gc_scan_tags(page, tags);
+	}
+}
+
 void
 gc_mark_children(_gc_cap void *obj,
     _gc_cap struct gc_btbl *btbl, size_t big_indx,
     _gc_cap struct gc_blk *blk, size_t sml_indx)
 {
 	size_t page_idx, tag_off, npage, tag_end;
-	size_t i, len;
+	size_t i, len, skip;
 	uintptr_t objlo, objhi, pagelo, pagehi;
 	struct gc_tags tags;
 	_gc_cap char (*page)[GC_PAGESZ];
-	_gc_cap struct gc_vm_ent *ve;
-	_gc_cap struct gc_vm_tbl *vt;
-	int unmanaged;
 
 	gc_debug("gc_mark_children: scanning object %s\n", gc_cap_str(obj));
 
@@ -353,13 +739,21 @@ gc_mark_children(_gc_cap void *obj,
 	 * Mark children of object.
 	 *
 	 * Object might be unmanaged by the GC, in which case btbl
-	 * will be NULL.
+	 * will be NULL or a btbl of the VM table.
 	 *
 	 * For each page spanned by the object, the tags are obtained,
 	 * and then that page is scanned by gc_scan_tags. This is
 	 * just the outer loop that handles the spanning and tags.
 	 *
 	 */
+	if (btbl == NULL || !(btbl->bt_flags & GC_BTBL_FLAG_MANAGED)) {
+		gc_mark_unmanaged(obj);
+		return;
+	}
+	/* Pointer-free objects are marked, but have nothing to scan. */
+	if (gc_is_leaf(btbl, big_indx, blk))
+		return;
+
 	len = gc_cheri_getlen(obj);
 	objlo = gc_cheri_getbase(obj);
 	objhi = objlo + len;
@@ -368,30 +762,9 @@ gc_mark_children(_gc_cap void *obj,
 	pagehi = GC_ROUND_PAGESZ(objhi);
 	npage = (pagehi - pagelo) / GC_PAGESZ;
 	page = gc_cheri_ptr((void *)pagelo, GC_PAGESZ);
-	
-	unmanaged = (btbl == NULL) ||
-	    !(btbl->bt_flags & GC_BTBL_FLAG_MANAGED);
 
-	if (unmanaged) {
-		/*
-		 * Unmanaged object. Get the tags directly.
-		 */
-		vt = &gc_state_c->gs_vt;
-		page_idx = 0;
-
-		ve = gc_vm_tbl_find(vt, (uint64_t)(void *)page);
-		/* assert(ve != NULL); */ /* guaranteed by caller */
-		if (ve->ve_prot & GC_VE_PROT_RD)
-			tags = gc_get_page_tags(page);
-		else {
-			gc_debug("warning: not allowed to read page 0x%llx", (uint64_t)(void *)page);
-			tags.tg_lo = 0;
-			tags.tg_hi = 0;
-		}
-	} else {
-		page_idx = GC_SLOT_IDX_TO_PAGE_IDX(btbl, big_indx);
-		tags = gc_get_or_update_tags(btbl, page_idx);
-	}
+	page_idx = GC_SLOT_IDX_TO_PAGE_IDX(btbl, big_indx);
+	tags = gc_get_or_update_tags(btbl, page_idx);
 
 	tag_off = ((size_t)objlo - pagelo) / GC_TAG_GRAN;
 	tag_end = (pagehi - (size_t)objhi) / GC_TAG_GRAN;
@@ -411,20 +784,14 @@ gc_mark_children(_gc_cap void *obj,
 	/* Scan whole pages. */
 	for (i = 0; i < npage - 1; i++) {
 		gc_scan_tags(page, tags);
+		/* Skip the middle pages known to hold no tags. */
+		skip = gc_notags_run(btbl, page_idx + 1, npage - 2 - i);
+		i += skip;
+		page_idx += skip;
+		page += skip;
 		page_idx++;
 		page++;
-		if (!unmanaged)
-			tags = gc_get_or_update_tags(btbl, page_idx);
-		else {
-			ve = gc_vm_tbl_find(vt, (uint64_t)(void *)page);
-			if (ve != NULL && (ve->ve_prot & GC_VE_PROT_RD))
-				tags = gc_get_page_tags(page);
-			else {
-				gc_debug("warning: not allowed to read page 0x%llx", (uint64_t)(void *)page);
-				tags.tg_lo = 0;
-				tags.tg_hi = 0;
-			}
-		}
+		tags = gc_get_or_update_tags(btbl, page_idx);
 	}
 
 	/*
@@ -441,34 +808,55 @@ gc_mark_children(_gc_cap void *obj,
 	gc_scan_tags(page, tags);
 }
 
-void
-gc_start_sweeping(void)
+int
+gc_push_sweep(_gc_cap struct gc_btbl *btbl)
 {
 	_gc_cap void *ptr;
 	int error;
 
-	gc_debug("begin sweeping");
-	gc_state_c->gs_mark_state = GC_MS_SWEEP;
-
-	/* Push the btbls to consider on to the sweep stack. */
-	ptr = &gc_state_c->gs_btbl_small;
+	ptr = btbl;
 	ptr = gc_cheri_incbase(ptr, gc_cheri_getoffset(ptr));
 	ptr = gc_cheri_setoffset(ptr, 0);
 	ptr = gc_cheri_setlen(ptr, sizeof(struct gc_btbl));
 	error = gc_stack_push(gc_state_c->gs_sweep_stack_c, ptr);
 	if (error != 0) {
 		gc_error("sweep stack overflow");
-		return;
+		return (1);
 	}
-	ptr = &gc_state_c->gs_btbl_big;
-	ptr = gc_cheri_incbase(ptr, gc_cheri_getoffset(ptr));
-	ptr = gc_cheri_setoffset(ptr, 0);
-	ptr = gc_cheri_setlen(ptr, sizeof(struct gc_btbl));
-	error = gc_stack_push(gc_state_c->gs_sweep_stack_c, ptr);
-	if (error != 0) {
-		gc_error("sweep stack overflow");
+	return (0);
+}
+
+void
+gc_start_sweeping(void)
+{
+
+	gc_debug("begin sweeping");
+	gc_ev_marked();
+	/* The mark bits are final; see which samples survived. */
+	gc_prof_collect();
+	if (gc_state_c->gs_evac_now)
+		gc_evacuate();
+	if (!gc_state_c->gs_minor && (gc_state_c->gs_conc & GC_CONC_SWEEP)) {
+		gc_start_lazy_sweeping();
 		return;
 	}
+	gc_state_c->gs_mark_state = GC_MS_SWEEP;
+
+	/*
+	 * Push the btbls to consider on to the sweep stack. Minor
+	 * collections only sweep the nursery, except with sticky marks,
+	 * where young objects may be anywhere.
+	 */
+	if (!gc_state_c->gs_minor ||
+	    gc_state_c->gs_gen_mode == GC_GEN_STICKY) {
+		if (gc_push_sweep(&gc_state_c->gs_btbl_small) != 0)
+			return;
+		if (gc_push_sweep(&gc_state_c->gs_btbl_big) != 0)
+			return;
+	}
+	if (gc_state_c->gs_btbl_nursery.bt_valid &&
+	    gc_push_sweep(&gc_state_c->gs_btbl_nursery) != 0)
+		return;
 
 	gc_resume_sweeping();
 }
@@ -496,6 +884,12 @@ gc_resume_sweeping(void)
 		gc_state_c->gs_nalloc -= gc_state_c->gs_nsweep;
 		gc_state_c->gs_nallocbytes -= gc_state_c->gs_nsweepbytes;
 #endif
+		/*
+		 * Every survivor is now old, so no old-to-young
+		 * references remain.
+		 */
+		gc_clear_remembered();
+		gc_ev_swept();
 		return;
 	}
 	small = btbl->bt_flags & GC_BTBL_FLAG_SMALL;
@@ -516,6 +910,10 @@ gc_resume_sweeping(void)
 		btbl->bt_map[i] = byte;
 	}
 
+	/* Return runs of free pages to the OS. */
+	if (btbl->bt_flags & GC_BTBL_FLAG_MANAGED)
+		gc_btbl_release(btbl, gc_state_c->gs_release_min);
+
 	/*
 	 * Invalidate knowledge of tag bits for all pages stored in
 	 * this block table.
@@ -528,6 +926,124 @@ gc_resume_sweeping(void)
 	npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
 	for (i = 0; i < npages; i++)
 		btbl->bt_tags[i].tg_v = 0;
+	memset((void *)btbl->bt_notags, 0,
+	    GC_BIT_NWORDS(npages) * sizeof(uint64_t));
+}
+
+void
+gc_start_lazy_sweeping(void)
+{
+
+	gc_debug("begin lazy sweeping");
+	gc_state_c->gs_epoch++;
+	gc_state_c->gs_btbl_small.bt_sweep = 0;
+	gc_state_c->gs_btbl_big.bt_sweep = 0;
+	gc_state_c->gs_btbl_big.bt_freecont = 0;
+	if (gc_state_c->gs_btbl_nursery.bt_valid)
+		gc_state_c->gs_btbl_nursery.bt_sweep = 0;
+	gc_state_c->gs_sweep_pending = 1;
+	/*
+	 * Survivors are old as far as marking is concerned; cards set
+	 * from now on are for the next collection.
+	 */
+	gc_clear_remembered();
+	/* The mutator may run again. */
+	gc_state_c->gs_mark_state = GC_MS_NONE;
+#ifdef GC_USE_PTHREAD
+	pthread_cond_signal((pthread_cond_t *)&gc_state_c->gs_conc_cv);
+#endif
+}
+
+void
+gc_sweep_slot(_gc_cap struct gc_btbl *btbl, size_t i)
+{
+	_gc_cap struct gc_blk *blk;
+	void *addr;
+	uint8_t byte, type;
+
+	byte = btbl->bt_map[GC_BTBL_MAPINDX(i)];
+	type = GC_BTBL_GETTYPE(byte, i);
+	addr = (char *)gc_cheri_getbase(btbl->bt_base) + i * btbl->bt_slotsz;
+	if (btbl->bt_flags & GC_BTBL_FLAG_SMALL) {
+		if (type != GC_BTBL_USED)
+			return;
+		blk = gc_cheri_ptr(addr, btbl->bt_slotsz);
+		if (blk->bk_epoch == gc_state_c->gs_epoch)
+			return; /* the allocator got here first */
+		gc_sweep_small_iter(btbl, &byte, type, addr, i);
+		blk->bk_epoch = gc_state_c->gs_epoch;
+	} else
+		gc_sweep_large_iter(btbl, &byte, type, addr, i,
+		    &btbl->bt_freecont);
+	btbl->bt_map[GC_BTBL_MAPINDX(i)] = byte;
+	/* See gc_resume_sweeping. */
+	btbl->bt_tags[i * btbl->bt_slotsz / GC_PAGESZ].tg_v = 0;
+	GC_BIT_CLR(btbl->bt_notags, i * btbl->bt_slotsz / GC_PAGESZ);
+}
+
+int
+gc_sweep_blk(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+	_gc_cap struct gc_blk **list;
+	size_t i;
+	uint8_t type;
+
+	if (!gc_state_c->gs_sweep_pending ||
+	    blk->bk_epoch == gc_state_c->gs_epoch)
+		return (0);
+	list = gc_blk_list(btbl, blk);
+	i = (gc_cheri_getbase(blk) - gc_cheri_getbase(btbl->bt_base)) /
+	    btbl->bt_slotsz;
+	gc_sweep_slot(btbl, i);
+	type = GC_BTBL_GETTYPE(btbl->bt_map[GC_BTBL_MAPINDX(i)], i);
+	/* Freed, or promoted to another list. */
+	return (type != GC_BTBL_USED || gc_blk_list(btbl, blk) != list);
+}
+
+int
+gc_sweep_lazy_bt(_gc_cap struct gc_btbl *btbl, size_t n)
+{
+
+	if (!btbl->bt_valid || btbl->bt_sweep == btbl->bt_nslots)
+		return (1);
+	for (; n > 0 && btbl->bt_sweep < btbl->bt_nslots; n--)
+		gc_sweep_slot(btbl, btbl->bt_sweep++);
+	if (btbl->bt_sweep < btbl->bt_nslots)
+		return (0);
+	/* Just finished this btbl. */
+	if (btbl->bt_flags & GC_BTBL_FLAG_MANAGED)
+		gc_btbl_release(btbl, gc_state_c->gs_release_min);
+	return (1);
+}
+
+int
+gc_sweep_lazy(size_t n)
+{
+
+	if (!gc_state_c->gs_sweep_pending)
+		return (1);
+	if (!gc_sweep_lazy_bt(&gc_state_c->gs_btbl_small, n) ||
+	    !gc_sweep_lazy_bt(&gc_state_c->gs_btbl_big, n) ||
+	    !gc_sweep_lazy_bt(&gc_state_c->gs_btbl_nursery, n))
+		return (0);
+	gc_state_c->gs_sweep_pending = 0;
+#ifdef GC_COLLECT_STATS
+	gc_debug("lazy sweep complete (swept %zu/%zu object(s), "
+	    "total recovered %zu/%zu bytes)",
+	    gc_state_c->gs_nsweep, gc_state_c->gs_nalloc,
+	    gc_state_c->gs_nsweepbytes, gc_state_c->gs_nallocbytes);
+	gc_state_c->gs_nalloc -= gc_state_c->gs_nsweep;
+	gc_state_c->gs_nallocbytes -= gc_state_c->gs_nsweepbytes;
+#endif
+	gc_ev_swept();
+	return (1);
+}
+
+void
+gc_sweep_finish(void)
+{
+
+	(void)gc_sweep_lazy(SIZE_MAX);
 }
 
 void
@@ -535,24 +1051,30 @@ gc_sweep_large_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
     uint8_t type, void *addr, int j, int *freecont)
 {
 	_gc_cap void *p;
+	uint8_t reuse;
 
 	p = gc_cheri_ptr(addr, btbl->bt_slotsz);
+	reuse = type & GC_BTBL_REUSE_MASK;
+	type &= ~GC_BTBL_REUSE_MASK;
 
 	if (type == GC_BTBL_CONT && *freecont) {
 		/*
 		 * Freeing continuation data.
 		 */
 		GC_BTBL_SETTYPE(*byte, j, GC_BTBL_FREE);
-		gc_fill_free_mem(p);
+		if (*freecont == 1)
+			gc_fill_free_mem(p);
 #ifdef GC_COLLECT_STATS
 		gc_state_c->gs_nsweepbytes += btbl->bt_slotsz;
 #endif
 	} else if (type == GC_BTBL_USED) {
 		/* Used but not marked; free entire block. */
 		GC_BTBL_SETTYPE(*byte, j, GC_BTBL_FREE);
-		gc_fill_free_mem(p);
+		/* gc_reuse objects are released without poisoning. */
+		if (!reuse)
+			gc_fill_free_mem(p);
 		/* Next iterations will free continuation data. */
-		*freecont = 1;
+		*freecont = reuse ? 2 : 1;
 #ifdef GC_COLLECT_STATS
 		gc_state_c->gs_nsweep++;
 		gc_state_c->gs_nsweepbytes += btbl->bt_slotsz;
@@ -560,12 +1082,16 @@ gc_sweep_large_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
 		/*gc_debug("swept entire large "
 		    "block at address %p",
 		    addr);*/
+	} else if (type == GC_BTBL_USED_MARKED &&
+	    gc_state_c->gs_gen_mode == GC_GEN_STICKY) {
+		/* Sticky mark: the object is now old. */
+		*freecont = 0;
 	} else if (type == GC_BTBL_USED_MARKED) {
 		/*
 		 * Used and marked; keep block and following
 		 * continuation data.
 		 */
-		GC_BTBL_SETTYPE(*byte, j, GC_BTBL_USED);
+		GC_BTBL_SETTYPE(*byte, j, GC_BTBL_USED | reuse);
 		*freecont = 0;
 	} else if (*freecont) {
 		*freecont = 0;
@@ -583,6 +1109,9 @@ gc_sweep_small_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
 
 	blk = gc_cheri_ptr(addr, btbl->bt_slotsz);
 	if (type == GC_BTBL_USED) {
+		/* Minor collections leave old blocks alone. */
+		if (gc_minor_skip(btbl, blk))
+			return;
 		hdrbits = (GC_BLK_HDRSZ + blk->bk_objsz - 1) / blk->bk_objsz;
 #ifdef GC_COLLECT_STATS
 		/*
@@ -606,27 +1135,41 @@ gc_sweep_small_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
 		if (!blk->bk_marks) {
 			/* Entire block free. Remove it from its list. */
 			GC_BTBL_SETTYPE(*byte, j, GC_BTBL_FREE);
-			if (blk->bk_next)
-				blk->bk_next->bk_prev = blk->bk_prev;
-			if (blk->bk_prev)
-				blk->bk_prev->bk_next = blk->bk_next;
+			gc_rm_blk(blk, gc_blk_list(btbl, blk));
 			gc_debug("swept entire block "
 			    "storing objects of size "
 			    "%zu at address %s",
 			    blk->bk_objsz,
 			    gc_cap_str(blk));
-			gc_fill_free_mem(blk);
+			gc_trace(GC_TRACE_SWEEP, gc_cheri_getbase(blk),
+			    blk->bk_objsz, 0);
+			/* No poisoning if every object was gc_reuse'd. */
+			tmp = ~(blk->bk_free | blk->bk_reuse);
+			tmp &= ((1ULL << (GC_PAGESZ / blk->bk_objsz)) - 1ULL);
+			tmp &= ~((1ULL << hdrbits) - 1ULL);
+			if (tmp != 0)
+				gc_fill_free_mem(blk);
 		} else {
 			/* Make free all those things that aren't marked. */
 			blk->bk_free = ~blk->bk_marks;
 			blk->bk_free &= ((1ULL << (GC_PAGESZ / blk->bk_objsz)) - 1ULL);
 			/* Account for the space taken up by the block header. */
 			blk->bk_free &= ~((1ULL << hdrbits) - 1ULL);
-			blk->bk_marks = 0;
+			/* Revoked objects are never marked, so are now free. */
+			blk->bk_revoked &= blk->bk_marks;
+			blk->bk_reuse &= blk->bk_marks;
+			if (gc_state_c->gs_gen_mode != GC_GEN_STICKY)
+				blk->bk_marks = 0;
+			gc_blk_rebucket(btbl, blk);
+			/* Survivors: promote the block in place. */
+			if (gc_is_young(btbl, blk))
+				gc_blk_promote(btbl, blk);
 			gc_debug("swept some objects "
 			    "of size %zu in block %s",
 			    blk->bk_objsz,
 			    gc_cap_str(blk));
+			gc_trace(GC_TRACE_SWEEP, gc_cheri_getbase(blk),
+			    blk->bk_objsz, blk->bk_free);
 		}
 	}
 }
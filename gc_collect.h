@@ -8,21 +8,59 @@
  * Collect. Requires regs and stack to be saved.
  */
 void	gc_collect(void);
+/*
+ * Collect the young generation only (GC_GEN_NURSERY, GC_GEN_STICKY).
+ * Requires regs and stack to be saved.
+ */
+void	gc_collect_minor(void);
 
 void	gc_start_marking(void);
 int	gc_is_unlimited(_gc_cap void *_obj);
 void	gc_scan_tags(_gc_cap void *_obj, struct gc_tags _tags);
 void	gc_scan_tags_64(_gc_cap void *_obj, uint64_t _tags);
+/* Clear all mark bits, for a full collection in GC_GEN_STICKY mode. */
+void	gc_clear_marks(void);
+void	gc_clear_marks_bt(_gc_cap struct gc_btbl *_btbl);
+/* Promote every young block, when leaving GC_GEN_NURSERY mode. */
+void	gc_promote_nursery(void);
 int	gc_push_root(_gc_cap void * _gc_cap *_rootp);
 void	gc_push_roots(void);
+/* Scan the remembered set (dirty old pages) for a minor collection. */
+void	gc_push_remembered(void);
+void	gc_push_remembered_bt(_gc_cap struct gc_btbl *_btbl);
+void	gc_push_remembered_wb(void);
+void	gc_clear_cards(_gc_cap struct gc_btbl *_btbl);
+/* Empty the remembered set: the cards and gs_wb_pages. */
+void	gc_clear_remembered(void);
+int	gc_push_sweep(_gc_cap struct gc_btbl *_btbl);
 void	gc_resume_marking(void);
 void	gc_start_sweeping(void);
 void	gc_resume_sweeping(void);
+/*
+ * Lazy sweeping (GC_CONC_SWEEP). gc_sweep_lazy sweeps up to _n slots of
+ * each btbl and returns non-zero once the sweep is complete;
+ * gc_sweep_finish completes it. gc_sweep_blk sweeps a block of a small
+ * btbl if it is still unswept, and returns non-zero iff this took it off
+ * its size-class list.
+ */
+void	gc_start_lazy_sweeping(void);
+void	gc_sweep_slot(_gc_cap struct gc_btbl *_btbl, size_t _i);
+int	gc_sweep_blk(_gc_cap struct gc_btbl *_btbl,
+	    _gc_cap struct gc_blk *_blk);
+int	gc_sweep_lazy_bt(_gc_cap struct gc_btbl *_btbl, size_t _n);
+int	gc_sweep_lazy(size_t _n);
+void	gc_sweep_finish(void);
 void	gc_sweep_large_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
 	    uint8_t type, void *addr, int j, int *freecont);
 void	gc_sweep_small_iter(_gc_cap struct gc_btbl *btbl, uint8_t *byte,
 	    uint8_t type, void *addr, int j);
 
+/*
+ * Scan the pages spanned by an unmanaged object that haven't been
+ * scanned since the roots were pushed. Pages are scanned whole, as
+ * other unmanaged objects may share them.
+ */
+void	gc_mark_unmanaged(_gc_cap void *_obj);
 void	gc_mark_children(_gc_cap void *obj,
 	    _gc_cap struct gc_btbl *btbl, size_t big_indx,
 	    _gc_cap struct gc_blk *blk, size_t sml_indx);
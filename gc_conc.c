@@ -0,0 +1,201 @@
+#ifdef GC_USE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_collect.h"
+#include "gc_conc.h"
+#include "gc_debug.h"
+#include "gc_stack.h"
+
+void
+gc_satb(_gc_cap void *old)
+{
+	int rc;
+
+	if (!gc_cheri_gettag(old))
+		return;
+	GC_LOCK();
+	/* Re-check: the mark may have finished while we waited. */
+	if (gc_state_c->gs_satb && !gc_is_unlimited(old)) {
+		rc = gc_set_mark(old);
+		/* Only newly-marked managed objects need scanning. */
+		if (gc_ty_is_used(rc) &&
+		    gc_stack_push(gc_state_c->gs_mark_stack_c, old) != 0)
+			gc_error("mark stack overflow");
+	}
+	GC_UNLOCK();
+}
+
+void
+gc_conc_finish(void)
+{
+	int rc;
+
+	gc_debug("finishing a concurrent collection");
+	gc_ev_pause_begin();
+	rc = gc_cheri_get_ts(gc_state_c->gs_gts_c);
+	if (rc != 0) {
+		gc_error("gc_cheri_get_ts error: %d", rc);
+		gc_ev_pause_end();
+		return;
+	}
+	/* Registers and stacks have no barrier: rescan them. */
+	gc_push_roots();
+	while (gc_state_c->gs_mark_state != GC_MS_NONE)
+		gc_resume_marking();
+	gc_state_c->gs_satb = 0;
+	rc = gc_cheri_put_ts(gc_state_c->gs_gts_c);
+	gc_ev_pause_end();
+	if (rc != 0) {
+		gc_error("gc_cheri_put_ts error: %d", rc);
+		return;
+	}
+	gc_trace(GC_TRACE_COLLECT, 1, 2, 0);
+}
+
+#ifdef GC_USE_PTHREAD
+int
+gc_set_concurrent(int modes)
+{
+
+	if (modes != 0 && gc_state_c->gs_conc == 0) {
+		gc_state_c->gs_conc_stop = 0;
+		if (pthread_create((pthread_t *)&gc_state_c->gs_conc_thr, NULL,
+		    gc_conc_main, NULL) != 0) {
+			gc_error("pthread_create");
+			return (GC_ERROR);
+		}
+	} else if (modes == 0 && gc_state_c->gs_conc != 0) {
+		GC_LOCK();
+		gc_state_c->gs_conc_stop = 1;
+		pthread_cond_signal((pthread_cond_t *)&gc_state_c->gs_conc_cv);
+		GC_UNLOCK();
+		pthread_join(gc_state_c->gs_conc_thr, NULL);
+		/*
+		 * A mark or sweep in progress is finished by the next
+		 * allocation or collection.
+		 */
+	}
+	GC_LOCK();
+	gc_state_c->gs_conc = modes;
+	GC_UNLOCK();
+	return (GC_SUCC);
+}
+
+void
+gc_conc_poll(void)
+{
+
+	if (gc_state_c->gs_satb) {
+		if (gc_state_c->gs_conc_done ||
+		    !(gc_state_c->gs_conc & GC_CONC_MARK))
+			gc_conc_finish();
+	} else if ((gc_state_c->gs_conc & GC_CONC_MARK) &&
+	    gc_state_c->gs_mark_state == GC_MS_NONE &&
+	    gc_state_c->gs_allocbytes >= gc_state_c->gs_conc_trigger)
+		gc_conc_start();
+}
+
+void
+gc_conc_start(void)
+{
+	int rc;
+
+	gc_sweep_finish();
+	gc_debug("beginning a concurrent collection");
+	gc_trace(GC_TRACE_COLLECT, 0, 2, 0);
+	gc_ev_begin(GC_EV_CONC);
+	gc_ev_pause_begin();
+#ifdef GC_COLLECT_STATS
+	gc_state_c->gs_nmark = 0;
+	gc_state_c->gs_nmarkbytes = 0;
+	gc_state_c->gs_nsweep = 0;
+	gc_state_c->gs_nsweepbytes = 0;
+	gc_state_c->gs_ntcollect++;
+#endif
+	if (gc_vm_tbl_update(&gc_state_c->gs_vt) != GC_SUCC) {
+		gc_error("gc_vm_tbl_update");
+		gc_ev_pause_end();
+		return;
+	}
+	if (gc_state_c->gs_gen_mode == GC_GEN_STICKY)
+		gc_clear_marks();
+	gc_state_c->gs_nminor = 0;
+	gc_state_c->gs_allocbytes = 0;
+	rc = gc_cheri_get_ts(gc_state_c->gs_gts_c);
+	if (rc != 0) {
+		gc_error("gc_cheri_get_ts error: %d", rc);
+		gc_ev_pause_end();
+		return;
+	}
+	gc_state_c->gs_mark_state = GC_MS_MARK;
+	gc_state_c->gs_satb = 1;
+	gc_state_c->gs_conc_done = 0;
+	gc_push_roots();
+	gc_ev_roots();
+	/* The trusted stack may change before we finish; put it back now. */
+	rc = gc_cheri_put_ts(gc_state_c->gs_gts_c);
+	gc_ev_pause_end();
+	if (rc != 0)
+		gc_error("gc_cheri_put_ts error: %d", rc);
+	pthread_cond_signal((pthread_cond_t *)&gc_state_c->gs_conc_cv);
+}
+
+void *
+gc_conc_main(void *arg)
+{
+	int i;
+
+	GC_LOCK();
+	for (;;) {
+		while (!gc_state_c->gs_conc_stop &&
+		    (!gc_state_c->gs_satb || gc_state_c->gs_conc_done) &&
+		    !gc_state_c->gs_sweep_pending)
+			pthread_cond_wait(
+			    (pthread_cond_t *)&gc_state_c->gs_conc_cv,
+			    (pthread_mutex_t *)&gc_state_c->gs_lock);
+		if (gc_state_c->gs_conc_stop)
+			break;
+		if (gc_state_c->gs_sweep_pending)
+			(void)gc_sweep_lazy(GC_CONC_SLICE);
+		for (i = 0; gc_state_c->gs_satb && !gc_state_c->gs_conc_done &&
+		    i < GC_CONC_SLICE; i++) {
+			/*
+			 * Sweeping starts on the mutator, after the roots
+			 * have been rescanned.
+			 */
+			if (gc_stack_empty(gc_state_c->gs_mark_stack_c)) {
+				gc_state_c->gs_conc_done = 1;
+				break;
+			}
+			gc_resume_marking();
+		}
+		/* Let the mutators in. */
+		GC_UNLOCK();
+		sched_yield();
+		GC_LOCK();
+	}
+	GC_UNLOCK();
+	return (NULL);
+}
+#else /* !GC_USE_PTHREAD */
+int
+gc_set_concurrent(int modes)
+{
+
+	/* No collector thread; the allocator can still sweep lazily. */
+	if (modes & ~GC_CONC_SWEEP)
+		return (GC_ERROR);
+	gc_state_c->gs_conc = modes;
+	return (GC_SUCC);
+}
+
+void
+gc_conc_poll(void)
+{
+
+}
+#endif /* GC_USE_PTHREAD */
@@ -0,0 +1,72 @@
+#ifndef _GC_CONC_H_
+#define _GC_CONC_H_
+
+#include "gc_cheri.h"
+
+/*
+ * Concurrent marking and sweeping (GC_USE_PTHREAD).
+ *
+ * With gc_set_concurrent(GC_CONC_MARK), a collector thread does the
+ * marking of full collections while mutators keep running:
+ *
+ * 1. When gs_conc_trigger bytes have been allocated since the last
+ *    collection, the allocating mutator (whose registers and stack are
+ *    saved) sets gs_satb, pushes the roots and wakes the collector.
+ *    The stack is scanned there and then rather than pushed, as the
+ *    barrier doesn't cover it: the snapshot includes everything it
+ *    references when marking begins.
+ * 2. The collector thread drains the mark stack in slices of
+ *    GC_CONC_SLICE objects, dropping gs_lock in between.
+ * 3. The next allocation after the mark stack drains finishes the
+ *    collection in a short stop-the-world phase: the roots, which have
+ *    no barrier, are rescanned, marking completes and the heap is
+ *    swept (lazily, with GC_CONC_SWEEP).
+ *
+ * With GC_CONC_SWEEP, the sweep of every full collection is lazy: the
+ * mutator resumes as soon as marking completes, and the collector
+ * thread sweeps GC_CONC_SLICE slots of each btbl per lock hold. A
+ * small block is swept once per epoch (gs_epoch, bumped when a lazy
+ * sweep starts, against bk_epoch), by whichever of the collector
+ * thread and the allocator (gc_follow_free) reaches it first. Big
+ * objects allocated beyond the big btbl's sweep cursor are allocated
+ * black. Any pending sweep is completed before the next collection
+ * starts, or when the allocator runs out of memory.
+ *
+ * While gs_satb is set, GC_STORE_CAP pushes the capability it
+ * overwrites, so that everything reachable when marking began is
+ * marked (snapshot-at-the-beginning). Objects allocated in the
+ * meantime are marked at once (allocate black). Clients must
+ * therefore use GC_STORE_CAP for every store of a capability while
+ * concurrent mode is on, whatever the destination: collector-allocated
+ * objects, registered root ranges and unmanaged memory alike. An
+ * overwrite made without the barrier (e.g., by memcpy or realloc of
+ * unmanaged memory) can hide a live object from the snapshot, and it
+ * is then freed.
+ *
+ * Only one mutator thread is supported: the one that calls into the
+ * collector. Its registers and stack are saved on entry and scanned at
+ * the start and the end of marking; the registers and stacks of other
+ * threads are never scanned, so they must not hold the only reference
+ * to an object at any point while concurrent mode is on.
+ *
+ * gs_lock serializes the collector thread with the collector's entry
+ * points (gc_malloc, gc_extern_collect, gc_revoke and the barrier);
+ * there is no finer-grained locking.
+ */
+
+/* Objects marked, or slots swept, by the collector thread per lock hold. */
+#define GC_CONC_SLICE		64
+
+/* Default gs_conc_trigger. */
+#define GC_CONC_TRIGGER_DEFAULT	(64 * 1024)
+
+/*
+ * Called on entry to the allocator with gs_lock held and regs and
+ * stack saved; starts or finishes a concurrent collection as needed.
+ */
+void	gc_conc_poll(void);
+void	gc_conc_start(void);
+void	gc_conc_finish(void);
+void	*gc_conc_main(void *_arg);
+
+#endif /* !_GC_CONC_H_ */
@@ -8,6 +8,10 @@
 
 int	gc_debug_indent_level;
 
+uint32_t		gc_trace_mask;
+uint64_t		gc_trace_seq;
+struct gc_trace_ent	gc_trace_buf[GC_TRACESZ];
+
 void
 gc_debug_indent(int incr)
 {
@@ -68,6 +72,77 @@ gc_log(int severity, const char *file, int line, const char *format, ...)
 		gc_cmdln();
 }
 
+const char *
+gc_trace_ev_str(int ev)
+{
+
+	if (0)
+		;
+#define	X(cnst, value, str, ...)			\
+	else if (ev == cnst)				\
+		return (str);
+	X_GC_TRACE
+#undef	X
+	else
+		return ("?");
+}
+
+void
+gc_trace_rec(int ev, int line, uint64_t a0, uint64_t a1, uint64_t a2)
+{
+	struct gc_trace_ent *te;
+	uint64_t seq;
+
+	/*
+	 * Claim a slot. Concurrent writers always get distinct slots;
+	 * the sequence number is invalidated first and stored last so
+	 * that gc_trace_dump can detect entries that are being
+	 * overwritten.
+	 */
+	seq = __sync_fetch_and_add(&gc_trace_seq, 1);
+	te = &gc_trace_buf[seq & (GC_TRACESZ - 1)];
+	te->te_seq = GC_TRACE_SEQ_NONE;
+	__sync_synchronize();
+	te->te_ev = ev;
+	te->te_line = line;
+	te->te_arg[0] = a0;
+	te->te_arg[1] = a1;
+	te->te_arg[2] = a2;
+	__sync_synchronize();
+	te->te_seq = seq;
+}
+
+void
+gc_trace_dump(size_t n)
+{
+	struct gc_trace_ent *te, ent;
+	uint64_t seq, end;
+
+	end = gc_trace_seq;
+	if (n > GC_TRACESZ)
+		n = GC_TRACESZ;
+	if (n > end)
+		n = end;
+	for (seq = end - n; seq < end; seq++) {
+		te = &gc_trace_buf[seq & (GC_TRACESZ - 1)];
+		if (te->te_seq != seq)
+			continue; /* overwritten or not yet complete */
+		/*
+		 * A writer may reclaim the slot while it is being copied;
+		 * the copy is only good if te_seq is unchanged after it.
+		 */
+		__sync_synchronize();
+		ent = *te;
+		__sync_synchronize();
+		if (te->te_seq != seq)
+			continue;
+		fprintf(stderr, "gc:trace:%" PRIu64 ": %s (line %u) "
+		    "0x%" PRIx64 " 0x%" PRIx64 " 0x%" PRIx64 "\n",
+		    seq, gc_trace_ev_str(ent.te_ev), ent.te_line,
+		    ent.te_arg[0], ent.te_arg[1], ent.te_arg[2]);
+	}
+}
+
 void
 gc_print_map(_gc_cap struct gc_btbl * btbl)
 {
@@ -163,12 +238,13 @@ gc_print_siginfo_status(void)
 	printf(
 	    "[gc] alloc=%zu allocb=%zu%c mk=%zu mkb=%zu%c swp=%zu swpb=%zu%c\n"
 	    "[gc] btbls: [sz=%zu%c] btblb: [sz=%zu%c]\n"
-	    "[gc] ntcollect=%zu\n",
+	    "[gc] ntcollect=%zu released=%zu%c\n",
 	    gc_state_c->gs_nalloc, SZFORMAT(gc_state_c->gs_nallocbytes),
 	    gc_state_c->gs_nmark, SZFORMAT(gc_state_c->gs_nmarkbytes),
 	    gc_state_c->gs_nsweep, SZFORMAT(gc_state_c->gs_nsweepbytes),
 	    SZFORMAT(btbls_sz), SZFORMAT(btblb_sz),
-	    gc_state_c->gs_ntcollect);
+	    gc_state_c->gs_ntcollect,
+	    SZFORMAT(gc_state_c->gs_nrelease * GC_PAGESZ));
 }
 
 void
@@ -190,21 +266,60 @@ gc_fill(_gc_cap void *obj, uint32_t magic)
 		    (magic >> (24 - (8 * i))) & 0xFF;
 }
 
+void
+gc_fill_zero(_gc_cap void *obj)
+{
+	_gc_cap struct gc_btbl *btbl;
+	uintptr_t lo, hi, pglo, pghi;
+
+	lo = gc_cheri_getbase(obj);
+	hi = lo + gc_cheri_getlen(obj);
+	pglo = GC_ROUND_PAGESZ(lo);
+	pghi = GC_ALIGN_PAGESZ(hi);
+	/* Remapping would break up a superpage. */
+	btbl = gc_get_managed_btbl(lo);
+	if (btbl != NULL && (btbl->bt_flags & GC_BTBL_FLAG_SUPER))
+		pghi = pglo;
+
+	if (pghi > pglo && pghi - pglo >= GC_ZERO_MAP_MIN &&
+	    gc_zero_pages((void *)pglo, pghi - pglo) == 0) {
+		/* Whole pages were remapped; zero the head and tail. */
+		memset((void *)lo, 0, pglo - lo);
+		memset((void *)pghi, 0, hi - pghi);
+	} else
+		memset((void *)lo, 0, hi - lo);
+}
+
 void
 gc_fill_used_mem(_gc_cap void *obj, size_t roundsz)
 {
 
-	gc_debug("fill with INIT_USE: %s", gc_cap_str(obj));
-	gc_fill(obj, GC_MAGIC_INIT_USE);
-	obj = gc_cheri_ptr((void*)(gc_cheri_getbase(obj) +
-	    gc_cheri_getlen(obj)), roundsz - gc_cheri_getlen(obj));
-	gc_debug("fill with INIT_INTERNAL: %s", gc_cap_str(obj));
-	gc_fill(obj, GC_MAGIC_INIT_INTERNAL);
+	switch (gc_state_c->gs_poison) {
+	case GC_POISON_ZERO:
+		/* Zero the object and its slack in one pass. */
+		gc_debug("fill with zero: %s", gc_cap_str(obj));
+		gc_fill_zero(gc_cheri_ptr((void *)gc_cheri_getbase(obj),
+		    roundsz));
+		break;
+	case GC_POISON_PATTERN:
+		gc_debug("fill with INIT_USE: %s", gc_cap_str(obj));
+		gc_fill(obj, GC_MAGIC_INIT_USE);
+		obj = gc_cheri_ptr((void*)(gc_cheri_getbase(obj) +
+		    gc_cheri_getlen(obj)), roundsz - gc_cheri_getlen(obj));
+		gc_debug("fill with INIT_INTERNAL: %s", gc_cap_str(obj));
+		gc_fill(obj, GC_MAGIC_INIT_INTERNAL);
+		break;
+	default:
+		break;
+	}
 }
 
 void
 gc_fill_free_mem(_gc_cap void *obj)
 {
+
+	if (gc_state_c->gs_poison != GC_POISON_PATTERN)
+		return;
 	gc_debug("fill with INIT_FREE: %s", gc_cap_str(obj));
 	gc_fill(obj, GC_MAGIC_INIT_FREE);
 }
@@ -9,9 +9,9 @@
 	X(GC_LOG_ERROR,	0, "error")					\
 	X(GC_LOG_WARN,	1, "warn")					\
 	X(GC_LOG_DEBUG,	2, "debug")
-#define	gc_error(...) gc_log(GC_LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define	gc_warn(...) gc_log(GC_LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define	gc_debug(...) gc_log(GC_LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+#define	gc_error(...) GC_LOG(GC_LOG_ERROR, __VA_ARGS__)
+#define	gc_warn(...) GC_LOG(GC_LOG_WARN, __VA_ARGS__)
+#define	gc_debug(...) GC_LOG(GC_LOG_DEBUG, __VA_ARGS__)
 #define GC_NOTREACHABLE_ERROR() gc_error("NOTREACHABLE")
 
 enum gc_debug_defines {
@@ -20,6 +20,74 @@ enum gc_debug_defines {
 #undef	X
 };
 
+/*
+ * Compile-time log level.
+ *
+ * Messages with a severity greater than GC_LOG_LEVEL are compiled out:
+ * the condition below is constant, so the call to gc_log (and the
+ * evaluation of its arguments, e.g. gc_cap_str) is removed entirely.
+ * Release builds should use GC_LOG_LEVEL=GC_LOG_ERROR.
+ */
+#ifndef GC_LOG_LEVEL
+#define	GC_LOG_LEVEL	GC_LOG_WARN
+#endif
+
+#define	GC_LOG(severity, ...) do {					\
+		if ((severity) <= GC_LOG_LEVEL)				\
+			gc_log((severity), __FILE__, __LINE__,		\
+			    __VA_ARGS__);				\
+	} while (0)
+
+/*
+ * Binary trace ring buffer.
+ *
+ * gc_trace records a fixed-size binary entry in a global ring buffer,
+ * without any formatting or locking. Only events whose bit is set in
+ * gc_trace_mask are recorded, so tracing can stay compiled in and be
+ * switched on at run time; a disabled event costs a load and a branch.
+ * Capability arguments should be passed as base addresses.
+ */
+#define	X_GC_TRACE							\
+	X(GC_TRACE_ALLOC,	0, "alloc")				\
+	X(GC_TRACE_NEWBLK,	1, "newblk")				\
+	X(GC_TRACE_MARK,	2, "mark")				\
+	X(GC_TRACE_SCAN,	3, "scan")				\
+	X(GC_TRACE_SWEEP,	4, "sweep")				\
+	X(GC_TRACE_COLLECT,	5, "collect")				\
+	X(GC_TRACE_REVOKE,	6, "revoke")
+
+enum gc_trace_defines {
+#define	X(cnst, value, ...) cnst=value,
+	X_GC_TRACE
+#undef	X
+};
+
+struct gc_trace_ent {
+	uint64_t	te_seq;		/* sequence number, written last */
+	uint32_t	te_ev;		/* event (GC_TRACE_*) */
+	uint32_t	te_line;	/* source line of trace point */
+	uint64_t	te_arg[3];	/* event-specific arguments */
+};
+
+/* Number of entries in the trace ring; must be a power of two. */
+#define	GC_LOG_TRACESZ	10
+#define	GC_TRACESZ	((size_t)1 << GC_LOG_TRACESZ)
+
+#define	GC_TRACE_ALL	0xFFFFFFFFU
+
+/* te_seq of an entry that is being written. */
+#define	GC_TRACE_SEQ_NONE	(~(uint64_t)0)
+
+extern uint32_t			 gc_trace_mask;
+extern uint64_t			 gc_trace_seq;
+extern struct gc_trace_ent	 gc_trace_buf[GC_TRACESZ];
+
+#define	gc_trace(ev, a0, a1, a2) do {					\
+		if (gc_trace_mask & (1U << (ev)))			\
+			gc_trace_rec((ev), __LINE__, (uint64_t)(a0),	\
+			    (uint64_t)(a1), (uint64_t)(a2));		\
+	} while (0)
+
 extern int	 gc_debug_indent_level;
 #define	GC_DEBUG_INDENT_STR	"\t>>> "
 
@@ -27,6 +95,12 @@ void		 gc_debug_indent(int incr);
 void		 gc_log(int _severity, const char *_file, int _line,
 		    const char *_format, ...);
 const char	*gc_log_severity_str(int _severity);
+/* Records a trace entry; use the gc_trace macro instead. */
+void		 gc_trace_rec(int _ev, int _line, uint64_t _a0, uint64_t _a1,
+		    uint64_t _a2);
+const char	*gc_trace_ev_str(int _ev);
+/* Prints (at most) the last _n entries of the trace ring to stderr. */
+void		 gc_trace_dump(size_t _n);
 const char	*gc_cap_str(_gc_cap void *_ptr);
 /* Prints the map of a block table, without outputting the free blocks. */
 void		 gc_print_map(_gc_cap struct gc_btbl *_btbl);
@@ -35,8 +109,9 @@ const char	*gc_ve_prot_str(uint32_t prot);
 void		 gc_print_vm_tbl(_gc_cap struct gc_vm_tbl *_vt);
 void		 gc_print_siginfo_status(void);
 
-/* Initializes the memory for this object with a magic pattern, in
- * order to aid debugging of memory corruption.
+/* Initializes the memory for this object according to gs_poison:
+ * zeroed, or filled with a magic pattern in order to aid debugging of
+ * memory corruption.
  *
  * It is assumed that the length of _obj specifies how much of the
  * object is actually to be used by a client, and that _roundsz is the
@@ -44,8 +119,11 @@ void		 gc_print_siginfo_status(void);
  * difference can be filled with a different pattern.
  */
 void		 gc_fill_used_mem(_gc_cap void *_obj, size_t _roundsz);
+/* Only writes to _obj in GC_POISON_PATTERN mode. */
 void		 gc_fill_free_mem(_gc_cap void *_obj);
 void		 gc_fill(_gc_cap void * _obj, uint32_t _magic);
+/* Zeroes _obj, remapping whole pages when the object is large. */
+void		 gc_fill_zero(_gc_cap void *_obj);
 
 #define	GC_MAGIC_INIT_USE	0xA110CA7D
 #define	GC_MAGIC_INIT_INTERNAL	0x5CAFF01D
@@ -0,0 +1,353 @@
+#include <sys/mman.h>
+
+#include <string.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_debug.h"
+#include "gc_evac.h"
+#include "gc_revoke.h"
+#include "gc_roots.h"
+
+int
+gc_set_evacuate(int on)
+{
+	int old;
+
+	old = gc_state_c->gs_evac;
+	gc_state_c->gs_evac = on != 0;
+	return (old);
+}
+
+void
+gc_evac_pin(_gc_cap void *obj)
+{
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_blk *blk;
+	int rc;
+
+	blk = NULL;
+	rc = gc_get_obj(obj, NULL, gc_cap_addr(&bt), NULL,
+	    gc_cap_addr(&blk), NULL);
+	if (gc_ty_is_unmanaged(rc) || blk == NULL ||
+	    !(bt->bt_flags & GC_BTBL_FLAG_SMALL) ||
+	    (bt->bt_flags & GC_BTBL_FLAG_NURSERY))
+		return;
+	blk->bk_flags |= GC_BLK_FLAG_PINNED;
+}
+
+/* Pins the blocks referenced from the saved registers and trusted stack. */
+static void
+gc_evac_pin_roots(void)
+{
+	_gc_cap void * _gc_cap *cap;
+	size_t i, ncap;
+
+	for (i = 0; i < GC_NUM_SAVED_REGS; i++)
+		if (gc_cheri_gettag(gc_state_c->gs_regs_c[i]))
+			gc_evac_pin(gc_unseal(gc_state_c->gs_regs_c[i]));
+	/* Stale frames can never be returned to, so pin nothing. */
+	cap = gc_ts_frames(gc_state_c->gs_gts_c, &ncap);
+	ncap *= GC_TS_FRAME_NCAP;
+	for (i = 0; i < ncap; i++)
+		if (gc_cheri_gettag(cap[i]))
+			gc_evac_pin(gc_unseal(cap[i]));
+}
+
+/* Pins the block a capability refers to (a gc_revoke_fn). */
+static int
+gc_evac_pin_slot(_gc_cap void * _gc_cap *slot)
+{
+
+	gc_evac_pin(gc_unseal(*slot));
+	return (0);
+}
+
+/*
+ * Pins the blocks referenced from readable mappings that aren't
+ * writable, as the fix-up pass can't rewrite capabilities there.
+ */
+static void
+gc_evac_pin_ro(void)
+{
+	_gc_cap struct gc_vm_tbl *vt;
+	_gc_cap struct gc_vm_ent *ve;
+	_gc_cap void *page;
+	struct gc_tags tags;
+	uint64_t addr;
+	size_t i;
+
+	vt = &gc_state_c->gs_vt;
+	for (i = 0; i < vt->vt_nent; i++) {
+		ve = &vt->vt_ent[i];
+		if ((ve->ve_prot & (GC_VE_PROT_RD | GC_VE_PROT_WR)) !=
+		    GC_VE_PROT_RD)
+			continue;
+		for (addr = ve->ve_start; addr < ve->ve_end;
+		    addr += GC_PAGESZ) {
+			if (gc_get_managed_btbl(addr) != NULL)
+				continue;
+			page = gc_cheri_ptr((void *)addr, GC_PAGESZ);
+			tags = gc_get_page_tags(page);
+			gc_revoke_scan_page(page, &tags, gc_evac_pin_slot);
+		}
+	}
+}
+
+/* Returns the block whose header is in slot i, or NULL. */
+static _gc_cap struct gc_blk *
+gc_evac_blk(_gc_cap struct gc_btbl *btbl, size_t i)
+{
+
+	if (GC_BTBL_GETTYPE(btbl->bt_map[GC_BTBL_MAPINDX(i)], i) !=
+	    GC_BTBL_USED)
+		return (NULL);
+	return (gc_cheri_ptr((char *)gc_cheri_getbase(btbl->bt_base) +
+	    i * btbl->bt_slotsz, btbl->bt_slotsz));
+}
+
+/* Returns non-zero iff the block is an unpinned evacuation candidate. */
+static int
+gc_evac_sparse(_gc_cap struct gc_blk *blk)
+{
+	size_t nslot, hdrbits;
+
+	if (blk->bk_marks == 0 || (blk->bk_flags & GC_BLK_FLAG_PINNED))
+		return (0);
+	nslot = GC_PAGESZ / blk->bk_objsz;
+	if (nslot > 64)
+		nslot = 64;
+	hdrbits = (GC_BLK_HDRSZ + blk->bk_objsz - 1) / blk->bk_objsz;
+	nslot -= hdrbits;
+	return (__builtin_popcountll(blk->bk_marks) * GC_OCC_NBKT < nslot);
+}
+
+/* Makes room for one more forwarding entry; returns non-zero iff error. */
+static int
+gc_evac_reserve(void)
+{
+	_gc_cap struct gc_evac_ent *fw;
+	size_t sz;
+
+	if (gc_state_c->gs_fw_n < gc_state_c->gs_fw_sz)
+		return (GC_SUCC);
+	sz = gc_state_c->gs_fw_sz != 0 ?
+	    2 * gc_state_c->gs_fw_sz : GC_EVAC_TBLSZ;
+	fw = gc_alloc_internal(sz * sizeof(struct gc_evac_ent));
+	if (fw == NULL) {
+		gc_error("gc_alloc_internal(forwarding table)");
+		return (GC_ERROR);
+	}
+	if (gc_state_c->gs_fw_sz != 0) {
+		memcpy((void *)fw, (void *)gc_state_c->gs_fw,
+		    gc_state_c->gs_fw_n * sizeof(struct gc_evac_ent));
+		munmap((void *)gc_state_c->gs_fw,
+		    gc_state_c->gs_fw_sz * sizeof(struct gc_evac_ent));
+	}
+	gc_state_c->gs_fw = fw;
+	gc_state_c->gs_fw_sz = sz;
+	return (GC_SUCC);
+}
+
+/* Capability-sized copies, so that the tags come along. */
+static void
+gc_evac_copy(_gc_cap void *dst, _gc_cap void *src, size_t sz)
+{
+	_gc_cap void * _gc_cap *d;
+	_gc_cap void * _gc_cap *s;
+	size_t i;
+
+	d = (_gc_cap void * _gc_cap *)dst;
+	s = (_gc_cap void * _gc_cap *)src;
+	for (i = 0; i < sz / sizeof(_gc_cap void *); i++)
+		d[i] = s[i];
+}
+
+/*
+ * Moves the marked objects out of a candidate block. Returns non-zero
+ * iff the class has no room left; the objects not yet moved stay put.
+ */
+static int
+gc_evac_move(_gc_cap struct gc_btbl *btbl, _gc_cap struct gc_blk *blk)
+{
+	_gc_cap struct gc_blk **list;
+	_gc_cap struct gc_blk *nblk;
+	_gc_cap struct gc_evac_ent *fw;
+	_gc_cap void *obj;
+	_gc_cap void *nobj;
+	size_t logsz, nidx, page;
+	uint64_t marks;
+	int k;
+
+	logsz = GC_LOG2(blk->bk_objsz);
+	if (blk->bk_flags & GC_BLK_FLAG_LEAF)
+		list = (_gc_cap struct gc_blk **)
+		    &gc_state_c->gs_leaf[logsz][0];
+	else
+		list = (_gc_cap struct gc_blk **)
+		    &gc_state_c->gs_heap[logsz][0];
+	for (marks = blk->bk_marks; marks != 0; marks &= marks - 1) {
+		k = GC_FIRST_BIT(marks);
+		if (gc_evac_reserve() != GC_SUCC)
+			return (1);
+		nobj = gc_malloc_small(btbl, list, blk->bk_objsz,
+		    blk->bk_objsz, blk->bk_flags & GC_BLK_FLAG_LEAF);
+		if (nobj == NULL)
+			return (1);
+		obj = gc_cheri_incbase(blk, k * blk->bk_objsz);
+		obj = gc_cheri_setlen(obj, blk->bk_objsz);
+		gc_evac_copy(nobj, obj, blk->bk_objsz);
+		(void)gc_get_obj(nobj, NULL, NULL, NULL, gc_cap_addr(&nblk),
+		    gc_cheri_ptr(&nidx, sizeof(nidx)));
+		nblk->bk_marks |= 1ULL << nidx;
+		if (blk->bk_reuse & (1ULL << k))
+			nblk->bk_reuse |= 1ULL << nidx;
+		blk->bk_marks &= ~(1ULL << k);
+		/* The copy's page has new capabilities. */
+		page = (gc_cheri_getbase(nobj) -
+		    gc_cheri_getbase(btbl->bt_base)) / GC_PAGESZ;
+		btbl->bt_tags[page].tg_v = 0;
+		GC_BIT_CLR(btbl->bt_notags, page);
+		/* Blocks are visited in address order, so this stays sorted. */
+		fw = &gc_state_c->gs_fw[gc_state_c->gs_fw_n++];
+		fw->fw_base = gc_cheri_getbase(obj);
+		fw->fw_top = fw->fw_base + blk->bk_objsz;
+		fw->fw_new = gc_cheri_getbase(nobj);
+#ifdef GC_COLLECT_STATS
+		/* The sweep counts the old slot as freed. */
+		gc_state_c->gs_nalloc++;
+		gc_state_c->gs_nallocbytes += blk->bk_objsz;
+#endif
+	}
+	return (0);
+}
+
+static _gc_cap struct gc_evac_ent *
+gc_evac_find(uint64_t base)
+{
+	_gc_cap struct gc_evac_ent *fw;
+	size_t lo, hi, mid;
+
+	fw = gc_state_c->gs_fw;
+	if (gc_state_c->gs_fw_n == 0 || base < fw[0].fw_base ||
+	    base >= fw[gc_state_c->gs_fw_n - 1].fw_top)
+		return (NULL);
+	/* Find the last entry starting at or below base. */
+	lo = 0;
+	hi = gc_state_c->gs_fw_n;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (fw[mid].fw_base <= base)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return (base < fw[lo].fw_top ? &fw[lo] : NULL);
+}
+
+uint64_t
+gc_evac_lookup(uint64_t base)
+{
+	_gc_cap struct gc_evac_ent *fw;
+
+	fw = gc_evac_find(base);
+	if (fw == NULL)
+		return (0);
+	return (fw->fw_new + (base - fw->fw_base));
+}
+
+/* Points a capability into a moved object at the copy (a gc_revoke_fn). */
+static int
+gc_evac_fix(_gc_cap void * _gc_cap *slot)
+{
+	_gc_cap struct gc_evac_ent *fw;
+	_gc_cap void *cap;
+	_gc_cap void *ncap;
+	uint64_t base, len;
+
+	cap = *slot;
+	/* Sealed capabilities pinned their objects. */
+	if (!gc_cheri_gettag(cap) || gc_cheri_getsealed(cap))
+		return (0);
+	base = gc_cheri_getbase(cap);
+	fw = gc_evac_find(base);
+	if (fw == NULL)
+		return (0);
+	len = gc_cheri_getlen(cap);
+	if (base + len > fw->fw_top) {
+		gc_error("capability overlaps a moved object: %s",
+		    gc_cap_str(cap));
+		return (0);
+	}
+	ncap = gc_cheri_ptr((void *)(fw->fw_new + (base - fw->fw_base)), len);
+	ncap = gc_cheri_setoffset(ncap, gc_cheri_getoffset(cap));
+	ncap = gc_cheri_andperm(ncap, gc_cheri_getperm(cap));
+	*slot = ncap;
+	return (0);
+}
+
+void
+gc_evacuate(void)
+{
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_blk *blk;
+	size_t ncand[GC_LOG_BIGSZ][2];
+	size_t i, nblk;
+
+	gc_state_c->gs_evac_now = 0;
+	gc_state_c->gs_fw_n = 0;
+	bt = &gc_state_c->gs_btbl_small;
+	if (!bt->bt_valid)
+		return;
+	gc_evac_pin_roots();
+	gc_evac_pin_ro();
+	memset(ncand, 0, sizeof(ncand));
+	for (i = 0; i < bt->bt_nslots; i++) {
+		blk = gc_evac_blk(bt, i);
+		if (blk != NULL && gc_evac_sparse(blk))
+			ncand[GC_LOG2(blk->bk_objsz)]
+			    [!!(blk->bk_flags & GC_BLK_FLAG_LEAF)]++;
+	}
+	/* Keep the allocator away from the candidates. */
+	nblk = 0;
+	for (i = 0; i < bt->bt_nslots; i++) {
+		blk = gc_evac_blk(bt, i);
+		if (blk == NULL || !gc_evac_sparse(blk) ||
+		    ncand[GC_LOG2(blk->bk_objsz)]
+		    [!!(blk->bk_flags & GC_BLK_FLAG_LEAF)] < 2)
+			continue;
+		gc_rm_blk(blk, gc_blk_list(bt, blk));
+		blk->bk_flags |= GC_BLK_FLAG_EVAC;
+		nblk++;
+	}
+	for (i = 0; i < bt->bt_nslots && nblk != 0; i++) {
+		blk = gc_evac_blk(bt, i);
+		if (blk != NULL && (blk->bk_flags & GC_BLK_FLAG_EVAC) &&
+		    gc_evac_move(bt, blk) != 0)
+			break;
+	}
+	/*
+	 * The fix-up scans read tags afresh and leave bt_tags alone: a
+	 * fixed-up capability keeps its tag, and the copies' pages were
+	 * invalidated by gc_evac_move.
+	 */
+	if (gc_state_c->gs_fw_n != 0) {
+		gc_revoke_scan_bt(&gc_state_c->gs_btbl_small, gc_evac_fix);
+		gc_revoke_scan_bt(&gc_state_c->gs_btbl_big, gc_evac_fix);
+		gc_revoke_scan_bt(&gc_state_c->gs_btbl_nursery, gc_evac_fix);
+		gc_revoke_scan_vm(gc_evac_fix);
+		gc_roots_scan_wp(gc_evac_fix);
+		gc_prof_evac();
+	}
+	/* Emptied blocks are freed by the sweep; the rest go back. */
+	for (i = 0; i < bt->bt_nslots; i++) {
+		blk = gc_evac_blk(bt, i);
+		if (blk == NULL)
+			continue;
+		if ((blk->bk_flags & GC_BLK_FLAG_EVAC) && blk->bk_marks != 0)
+			gc_ins_blk(blk, gc_blk_list(bt, blk));
+		blk->bk_flags &= ~(GC_BLK_FLAG_EVAC | GC_BLK_FLAG_PINNED);
+	}
+	gc_debug("evacuated %zu object(s) from %zu sparse block(s)",
+	    gc_state_c->gs_fw_n, nblk);
+}
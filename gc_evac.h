@@ -0,0 +1,56 @@
+#ifndef _GC_EVAC_H_
+#define _GC_EVAC_H_
+
+#include <stdint.h>
+
+#include "gc_cheri.h"
+
+/*
+ * Evacuation of sparse small blocks.
+ *
+ * With gc_set_evacuate(1), a full collection started by gc_collect
+ * compacts the old small heap once marking completes and before the
+ * sweep, while the mutator is stopped:
+ *
+ * 1. A block whose marked objects fill less than 1 / GC_OCC_NBKT of
+ *    its slots is a candidate, unless it is pinned. Size classes with
+ *    fewer than two candidates are left alone, as moving the objects
+ *    would not free a block.
+ * 2. The candidates are taken off their lists, and each marked object
+ *    is copied to a slot allocated from the remaining (dense) blocks of
+ *    its class, which is marked in its place. The old slot is left
+ *    unmarked for the sweep, and the move is recorded in a forwarding
+ *    table sorted by old base.
+ * 3. Every tagged word of the managed btbls and of the writable
+ *    unmanaged mappings (see gc_revoke_scan_bt) that points into a
+ *    moved object is rewritten to the new copy, keeping its offset
+ *    from the object's base, its length, its offset and its
+ *    permissions.
+ *
+ * Blocks are pinned, and never moved, if they are referenced from the
+ * saved registers or the trusted stack (which are handed back to the
+ * mutator as they are), from readable mappings that aren't writable
+ * (which the fix-up pass can't store to), or by a sealed capability
+ * found while marking (which the collector can unseal, but not seal
+ * again). Big objects and
+ * the nursery are never moved.
+ */
+
+/* A moved object: [fw_base, fw_top) now lives at fw_new. */
+struct gc_evac_ent {
+	uint64_t	fw_base;
+	uint64_t	fw_top;
+	uint64_t	fw_new;
+};
+
+/* Initial number of forwarding entries; the table grows by doubling. */
+#define	GC_EVAC_TBLSZ		1024
+
+/* Evacuates sparse blocks; requires marking complete, regs saved. */
+void	gc_evacuate(void);
+/* Pins the block containing the object, if any. */
+void	gc_evac_pin(_gc_cap void *_obj);
+/* Returns the new base of a moved object, or 0 if it was not moved. */
+uint64_t	gc_evac_lookup(uint64_t _base);
+
+#endif /* !_GC_EVAC_H_ */
@@ -0,0 +1,214 @@
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "gc_debug.h"
+#include "gc_event.h"
+
+uint64_t
+gc_ev_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+size_t
+gc_ev_hist_bkt(uint64_t ns)
+{
+	int e;
+
+	if (ns < GC_EV_HIST_SUB)
+		return (ns);
+	e = 63 - __builtin_clzll(ns);
+	return ((e - GC_EV_LOG_HIST_SUB + 1) * GC_EV_HIST_SUB +
+	    ((ns >> (e - GC_EV_LOG_HIST_SUB)) & (GC_EV_HIST_SUB - 1)));
+}
+
+uint64_t
+gc_ev_hist_max(size_t bkt)
+{
+	int e;
+	uint64_t sub;
+
+	if (bkt < GC_EV_HIST_SUB)
+		return (bkt);
+	e = bkt / GC_EV_HIST_SUB + GC_EV_LOG_HIST_SUB - 1;
+	sub = bkt % GC_EV_HIST_SUB;
+	return (((GC_EV_HIST_SUB + sub + 1) << (e - GC_EV_LOG_HIST_SUB)) - 1);
+}
+
+/* Appends el_cur to the ring and calls the callback. */
+static void
+gc_ev_record(void)
+{
+	_gc_cap struct gc_event_log *el;
+	_gc_cap struct gc_event *ev;
+
+	el = &gc_state_c->gs_ev;
+	ev = &el->el_ring[el->el_nrec++ & (GC_EV_RINGSZ - 1)];
+	*ev = el->el_cur;
+	el->el_active = 0;
+	gc_debug("collection %llu: %llu ns, paused %llu ns (max %llu ns), "
+	    "stack high-water %zu, %zu page(s) scanned",
+	    (unsigned long long)ev->ev_seq,
+	    (unsigned long long)(ev->ev_sweep - ev->ev_start),
+	    (unsigned long long)ev->ev_pause,
+	    (unsigned long long)ev->ev_maxpause,
+	    ev->ev_stackhw, ev->ev_pages);
+	if (el->el_fn != NULL)
+		el->el_fn((const struct gc_event *)(void *)ev, el->el_arg);
+}
+
+void
+gc_ev_begin(int kind)
+{
+	_gc_cap struct gc_event_log *el;
+
+	el = &gc_state_c->gs_ev;
+	if (el->el_active)
+		gc_ev_record();
+	memset((void *)&el->el_cur, 0, sizeof(el->el_cur));
+	el->el_cur.ev_seq = el->el_seq++;
+	el->el_cur.ev_kind = kind;
+	el->el_cur.ev_start = gc_ev_now();
+	el->el_active = 1;
+	el->el_swept = 0;
+}
+
+void
+gc_ev_roots(void)
+{
+
+	gc_state_c->gs_ev.el_cur.ev_roots = gc_ev_now();
+}
+
+void
+gc_ev_marked(void)
+{
+	_gc_cap struct gc_event *ev;
+
+	ev = &gc_state_c->gs_ev.el_cur;
+	ev->ev_mark = gc_ev_now();
+#ifdef GC_COLLECT_STATS
+	ev->ev_nmark = gc_state_c->gs_nmark;
+	ev->ev_markbytes = gc_state_c->gs_nmarkbytes;
+#endif
+}
+
+void
+gc_ev_swept(void)
+{
+	_gc_cap struct gc_event_log *el;
+
+	el = &gc_state_c->gs_ev;
+	if (!el->el_active)
+		return;
+	el->el_cur.ev_sweep = gc_ev_now();
+#ifdef GC_COLLECT_STATS
+	el->el_cur.ev_nsweep = gc_state_c->gs_nsweep;
+	el->el_cur.ev_sweepbytes = gc_state_c->gs_nsweepbytes;
+#endif
+	el->el_swept = 1;
+	/* Otherwise, recorded when the pause ends. */
+	if (el->el_pausebeg == 0)
+		gc_ev_record();
+}
+
+void
+gc_ev_pause_begin(void)
+{
+	_gc_cap struct gc_event_log *el;
+
+	el = &gc_state_c->gs_ev;
+	if (el->el_pausebeg == 0)
+		el->el_pausebeg = gc_ev_now();
+}
+
+void
+gc_ev_pause_end(void)
+{
+	_gc_cap struct gc_event_log *el;
+	uint64_t ns;
+
+	el = &gc_state_c->gs_ev;
+	if (el->el_pausebeg == 0)
+		return;
+	ns = gc_ev_now() - el->el_pausebeg;
+	el->el_pausebeg = 0;
+	el->el_hist[gc_ev_hist_bkt(ns)]++;
+	el->el_npause++;
+	if (el->el_active) {
+		el->el_cur.ev_pause += ns;
+		if (ns > el->el_cur.ev_maxpause)
+			el->el_cur.ev_maxpause = ns;
+		if (el->el_swept)
+			gc_ev_record();
+	}
+}
+
+void
+gc_set_event_fn(gc_event_fn *fn, void *arg)
+{
+
+	GC_LOCK();
+	gc_state_c->gs_ev.el_fn = fn;
+	gc_state_c->gs_ev.el_arg = arg;
+	GC_UNLOCK();
+}
+
+size_t
+gc_get_events(struct gc_event *buf, size_t n)
+{
+	_gc_cap struct gc_event_log *el;
+	size_t i, nrec;
+
+	GC_LOCK();
+	el = &gc_state_c->gs_ev;
+	nrec = el->el_nrec < GC_EV_RINGSZ ? el->el_nrec : GC_EV_RINGSZ;
+	if (n > nrec)
+		n = nrec;
+	for (i = 0; i < n; i++)
+		buf[i] = el->el_ring[(el->el_nrec - n + i) &
+		    (GC_EV_RINGSZ - 1)];
+	GC_UNLOCK();
+	return (n);
+}
+
+uint64_t
+gc_pause_pct(double pct)
+{
+	uint64_t rv;
+
+	GC_LOCK();
+	rv = gc_ev_pause_pct(pct);
+	GC_UNLOCK();
+	return (rv);
+}
+
+uint64_t
+gc_ev_pause_pct(double pct)
+{
+	_gc_cap struct gc_event_log *el;
+	uint64_t target, sum, rv;
+	size_t i;
+
+	el = &gc_state_c->gs_ev;
+	rv = 0;
+	if (el->el_npause != 0) {
+		target = (uint64_t)(pct / 100.0 * el->el_npause);
+		if (target == 0)
+			target = 1;
+		if (target > el->el_npause)
+			target = el->el_npause;
+		for (i = 0, sum = 0; i < GC_EV_HIST_NBKT; i++) {
+			sum += el->el_hist[i];
+			if (sum >= target) {
+				rv = gc_ev_hist_max(i);
+				break;
+			}
+		}
+	}
+	return (rv);
+}
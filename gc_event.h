@@ -0,0 +1,91 @@
+#ifndef _GC_EVENT_H_
+#define _GC_EVENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Collection event log.
+ *
+ * Each collection fills in a struct gc_event as it goes: timestamps
+ * (CLOCK_MONOTONIC, in nanoseconds) for its start, for the end of the
+ * root push, and for the end of marking and of sweeping, together with
+ * its stop-the-world time, the mark stack high-water mark and the
+ * number of pages scanned. The object and byte counts are only
+ * available with GC_COLLECT_STATS, and are zero otherwise.
+ *
+ * When the collection's sweep completes (which, for lazy sweeping, may
+ * be well after the mutators have resumed), the event is appended to a
+ * ring of the last GC_EV_RINGSZ events and passed to the callback set
+ * with gc_set_event_fn. The callback runs inside the collector with
+ * gs_lock held, possibly on the collector thread, and must not call
+ * back into it.
+ *
+ * Every stop-the-world pause is also recorded in a log-linear
+ * histogram: values below GC_EV_HIST_SUB ns have a bucket each, and
+ * every power of two above that is split into GC_EV_HIST_SUB buckets,
+ * so percentiles (gc_pause_pct) are exact to within 1/GC_EV_HIST_SUB.
+ */
+
+/* Collection kinds (ev_kind). */
+#define	GC_EV_FULL		0
+#define	GC_EV_MINOR		1
+#define	GC_EV_CONC		2
+
+struct gc_event {
+	uint64_t	ev_seq;		/* collection number */
+	int		ev_kind;	/* GC_EV_* */
+	uint64_t	ev_start;	/* collection started */
+	uint64_t	ev_roots;	/* roots pushed */
+	uint64_t	ev_mark;	/* marking complete */
+	uint64_t	ev_sweep;	/* sweeping complete */
+	uint64_t	ev_pause;	/* total stop-the-world time */
+	uint64_t	ev_maxpause;	/* longest single pause */
+	size_t		ev_nmark;	/* objects marked */
+	size_t		ev_markbytes;	/* bytes marked */
+	size_t		ev_nsweep;	/* objects swept */
+	size_t		ev_sweepbytes;	/* bytes swept */
+	size_t		ev_stackhw;	/* mark stack high-water (entries) */
+	size_t		ev_pages;	/* pages scanned for capabilities */
+};
+
+typedef void		gc_event_fn(const struct gc_event *_ev, void *_arg);
+
+/* Number of events kept (power of 2). */
+#define	GC_EV_RINGSZ		64
+/* Histogram buckets per power of two (power of 2), and in total. */
+#define	GC_EV_LOG_HIST_SUB	3
+#define	GC_EV_HIST_SUB		(1 << GC_EV_LOG_HIST_SUB)
+#define	GC_EV_HIST_NBKT		(64 * GC_EV_HIST_SUB)
+
+struct gc_event_log {
+	struct gc_event	 el_ring[GC_EV_RINGSZ];
+	uint64_t	 el_seq;	/* events started */
+	uint64_t	 el_nrec;	/* events recorded in el_ring */
+	struct gc_event	 el_cur;	/* event in progress */
+	int		 el_active;	/* el_cur is in progress */
+	int		 el_swept;	/* el_cur's sweep is complete */
+	uint64_t	 el_pausebeg;	/* start of current pause, or 0 */
+	uint64_t	 el_hist[GC_EV_HIST_NBKT]; /* pause times */
+	uint64_t	 el_npause;	/* pauses in el_hist */
+	gc_event_fn	*el_fn;		/* callback, or NULL */
+	void		*el_arg;	/* callback argument */
+};
+
+/* Returns the current CLOCK_MONOTONIC time in nanoseconds. */
+uint64_t	gc_ev_now(void);
+/* Starts a new event; any event still in progress is recorded first. */
+void		gc_ev_begin(int _kind);
+/* Mark the ends of the root push, the marking and the sweeping. */
+void		gc_ev_roots(void);
+void		gc_ev_marked(void);
+void		gc_ev_swept(void);
+/* Bracket a stop-the-world pause. */
+void		gc_ev_pause_begin(void);
+void		gc_ev_pause_end(void);
+/* gc_pause_pct, without taking gs_lock. */
+uint64_t	gc_ev_pause_pct(double _pct);
+size_t		gc_ev_hist_bkt(uint64_t _ns);
+uint64_t	gc_ev_hist_max(size_t _bkt);
+
+#endif /* !_GC_EVENT_H_ */
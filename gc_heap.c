@@ -0,0 +1,233 @@
+#include <sys/mman.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_debug.h"
+#include "gc_evac.h"
+#include "gc_heap.h"
+#include "gc_prof.h"
+#include "gc_revoke.h"
+#include "gc_roots.h"
+#include "gc_stack.h"
+#include "gc_vm.h"
+
+/* Flags that replace a released reservation with an inaccessible one. */
+#ifdef MAP_GUARD
+#define	GC_HEAP_GUARD_FLAGS	(MAP_GUARD | MAP_FIXED)
+#else
+#define	GC_HEAP_GUARD_FLAGS	(MAP_ANON | MAP_PRIVATE | MAP_FIXED)
+#endif
+
+int
+gc_heap_register(_gc_cap struct gc_heap_tbl *ht)
+{
+
+	if (ht == NULL) {
+		ht = gc_alloc_internal(sizeof(struct gc_heap_tbl));
+		if (ht == NULL) {
+			gc_error("gc_alloc_internal(%zu)",
+			    sizeof(struct gc_heap_tbl));
+			return (GC_ERROR);
+		}
+	}
+	if (ht->ht_n == GC_NHEAP) {
+		gc_error("too many heaps");
+		return (GC_ERROR);
+	}
+	ht->ht_heap[ht->ht_n++] = gc_state_c;
+	gc_state_c->gs_heaps = ht;
+	return (GC_SUCC);
+}
+
+/* Inserts a range into ht_rng, keeping it sorted. */
+static void
+gc_heap_rng_ins(_gc_cap struct gc_heap_tbl *ht, uint64_t base,
+    uint64_t top, _gc_cap struct gc_state *heap, int resv)
+{
+	size_t i;
+
+	for (i = ht->ht_nrng; i > 0 && ht->ht_rng[i - 1].hr_base > base; i--)
+		ht->ht_rng[i] = ht->ht_rng[i - 1];
+	ht->ht_rng[i].hr_base = base;
+	ht->ht_rng[i].hr_top = top;
+	ht->ht_rng[i].hr_heap = heap;
+	ht->ht_rng[i].hr_resv = resv;
+	ht->ht_nrng++;
+}
+
+void
+gc_heap_index(void)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	_gc_cap struct gc_state *gs;
+	size_t i;
+
+	ht = gc_state_c->gs_heaps;
+	ht->ht_nrng = 0;
+	ht->ht_nspill = 0;
+	for (i = 0; i < ht->ht_n; i++) {
+		gs = ht->ht_heap[i];
+		gc_heap_rng_ins(ht, gc_cheri_getbase(gs),
+		    gc_cheri_getbase(gs) + sizeof(struct gc_state), gs, 0);
+		if (gs->gs_hp_base != 0)
+			gc_heap_rng_ins(ht, gs->gs_hp_base, gs->gs_hp_top,
+			    gs, 1);
+		if (gs->gs_hp_spill)
+			ht->ht_nspill++;
+	}
+}
+
+/* Returns the index of the heap in the table, or -1. */
+static int
+gc_heap_find(_gc_cap struct gc_state *heap)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	size_t i;
+
+	ht = gc_state_c->gs_heaps;
+	for (i = 0; i < ht->ht_n; i++)
+		if (ht->ht_heap[i] == heap)
+			return (i);
+	return (-1);
+}
+
+_gc_cap struct gc_state *
+gc_heap_new(void)
+{
+	_gc_cap struct gc_state *cur, *heap;
+
+	cur = gc_state_c;
+	/* gc_init_lazy works on gc_state_c, as does the collector thread. */
+	if (cur->gs_conc != 0 || cur->gs_heaps->ht_n == GC_NHEAP)
+		return (NULL);
+	heap = NULL;
+	if (gc_init_lazy() == 0)
+		heap = gc_state_c;
+	gc_state_c = cur;
+	return (heap);
+}
+
+_gc_cap struct gc_state *
+gc_heap_switch(_gc_cap struct gc_state *heap)
+{
+	_gc_cap struct gc_state *old;
+
+	old = gc_state_c;
+	if (gc_heap_find(heap) < 0 || old->gs_conc != 0 || heap->gs_conc != 0)
+		return (NULL);
+	gc_state_c = heap;
+	return (old);
+}
+
+/* Unmaps everything that gc_state_c owns, then gc_state_c itself. */
+static void
+gc_heap_release(void)
+{
+	_gc_cap struct gc_state *gs;
+
+	gs = gc_state_c;
+	/* Give up the shared SIGSEGV handler, if this was its last user. */
+	if (gs->gs_root_wp)
+		gc_set_root_wp(0);
+	while (gs->gs_nroots != 0)
+		gc_roots_remove(gs->gs_roots[0].rt_range);
+	if (gs->gs_roots != NULL)
+		munmap((void *)gs->gs_roots,
+		    gs->gs_roots_sz * sizeof(struct gc_root));
+	/*
+	 * Objects in the reservation go with it. Its memory is freed,
+	 * but the range stays mapped, inaccessible, so that it isn't
+	 * reused while capabilities to the heap's objects remain.
+	 */
+	gc_free_btbl(&gs->gs_btbl_small);
+	gc_free_btbl(&gs->gs_btbl_big);
+	gc_free_btbl(&gs->gs_btbl_nursery);
+	if (gs->gs_hp_base != 0 && mmap((void *)gs->gs_hp_base,
+	    gs->gs_hp_top - gs->gs_hp_base, PROT_NONE, GC_HEAP_GUARD_FLAGS,
+	    -1, 0) == MAP_FAILED)
+		gc_error("mmap(PROT_NONE) of the reservation at %p",
+		    (void *)gs->gs_hp_base);
+	if (gs->gs_ready) {
+		gc_stack_free(&gs->gs_mark_stack);
+		gc_stack_free(&gs->gs_sweep_stack);
+		gc_vm_tbl_free(&gs->gs_vt);
+	}
+	if (gs->gs_rv != NULL)
+		munmap((void *)gs->gs_rv,
+		    gs->gs_rv_sz * sizeof(struct gc_revoke_ent));
+	if (gs->gs_fw != NULL)
+		munmap((void *)gs->gs_fw,
+		    gs->gs_fw_sz * sizeof(struct gc_evac_ent));
+	if (gs->gs_wb_pages != NULL)
+		munmap((void *)gs->gs_wb_pages,
+		    gs->gs_wb_sz * sizeof(uint64_t));
+	if (gs->gs_prof != NULL)
+		munmap((void *)gs->gs_prof, sizeof(struct gc_prof));
+#ifdef GC_USE_PTHREAD
+	pthread_mutex_destroy((pthread_mutex_t *)&gs->gs_lock);
+	pthread_cond_destroy((pthread_cond_t *)&gs->gs_conc_cv);
+#endif
+	munmap((void *)gs, sizeof(struct gc_state));
+}
+
+int
+gc_heap_destroy(_gc_cap struct gc_state *heap)
+{
+	_gc_cap struct gc_state *cur;
+	_gc_cap struct gc_heap_tbl *ht;
+	int i;
+
+	cur = gc_state_c;
+	ht = cur->gs_heaps;
+	i = gc_heap_find(heap);
+	/* Neither the default heap nor the current one. */
+	if (i <= 0 || heap == cur || heap->gs_conc != 0)
+		return (GC_ERROR);
+	ht->ht_heap[i] = ht->ht_heap[--ht->ht_n];
+	gc_debug("destroying heap %s", gc_cap_str(heap));
+	gc_state_c = heap;
+	gc_heap_release();
+	gc_state_c = cur;
+	gc_heap_index();
+	return (GC_SUCC);
+}
+
+int
+gc_heap_skip(uint64_t addr)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	_gc_cap struct gc_heap_rng *rng;
+	_gc_cap struct gc_state *gs;
+	size_t i, lo, hi, mid;
+
+	ht = gc_state_c->gs_heaps;
+	rng = ht->ht_rng;
+	if (ht->ht_nrng != 0 && addr >= rng[0].hr_base) {
+		/* Find the last range starting at or below addr. */
+		lo = 0;
+		hi = ht->ht_nrng;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (rng[mid].hr_base <= addr)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if (addr < rng[lo].hr_top)
+			return (!rng[lo].hr_resv ||
+			    rng[lo].hr_heap != gc_state_c);
+	}
+	if (ht->ht_nspill == 0)
+		return (0);
+	for (i = 0; i < ht->ht_n; i++) {
+		gs = ht->ht_heap[i];
+		if (gs == gc_state_c)
+			continue;
+		if (gs->gs_hp_spill &&
+		    (gc_btbl_contains(&gs->gs_btbl_small, addr) ||
+		    gc_btbl_contains(&gs->gs_btbl_big, addr) ||
+		    gc_btbl_contains(&gs->gs_btbl_nursery, addr)))
+			return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,75 @@
+#ifndef _GC_HEAP_H_
+#define _GC_HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+
+/*
+ * Multiple heaps.
+ *
+ * gc_init creates the default heap; gc_heap_new creates others (e.g.,
+ * one per sandbox). Each heap is a struct gc_state of its own, with its
+ * own address space reservation, btbls, size-class lists, mark and
+ * sweep stacks, VM table and root ranges (the static segments, to
+ * begin with). Every entry point acts on the current heap, gc_state_c,
+ * which gc_heap_switch selects.
+ *
+ * A collection traces the current heap only: capabilities into the
+ * reservation (or spilled btbls) of another heap, and into any heap's
+ * struct gc_state, are neither marked nor scanned. An object is
+ * therefore kept alive by the roots (registers, stacks and the current
+ * heap's root ranges) and by the objects of its own heap, directly or
+ * through unmanaged memory, but not by the objects of other heaps.
+ * Revocation and evacuation still update references held by other
+ * heaps, as they scan all writable mappings.
+ *
+ * gc_heap_destroy releases a heap without collecting it: a bounded
+ * number of unmappings (the btbl maps, the stacks and tables), whatever
+ * the size of the heap. The reservation is not unmapped but replaced by
+ * an inaccessible mapping, so that its addresses, to which capabilities
+ * may remain, are never handed out again.
+ *
+ * gc_heap_skip finds the range holding an address by binary search in
+ * ht_rng, the reservations and struct gc_states of all heaps sorted by
+ * base. Btbls mapped outside a reservation (gs_hp_spill) are tested one
+ * by one, for the heaps that have any.
+ *
+ * Switching is not synchronized with other threads, and a heap with
+ * concurrent modes on (gc_set_concurrent) can be neither switched
+ * from nor to, as its collector thread works on gc_state_c.
+ */
+
+/* Maximum number of heaps, including the default heap. */
+#define	GC_NHEAP		64
+
+/* An address range of a heap: its reservation or its struct gc_state. */
+struct gc_heap_rng {
+	uint64_t		 hr_base;
+	uint64_t		 hr_top;
+	_gc_cap struct gc_state	*hr_heap;	/* owner */
+	int			 hr_resv;	/* the owner's reservation */
+};
+
+/* Heaps in existence; shared by all of them. */
+struct gc_heap_tbl {
+	_gc_cap struct gc_state	*ht_heap[GC_NHEAP];	/* [0]: default */
+	size_t			 ht_n;
+	struct gc_heap_rng	 ht_rng[2 * GC_NHEAP];	/* sorted by hr_base */
+	size_t			 ht_nrng;
+	size_t			 ht_nspill;	/* heaps with gs_hp_spill set */
+};
+
+/* Adds gc_state_c to the table (allocating it if _ht is NULL). */
+int	gc_heap_register(_gc_cap struct gc_heap_tbl *_ht);
+/* Rebuilds ht_rng; called when a heap is reserved or destroyed. */
+void	gc_heap_index(void);
+/*
+ * Returns non-zero iff the marker should ignore the address, as it
+ * belongs to another heap or to a struct gc_state.
+ */
+int	gc_heap_skip(uint64_t _addr);
+
+#endif /* !_GC_HEAP_H_ */
@@ -0,0 +1,263 @@
+#include <execinfo.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_debug.h"
+#include "gc_prof.h"
+
+size_t
+gc_set_prof_rate(size_t bytes)
+{
+	size_t old;
+
+	GC_LOCK();
+	old = gc_prof_set_rate(bytes);
+	GC_UNLOCK();
+	return (old);
+}
+
+size_t
+gc_prof_set_rate(size_t bytes)
+{
+	size_t old;
+
+	if (bytes != 0 && gc_state_c->gs_prof == NULL) {
+		gc_state_c->gs_prof = gc_alloc_internal(sizeof(struct gc_prof));
+		if (gc_state_c->gs_prof == NULL) {
+			gc_error("gc_alloc_internal(%zu)",
+			    sizeof(struct gc_prof));
+			bytes = 0;
+		}
+	}
+	old = gc_state_c->gs_prof_rate;
+	gc_state_c->gs_prof_rate = bytes;
+	gc_state_c->gs_prof_left = bytes;
+	return (old);
+}
+
+/*
+ * Returns the bucket for the given stack, claiming a free one if
+ * necessary, or -1 if the table is full.
+ */
+static int
+gc_prof_bkt(uint64_t *pc, int depth)
+{
+	_gc_cap struct gc_prof_bkt *pb;
+	uint64_t h;
+	int i, n;
+
+	/* FNV-1a over the return addresses. */
+	h = 14695981039346656037ULL;
+	for (i = 0; i < depth; i++) {
+		h ^= pc[i];
+		h *= 1099511628211ULL;
+	}
+	for (n = 0; n < GC_PROF_NBKT; n++) {
+		i = (h + n) & (GC_PROF_NBKT - 1);
+		pb = &gc_state_c->gs_prof->pf_bkt[i];
+		if (pb->pb_depth == 0) {
+			memcpy(pb->pb_pc, pc, depth * sizeof(*pc));
+			pb->pb_depth = depth;
+			return (i);
+		}
+		if (pb->pb_depth == depth &&
+		    memcmp(pb->pb_pc, pc, depth * sizeof(*pc)) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+void
+gc_prof_alloc(_gc_cap void *ptr, size_t sz)
+{
+	_gc_cap struct gc_prof *pf;
+	_gc_cap struct gc_prof_ent *pe;
+	_gc_cap struct gc_prof_bkt *pb;
+	void *bt[GC_PROF_DEPTH + GC_PROF_SKIP];
+	uint64_t pc[GC_PROF_DEPTH];
+	int bkt, depth, i;
+
+	if (gc_state_c->gs_prof_left > sz) {
+		gc_state_c->gs_prof_left -= sz;
+		return;
+	}
+	gc_state_c->gs_prof_left = gc_state_c->gs_prof_rate;
+	pf = gc_state_c->gs_prof;
+
+	depth = backtrace(bt, GC_PROF_DEPTH + GC_PROF_SKIP) - GC_PROF_SKIP;
+	if (depth <= 0) {
+		pf->pf_ndrop++;
+		return;
+	}
+	for (i = 0; i < depth; i++)
+		pc[i] = (uint64_t)(uintptr_t)bt[i + GC_PROF_SKIP];
+	bkt = gc_prof_bkt(pc, depth);
+	if (bkt < 0 || pf->pf_nent == GC_PROF_NENT) {
+		pf->pf_ndrop++;
+		return;
+	}
+	pe = &pf->pf_ent[pf->pf_nent++];
+	pe->pe_base = gc_cheri_getbase(ptr);
+	pe->pe_nobj = sz < gc_state_c->gs_prof_rate ?
+	    gc_state_c->gs_prof_rate / sz : 1;
+	pe->pe_bytes = pe->pe_nobj * sz;
+	pe->pe_bkt = bkt;
+	pe->pe_ncoll = 0;
+	pb = &pf->pf_bkt[bkt];
+	pb->pb_nalloc += pe->pe_nobj;
+	pb->pb_allocbytes += pe->pe_bytes;
+	pb->pb_nlive += pe->pe_nobj;
+	pb->pb_livebytes += pe->pe_bytes;
+	gc_debug("profiler: sampled %s", gc_cap_str(ptr));
+}
+
+/* Drops entry i from the in-use counts and the table. */
+static void
+gc_prof_drop(size_t i)
+{
+	_gc_cap struct gc_prof *pf;
+	_gc_cap struct gc_prof_bkt *pb;
+
+	pf = gc_state_c->gs_prof;
+	pb = &pf->pf_bkt[pf->pf_ent[i].pe_bkt];
+	pb->pb_nlive -= pf->pf_ent[i].pe_nobj;
+	pb->pb_livebytes -= pf->pf_ent[i].pe_bytes;
+	pf->pf_ent[i] = pf->pf_ent[--pf->pf_nent];
+}
+
+void
+gc_prof_collect(void)
+{
+	_gc_cap struct gc_prof *pf;
+	_gc_cap struct gc_prof_ent *pe;
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_blk *blk;
+	_gc_cap void *obj;
+	size_t i, nsamp;
+	int rc;
+
+	pf = gc_state_c->gs_prof;
+	if (pf == NULL)
+		return;
+	nsamp = pf->pf_nent;
+	for (i = 0; i < pf->pf_nent; ) {
+		pe = &pf->pf_ent[i];
+		blk = NULL;
+		rc = gc_get_obj(gc_cheri_ptr((void *)pe->pe_base, GC_MINSZ),
+		    gc_cap_addr(&obj), gc_cap_addr(&bt), NULL,
+		    gc_cap_addr(&blk), NULL);
+		if (gc_ty_is_unmanaged(rc) || gc_ty_is_free(rc)) {
+			gc_prof_drop(i);
+			continue;
+		}
+		/* Not traced by this minor collection; still there. */
+		if (gc_minor_skip(bt, blk)) {
+			i++;
+			continue;
+		}
+		if (!gc_ty_is_marked(rc)) {
+			gc_prof_drop(i);
+			continue;
+		}
+		pe->pe_ncoll++;
+		pf->pf_bkt[pe->pe_bkt].pb_nsurv++;
+		i++;
+	}
+	gc_debug("profiler: %zu/%zu sampled object(s) survived",
+	    pf->pf_nent, nsamp);
+}
+
+void
+gc_prof_evac(void)
+{
+	_gc_cap struct gc_prof *pf;
+	uint64_t nbase;
+	size_t i;
+
+	pf = gc_state_c->gs_prof;
+	if (pf == NULL)
+		return;
+	for (i = 0; i < pf->pf_nent; i++) {
+		nbase = gc_evac_lookup(pf->pf_ent[i].pe_base);
+		if (nbase != 0)
+			pf->pf_ent[i].pe_base = nbase;
+	}
+}
+
+void
+gc_prof_free(uint64_t base)
+{
+	_gc_cap struct gc_prof *pf;
+	size_t i;
+
+	pf = gc_state_c->gs_prof;
+	if (pf == NULL)
+		return;
+	for (i = 0; i < pf->pf_nent; i++) {
+		if (pf->pf_ent[i].pe_base == base) {
+			gc_prof_drop(i);
+			return;
+		}
+	}
+}
+
+int
+gc_prof_dump(int fd)
+{
+	int rc;
+
+	GC_LOCK();
+	rc = gc_prof_write(fd);
+	GC_UNLOCK();
+	return (rc);
+}
+
+int
+gc_prof_write(int fd)
+{
+	_gc_cap struct gc_prof *pf;
+	_gc_cap struct gc_prof_bkt *pb;
+	_gc_cap struct gc_vm_ent *ve;
+	size_t i, nlive, livebytes, nalloc, allocbytes;
+	int j;
+
+	pf = gc_state_c->gs_prof;
+	if (pf == NULL)
+		return (GC_ERROR);
+	nlive = livebytes = nalloc = allocbytes = 0;
+	for (i = 0; i < GC_PROF_NBKT; i++) {
+		pb = &pf->pf_bkt[i];
+		nlive += pb->pb_nlive;
+		livebytes += pb->pb_livebytes;
+		nalloc += pb->pb_nalloc;
+		allocbytes += pb->pb_allocbytes;
+	}
+	dprintf(fd, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heapprofile\n",
+	    nlive, livebytes, nalloc, allocbytes);
+	for (i = 0; i < GC_PROF_NBKT; i++) {
+		pb = &pf->pf_bkt[i];
+		if (pb->pb_depth == 0)
+			continue;
+		dprintf(fd, "%6zu: %8zu [%6zu: %8zu] @",
+		    pb->pb_nlive, pb->pb_livebytes,
+		    pb->pb_nalloc, pb->pb_allocbytes);
+		for (j = 0; j < pb->pb_depth; j++)
+			dprintf(fd, " 0x%" PRIx64, pb->pb_pc[j]);
+		dprintf(fd, "\n");
+	}
+	dprintf(fd, "\nMAPPED_LIBRARIES:\n");
+	for (i = 0; i < gc_state_c->gs_vt.vt_nent; i++) {
+		ve = &gc_state_c->gs_vt.vt_ent[i];
+		dprintf(fd, "%08" PRIx64 "-%08" PRIx64 " %c%c%cp 00000000 "
+		    "00:00 0\n", ve->ve_start, ve->ve_end,
+		    (ve->ve_prot & GC_VE_PROT_RD) ? 'r' : '-',
+		    (ve->ve_prot & GC_VE_PROT_WR) ? 'w' : '-',
+		    (ve->ve_prot & GC_VE_PROT_EX) ? 'x' : '-');
+	}
+	if (pf->pf_ndrop != 0)
+		gc_debug("profiler: %zu sample(s) dropped", pf->pf_ndrop);
+	return (GC_SUCC);
+}
@@ -0,0 +1,80 @@
+#ifndef _GC_PROF_H_
+#define _GC_PROF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gc_cheri.h"
+
+/*
+ * Sampling heap profiler.
+ *
+ * With gc_set_prof_rate(n), the allocator takes a sample each time
+ * another n bytes have been allocated: it records the allocation's
+ * call stack (return addresses, from backtrace(3)) in a bucket keyed
+ * by that stack, and remembers the sampled object.
+ *
+ * Each sample stands for the rate / size objects of its size that were
+ * allocated around it (or just itself, for objects bigger than the
+ * rate), and the buckets count these estimates, so the profile is
+ * already scaled when written.
+ *
+ * When marking of a collection completes, every sampled object that
+ * was not marked is dropped from the in-use counts of its bucket, and
+ * the others are counted as having survived. Explicitly freed objects
+ * (gc_revoke_commit) are dropped when they are freed.
+ *
+ * gc_prof_dump writes the buckets in the legacy (text) heap profile
+ * format understood by pprof: in-use (surviving) and allocated
+ * objects and bytes per call stack, followed by the memory mappings.
+ */
+
+/* Maximum number of return addresses per sample. */
+#define	GC_PROF_DEPTH		16
+/* Frames of the profiler and allocator itself, not recorded. */
+#define	GC_PROF_SKIP		3
+/* Number of distinct call stacks (power of 2). */
+#define	GC_PROF_NBKT		1024
+/* Maximum number of sampled objects tracked at once. */
+#define	GC_PROF_NENT		4096
+/* Suggested sampling rate (bytes); profiling is off by default. */
+#define	GC_PROF_RATE_DEFAULT	(512 * 1024)
+
+struct gc_prof_bkt {
+	uint64_t	pb_pc[GC_PROF_DEPTH];	/* return addresses */
+	int		pb_depth;	/* entries used in pb_pc, 0: unused */
+	size_t		pb_nalloc;	/* objects allocated (estimate) */
+	size_t		pb_allocbytes;	/* bytes allocated (estimate) */
+	size_t		pb_nlive;	/* objects in use (estimate) */
+	size_t		pb_livebytes;	/* bytes in use (estimate) */
+	size_t		pb_nsurv;	/* collections survived by samples */
+};
+
+struct gc_prof_ent {
+	uint64_t	pe_base;	/* sampled object */
+	size_t		pe_nobj;	/* objects it stands for */
+	size_t		pe_bytes;	/* bytes it stands for */
+	uint32_t	pe_bkt;		/* index into pf_bkt */
+	uint32_t	pe_ncoll;	/* collections survived */
+};
+
+struct gc_prof {
+	struct gc_prof_bkt	pf_bkt[GC_PROF_NBKT];
+	struct gc_prof_ent	pf_ent[GC_PROF_NENT];
+	size_t			pf_nent;	/* entries used in pf_ent */
+	size_t			pf_ndrop;	/* samples lost to full tables */
+};
+
+/* gc_set_prof_rate and gc_prof_dump, without taking gs_lock. */
+size_t	gc_prof_set_rate(size_t _bytes);
+int	gc_prof_write(int _fd);
+/* Called by the allocator for each allocation while profiling. */
+void	gc_prof_alloc(_gc_cap void *_ptr, size_t _sz);
+/* Called when marking completes; updates the survivors. */
+void	gc_prof_collect(void);
+/* Called after evacuation; follows the samples that were moved. */
+void	gc_prof_evac(void);
+/* Called when an object is freed explicitly. */
+void	gc_prof_free(uint64_t _base);
+
+#endif /* !_GC_PROF_H_ */
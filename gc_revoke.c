@@ -0,0 +1,358 @@
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_collect.h"
+#include "gc_debug.h"
+#include "gc_heap.h"
+#include "gc_revoke.h"
+#include "gc_roots.h"
+#include "gc_scan.h"
+
+int
+gc_revoke_queue(uint64_t base, uint64_t len, int quar)
+{
+	_gc_cap struct gc_revoke_ent *rv;
+	size_t sz;
+
+	if (gc_state_c->gs_rv_n == gc_state_c->gs_rv_sz) {
+		sz = gc_state_c->gs_rv_sz != 0 ?
+		    2 * gc_state_c->gs_rv_sz : GC_REVOKE_BATCHSZ;
+		rv = gc_alloc_internal(sz * sizeof(struct gc_revoke_ent));
+		if (rv == NULL) {
+			gc_error("gc_alloc_internal(revocation batch)");
+			return (GC_ERROR);
+		}
+		if (gc_state_c->gs_rv_sz != 0) {
+			memcpy((void *)rv, (void *)gc_state_c->gs_rv,
+			    gc_state_c->gs_rv_n * sizeof(struct gc_revoke_ent));
+			munmap((void *)gc_state_c->gs_rv,
+			    gc_state_c->gs_rv_sz * sizeof(struct gc_revoke_ent));
+		}
+		gc_state_c->gs_rv = rv;
+		gc_state_c->gs_rv_sz = sz;
+	}
+	gc_state_c->gs_rv[gc_state_c->gs_rv_n].re_base = base;
+	gc_state_c->gs_rv[gc_state_c->gs_rv_n].re_top = base + len;
+	gc_state_c->gs_rv[gc_state_c->gs_rv_n].re_quar = quar;
+	gc_state_c->gs_rv_n++;
+	if (quar)
+		gc_state_c->gs_rv_bytes += len;
+	return (GC_SUCC);
+}
+
+static int
+gc_revoke_ent_cmp(const void *a, const void *b)
+{
+	const struct gc_revoke_ent *ra, *rb;
+
+	ra = a;
+	rb = b;
+	if (ra->re_base < rb->re_base)
+		return (-1);
+	return (ra->re_base > rb->re_base);
+}
+
+void
+gc_revoke_prepare(void)
+{
+	_gc_cap struct gc_revoke_ent *rv;
+	_gc_cap void *obj;
+	size_t i, n;
+	int rc;
+
+	rv = gc_state_c->gs_rv;
+	qsort((void *)rv, gc_state_c->gs_rv_n, sizeof(*rv), gc_revoke_ent_cmp);
+	/*
+	 * Drop duplicates and objects that are no longer revoked. A freed
+	 * object counts once, however often it was queued.
+	 */
+	for (i = n = 0; i < gc_state_c->gs_rv_n; i++) {
+		if (n > 0 && rv[i].re_base == rv[n - 1].re_base) {
+			if (rv[i].re_quar && rv[n - 1].re_quar)
+				gc_state_c->gs_rv_bytes -=
+				    rv[i].re_top - rv[i].re_base;
+			rv[n - 1].re_quar |= rv[i].re_quar;
+			continue;
+		}
+		obj = gc_cheri_ptr((void *)rv[i].re_base,
+		    rv[i].re_top - rv[i].re_base);
+		rc = gc_get_obj(obj, NULL, NULL, NULL, NULL, NULL);
+		if (!gc_ty_is_revoked(rc) || gc_ty_is_free(rc)) {
+			if (rv[i].re_quar)
+				gc_state_c->gs_rv_bytes -=
+				    rv[i].re_top - rv[i].re_base;
+			continue;
+		}
+		rv[n++] = rv[i];
+	}
+	gc_state_c->gs_rv_n = n;
+}
+
+int
+gc_revoke_match(_gc_cap void *cap)
+{
+	_gc_cap struct gc_revoke_ent *rv;
+	uint64_t base, len;
+	size_t lo, hi, mid;
+
+	if (!gc_cheri_gettag(cap) || gc_state_c->gs_rv_n == 0)
+		return (0);
+	rv = gc_state_c->gs_rv;
+	base = gc_cheri_getbase(cap);
+	len = gc_cheri_getlen(cap);
+	if (base < rv[0].re_base ||
+	    base >= rv[gc_state_c->gs_rv_n - 1].re_top)
+		return (0);
+	/* Find the last entry starting at or below base. */
+	lo = 0;
+	hi = gc_state_c->gs_rv_n;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (rv[mid].re_base <= base)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	/* Capabilities wider than the object (e.g., to a btbl) are kept. */
+	return (base < rv[lo].re_top && base + len <= rv[lo].re_top);
+}
+
+int
+gc_revoke_clear(_gc_cap void * _gc_cap *slot)
+{
+
+	if (!gc_revoke_match(*slot))
+		return (0);
+	*slot = gc_cheri_cleartag(*slot);
+	return (1);
+}
+
+void
+gc_revoke_scan_page(_gc_cap void *page, struct gc_tags *tags,
+    gc_revoke_fn *fn)
+{
+	_gc_cap void * _gc_cap *scan;
+	uint64_t *tagp;
+	uint64_t mask;
+	int i;
+
+	scan = (_gc_cap void * _gc_cap *)page;
+	for (i = 0; i < GC_PAGESZ / GC_TAG_GRAN; i++, scan++) {
+		tagp = i < 64 ? &tags->tg_lo : &tags->tg_hi;
+		mask = 1ULL << (i % 64);
+		if (!(*tagp & mask))
+			continue;
+		if (fn(scan))
+			*tagp &= ~mask;
+	}
+}
+
+void
+gc_revoke_scan_bt(_gc_cap struct gc_btbl *btbl, gc_revoke_fn *fn)
+{
+	_gc_cap void *page;
+	struct gc_tags tags, old;
+	size_t i, npages;
+
+	if (!btbl->bt_valid)
+		return;
+	npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
+	for (i = 0; i < npages; i++) {
+		if (gc_btbl_page_is_free(btbl, i))
+			continue;
+		/*
+		 * bt_tags is only filled in during a collection; the
+		 * mutator may have stored capabilities since, so read
+		 * the page's tags afresh and don't cache them.
+		 */
+		page = gc_cheri_ptr((char *)gc_cheri_getbase(btbl->bt_base) +
+		    i * GC_PAGESZ, GC_PAGESZ);
+		tags = gc_get_page_tags(page);
+		if (tags.tg_lo == 0 && tags.tg_hi == 0)
+			continue;
+		old = tags;
+		gc_revoke_scan_page(page, &tags, fn);
+		/* A cached entry would now name cleared words. */
+		if (tags.tg_lo != old.tg_lo || tags.tg_hi != old.tg_hi) {
+			btbl->bt_tags[i].tg_v = 0;
+			if (btbl->bt_notags != NULL)
+				GC_BIT_CLR(btbl->bt_notags, i);
+		}
+	}
+}
+
+static int
+gc_revoke_in(_gc_cap void *mem, uint64_t addr)
+{
+	uint64_t base;
+
+	if (!gc_cheri_gettag(mem))
+		return (0);
+	base = gc_cheri_getbase(mem);
+	return (addr >= base && addr < base + gc_cheri_getlen(mem));
+}
+
+/*
+ * Returns non-zero iff addr is in the collector's own memory: a struct
+ * gc_state, the heap table, or the btbl metadata, stacks or VM table of
+ * the current heap.
+ */
+static int
+gc_revoke_internal(uint64_t addr)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	_gc_cap struct gc_vm_tbl *vt;
+	size_t i;
+
+	ht = gc_state_c->gs_heaps;
+	if (ht != NULL) {
+		if (gc_revoke_in(ht, addr))
+			return (1);
+		for (i = 0; i < ht->ht_n; i++)
+			if (gc_revoke_in(ht->ht_heap[i], addr))
+				return (1);
+	}
+	vt = &gc_state_c->gs_vt;
+	return (gc_revoke_in(gc_state_c->gs_btbl_small.bt_map, addr) ||
+	    gc_revoke_in(gc_state_c->gs_btbl_big.bt_map, addr) ||
+	    gc_revoke_in(gc_state_c->gs_btbl_nursery.bt_map, addr) ||
+	    gc_revoke_in(gc_state_c->gs_mark_stack.data, addr) ||
+	    gc_revoke_in(gc_state_c->gs_sweep_stack.data, addr) ||
+	    gc_revoke_in(vt->vt_ent, addr) ||
+	    gc_revoke_in(vt->vt_bt, addr) ||
+	    gc_revoke_in(vt->vt_bt_hp, addr));
+}
+
+void
+gc_revoke_scan_vm(gc_revoke_fn *fn)
+{
+	_gc_cap struct gc_vm_tbl *vt;
+	_gc_cap struct gc_vm_ent *ve;
+	_gc_cap void *page;
+	struct gc_tags tags;
+	uint64_t addr;
+	size_t i;
+
+	vt = &gc_state_c->gs_vt;
+	for (i = 0; i < vt->vt_nent; i++) {
+		ve = &vt->vt_ent[i];
+		if ((ve->ve_prot & (GC_VE_PROT_RD | GC_VE_PROT_WR)) !=
+		    (GC_VE_PROT_RD | GC_VE_PROT_WR))
+			continue;
+		for (addr = ve->ve_start; addr < ve->ve_end;
+		    addr += GC_PAGESZ) {
+			/*
+			 * The heap has already been done, and the
+			 * collector's own capabilities (e.g., the big
+			 * btbl's bump pointer) must survive.
+			 */
+			if (gc_get_managed_btbl(addr) != NULL ||
+			    gc_revoke_internal(addr))
+				continue;
+			page = gc_cheri_ptr((void *)addr, GC_PAGESZ);
+			tags = gc_get_page_tags(page);
+			gc_revoke_scan_page(page, &tags, fn);
+		}
+	}
+}
+
+void
+gc_revoke_scan_roots(void)
+{
+	_gc_cap void * _gc_cap *cap;
+	size_t i, ncap;
+
+	for (i = 0; i < GC_NUM_SAVED_REGS; i++)
+		if (gc_revoke_match(gc_state_c->gs_regs_c[i]))
+			gc_state_c->gs_regs_c[i] =
+			    gc_cheri_cleartag(gc_state_c->gs_regs_c[i]);
+	cap = (_gc_cap void * _gc_cap *)gc_state_c->gs_gts_c;
+	ncap = gc_cheri_getlen(gc_state_c->gs_gts_c) /
+	    sizeof(_gc_cap void *);
+	for (i = 0; i < ncap; i++)
+		if (gc_revoke_match(cap[i]))
+			cap[i] = gc_cheri_cleartag(cap[i]);
+}
+
+void
+gc_revoke_free(uint64_t base)
+{
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_blk *blk;
+	_gc_cap void *obj;
+	size_t bidx, sidx, i;
+	int rc;
+
+	rc = gc_get_obj(gc_cheri_ptr((void *)base, GC_MINSZ),
+	    gc_cap_addr(&obj), gc_cap_addr(&bt),
+	    gc_cheri_ptr(&bidx, sizeof(bidx)), gc_cap_addr(&blk),
+	    gc_cheri_ptr(&sidx, sizeof(sidx)));
+	if (!gc_ty_is_revoked(rc) || gc_ty_is_free(rc))
+		return;
+	gc_fill_free_mem(obj);
+	if (bt->bt_flags & GC_BTBL_FLAG_SMALL) {
+		blk->bk_revoked &= ~(1ULL << sidx);
+		blk->bk_reuse &= ~(1ULL << sidx);
+		blk->bk_marks &= ~(1ULL << sidx);
+		blk->bk_free |= 1ULL << sidx;
+		gc_blk_rebucket(bt, blk);
+	} else {
+		gc_btbl_set_map(bt, bidx, bidx, GC_BTBL_FREE);
+		for (i = bidx + 1; i < bt->bt_nslots &&
+		    GC_BTBL_GETTYPE(bt->bt_map[GC_BTBL_MAPINDX(i)], i) ==
+		    GC_BTBL_CONT; i++)
+			gc_btbl_set_map(bt, i, i, GC_BTBL_FREE);
+	}
+	gc_prof_free(base);
+#ifdef GC_COLLECT_STATS
+	gc_state_c->gs_nalloc--;
+	gc_state_c->gs_nallocbytes -= gc_cheri_getlen(obj);
+#endif
+}
+
+void
+gc_revoke_commit_entry(void)
+{
+	size_t i;
+	int rc;
+
+	/* Collections assume revoked objects are still allocated. */
+	while (gc_state_c->gs_mark_state != GC_MS_NONE)
+		gc_collect();
+	gc_sweep_finish();
+	gc_revoke_prepare();
+	if (gc_state_c->gs_rv_n == 0) {
+		gc_state_c->gs_rv_bytes = 0;
+		return;
+	}
+	gc_debug("revoking a batch of %zu object(s)", gc_state_c->gs_rv_n);
+	gc_trace(GC_TRACE_REVOKE, gc_state_c->gs_rv[0].re_base,
+	    gc_state_c->gs_rv_n, 1);
+	if (gc_vm_tbl_update(&gc_state_c->gs_vt) != GC_SUCC) {
+		gc_error("gc_vm_tbl_update");
+		return;
+	}
+	rc = gc_cheri_get_ts(gc_state_c->gs_gts_c);
+	if (rc != 0) {
+		gc_error("gc_cheri_get_ts error: %d", rc);
+		return;
+	}
+	gc_revoke_scan_roots();
+	rc = gc_cheri_put_ts(gc_state_c->gs_gts_c);
+	if (rc != 0)
+		gc_error("gc_cheri_put_ts error: %d", rc);
+	gc_revoke_scan_bt(&gc_state_c->gs_btbl_small, gc_revoke_clear);
+	gc_revoke_scan_bt(&gc_state_c->gs_btbl_big, gc_revoke_clear);
+	gc_revoke_scan_bt(&gc_state_c->gs_btbl_nursery, gc_revoke_clear);
+	gc_revoke_scan_vm(gc_revoke_clear);
+	gc_roots_scan_wp(gc_revoke_clear);
+	/* Nothing can reach the objects now. */
+	for (i = 0; i < gc_state_c->gs_rv_n; i++)
+		gc_revoke_free(gc_state_c->gs_rv[i].re_base);
+	gc_state_c->gs_rv_n = 0;
+	gc_state_c->gs_rv_bytes = 0;
+}
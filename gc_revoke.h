@@ -0,0 +1,80 @@
+#ifndef _GC_REVOKE_H_
+#define _GC_REVOKE_H_
+
+#include <stdint.h>
+
+#include "gc_cheri.h"
+#include "gc_scan.h"
+
+struct gc_btbl;
+
+/*
+ * Batched revocation.
+ *
+ * gc_revoke sets the object's revoked bit, as before, and also queues
+ * the object in the revocation batch. gc_revoke_commit (see gc.h) then
+ * revokes the whole batch in a single pass:
+ *
+ * 1. The batch is sorted by base and pruned of objects that are no
+ *    longer revoked (a collection may have freed them in the
+ *    meantime).
+ * 2. Every tagged word of the used pages of the managed btbls, of the
+ *    writable unmanaged mappings other than the collector's own, of
+ *    the saved registers and of the trusted stack is checked against
+ *    the batch by binary search, and cleared if its bounds lie within
+ *    a batched object.
+ * 3. The batched objects are freed straight back to the allocator.
+ *
+ * Objects that are revoked but never committed are still invalidated by
+ * the next full collection.
+ *
+ * gc_free uses the batch as a quarantine: freed objects are revoked,
+ * and the batch is committed once it holds gs_quarantine bytes of them.
+ * Objects queued by gc_revoke don't count, and pruned ones stop
+ * counting.
+ */
+
+/*
+ * A batched object: [re_base, re_top). re_quar is set if it was queued
+ * by gc_free, and so is counted in gs_rv_bytes.
+ */
+struct gc_revoke_ent {
+	uint64_t	re_base;
+	uint64_t	re_top;
+	int		re_quar;
+};
+
+/*
+ * Called on each tagged word found by the scans below; returns non-zero
+ * iff it cleared the tag. gc_evac.c also uses the scans.
+ */
+typedef int	gc_revoke_fn(_gc_cap void * _gc_cap *_slot);
+
+/* Default gs_quarantine (see gc_free). */
+#define GC_QUARANTINE_DEFAULT	(64 * 1024)
+
+/* Initial number of entries in the batch; it grows by doubling. */
+#define GC_REVOKE_BATCHSZ	1024
+
+/* Queues an object (for gc_free iff _quar); returns non-zero iff error. */
+int	gc_revoke_queue(uint64_t _base, uint64_t _len, int _quar);
+/* Does the work of gc_revoke_commit; requires regs and stack saved. */
+void	gc_revoke_commit_entry(void);
+void	gc_revoke_prepare(void);
+/* Returns non-zero iff the capability lies within a batched object. */
+int	gc_revoke_match(_gc_cap void *_cap);
+/* Clears a capability if it points into the batch (a gc_revoke_fn). */
+int	gc_revoke_clear(_gc_cap void * _gc_cap *_slot);
+/*
+ * Calls fn on the tagged words of a page, updating its tags; of the used
+ * pages of a btbl, invalidating the bt_tags entry of any page where fn
+ * cleared a tag; and of the writable unmanaged mappings.
+ */
+void	gc_revoke_scan_page(_gc_cap void *_page, struct gc_tags *_tags,
+	    gc_revoke_fn *_fn);
+void	gc_revoke_scan_bt(_gc_cap struct gc_btbl *_btbl, gc_revoke_fn *_fn);
+void	gc_revoke_scan_vm(gc_revoke_fn *_fn);
+void	gc_revoke_scan_roots(void);
+void	gc_revoke_free(uint64_t _base);
+
+#endif /* !_GC_REVOKE_H_ */
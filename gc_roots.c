@@ -0,0 +1,450 @@
+#include <sys/mman.h>
+
+#include <signal.h>
+#include <string.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_collect.h"
+#include "gc_debug.h"
+#include "gc_heap.h"
+#include "gc_roots.h"
+#include "gc_scan.h"
+#include "gc_vm.h"
+
+/*
+ * SIGSEGV action in place before the first gc_set_root_wp(1), and the
+ * number of heaps with gs_root_wp set: the handler is shared by all
+ * heaps, and installed while any of them protects its roots.
+ */
+static struct sigaction	gc_roots_oldact;
+static int		gc_roots_nwp;
+
+int
+gc_add_roots(_gc_cap void *range)
+{
+	int rc;
+
+	GC_LOCK();
+	rc = gc_roots_add(range);
+	GC_UNLOCK();
+	return (rc);
+}
+
+int
+gc_remove_roots(_gc_cap void *range)
+{
+	int rc;
+
+	GC_LOCK();
+	rc = gc_roots_remove(range);
+	GC_UNLOCK();
+	return (rc);
+}
+
+/* Bytes of tags and bits kept for a range of npages pages. */
+static size_t
+gc_roots_memsz(size_t npages)
+{
+
+	return (npages * sizeof(struct gc_tags) +
+	    4 * GC_BIT_NWORDS(npages) * sizeof(uint64_t));
+}
+
+static int
+gc_roots_reserve(void)
+{
+	_gc_cap struct gc_root *roots;
+	size_t sz;
+
+	if (gc_state_c->gs_nroots < gc_state_c->gs_roots_sz)
+		return (GC_SUCC);
+	sz = gc_state_c->gs_roots_sz != 0 ?
+	    2 * gc_state_c->gs_roots_sz : GC_ROOTS_TBLSZ;
+	roots = gc_alloc_internal(sz * sizeof(struct gc_root));
+	if (roots == NULL) {
+		gc_error("gc_alloc_internal(root table)");
+		return (GC_ERROR);
+	}
+	if (gc_state_c->gs_roots_sz != 0) {
+		memcpy((void *)roots, (void *)gc_state_c->gs_roots,
+		    gc_state_c->gs_nroots * sizeof(struct gc_root));
+		munmap((void *)gc_state_c->gs_roots,
+		    gc_state_c->gs_roots_sz * sizeof(struct gc_root));
+	}
+	gc_state_c->gs_roots = roots;
+	gc_state_c->gs_roots_sz = sz;
+	return (GC_SUCC);
+}
+
+int
+gc_roots_add(_gc_cap void *range)
+{
+	_gc_cap struct gc_root *rt;
+	_gc_cap char *mem;
+	uint64_t base, top;
+	size_t npages, tagsz, bitsz;
+
+	base = gc_cheri_getbase(range);
+	top = base + gc_cheri_getlen(range);
+	if (top <= base)
+		return (GC_ERROR);
+	if (gc_roots_reserve() != GC_SUCC)
+		return (GC_ERROR);
+	base = GC_ALIGN_PAGESZ(base);
+	top = GC_ROUND_PAGESZ(top);
+	npages = (top - base) / GC_PAGESZ;
+	tagsz = npages * sizeof(struct gc_tags);
+	bitsz = GC_BIT_NWORDS(npages) * sizeof(uint64_t);
+	mem = gc_alloc_internal(gc_roots_memsz(npages));
+	if (mem == NULL) {
+		gc_error("gc_alloc_internal(%zu)", gc_roots_memsz(npages));
+		return (GC_ERROR);
+	}
+
+	/* Fresh mappings are zero: no tags cached, nothing protected. */
+	rt = &gc_state_c->gs_roots[gc_state_c->gs_nroots];
+	memset((void *)rt, 0, sizeof(struct gc_root));
+	rt->rt_range = gc_cheri_ptr((void *)gc_cheri_getbase(range),
+	    gc_cheri_getlen(range));
+	rt->rt_bt.bt_base = gc_cheri_ptr((void *)base, top - base);
+	rt->rt_bt.bt_slotsz = GC_PAGESZ;
+	rt->rt_bt.bt_nslots = npages;
+	rt->rt_bt.bt_tags = gc_cheri_setlen(mem, tagsz);
+	rt->rt_bt.bt_notags = gc_cheri_incbase(mem, tagsz);
+	rt->rt_bt.bt_notags = gc_cheri_setlen(rt->rt_bt.bt_notags, bitsz);
+	rt->rt_wp = gc_cheri_incbase(mem, tagsz + bitsz);
+	rt->rt_wp = gc_cheri_setlen(rt->rt_wp, bitsz);
+	rt->rt_wr = gc_cheri_incbase(mem, tagsz + 2 * bitsz);
+	rt->rt_wr = gc_cheri_setlen(rt->rt_wr, bitsz);
+	rt->rt_dirty = gc_cheri_incbase(mem, tagsz + 3 * bitsz);
+	rt->rt_dirty = gc_cheri_setlen(rt->rt_dirty, bitsz);
+	rt->rt_bt.bt_valid = 1;
+	gc_state_c->gs_nroots++;
+	gc_debug("added root range %s", gc_cap_str(rt->rt_range));
+	return (GC_SUCC);
+}
+
+/* Forgets the cached tags of a page. */
+static void
+gc_roots_drop(_gc_cap struct gc_root *rt, size_t i)
+{
+
+	rt->rt_bt.bt_tags[i].tg_v = 0;
+	GC_BIT_CLR(rt->rt_bt.bt_notags, i);
+}
+
+/*
+ * Returns non-zero iff a range of any heap other than rt has the page
+ * holding addr write-protected.
+ */
+static int
+gc_roots_wp_other(_gc_cap struct gc_root *rt, uint64_t addr)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	_gc_cap struct gc_state *gs;
+	_gc_cap struct gc_root *ort;
+	size_t h, i, j;
+
+	ht = gc_state_c->gs_heaps;
+	for (h = 0; h < ht->ht_n; h++) {
+		gs = ht->ht_heap[h];
+		for (i = 0; i < gs->gs_nroots; i++) {
+			ort = &gs->gs_roots[i];
+			if (ort == rt || !gc_btbl_contains(&ort->rt_bt, addr))
+				continue;
+			j = (addr - gc_cheri_getbase(ort->rt_bt.bt_base)) /
+			    GC_PAGESZ;
+			if (GC_BIT_ISSET(ort->rt_wp, j))
+				return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Lifts the write protection of page i, if the collector set it and no
+ * other range still relies on it.
+ */
+static void
+gc_roots_unprotect(_gc_cap struct gc_root *rt, size_t i)
+{
+	char *page;
+
+	if (!GC_BIT_ISSET(rt->rt_wp, i))
+		return;
+	GC_BIT_CLR(rt->rt_wp, i);
+	gc_roots_drop(rt, i);
+	page = (char *)gc_cheri_getbase(rt->rt_bt.bt_base) + i * GC_PAGESZ;
+	if (gc_roots_wp_other(rt, (uint64_t)(uintptr_t)page))
+		return;
+	if (mprotect(page, GC_PAGESZ, PROT_READ | PROT_WRITE) != 0)
+		gc_error("mprotect(%p)", page);
+}
+
+/* Consumes the rt_dirty bits set by gc_roots_fault. */
+static void
+gc_roots_sync(_gc_cap struct gc_root *rt)
+{
+	uint64_t dirty;
+	size_t i, j;
+
+	for (i = 0; i < GC_BIT_NWORDS(rt->rt_bt.bt_nslots); i++) {
+		if (rt->rt_dirty[i] == 0)
+			continue;
+		dirty = __sync_fetch_and_and((uint64_t *)(void *)
+		    &rt->rt_dirty[i], 0);
+		for (; dirty != 0; dirty &= dirty - 1) {
+			j = i * 64 + GC_FIRST_BIT(dirty);
+			gc_debug("root range %s: page %zu written",
+			    gc_cap_str(rt->rt_range), j);
+			/* The handler lifted the protection. */
+			GC_BIT_CLR(rt->rt_wp, j);
+			gc_roots_drop(rt, j);
+		}
+	}
+}
+
+int
+gc_roots_remove(_gc_cap void *range)
+{
+	_gc_cap struct gc_root *rt;
+	size_t i, j;
+
+	for (i = 0; i < gc_state_c->gs_nroots; i++) {
+		rt = &gc_state_c->gs_roots[i];
+		if (gc_cheri_getbase(rt->rt_range) ==
+		    gc_cheri_getbase(range) &&
+		    gc_cheri_getlen(rt->rt_range) == gc_cheri_getlen(range))
+			break;
+	}
+	if (i == gc_state_c->gs_nroots)
+		return (GC_ERROR);
+	gc_roots_sync(rt);
+	for (j = 0; j < rt->rt_bt.bt_nslots; j++)
+		gc_roots_unprotect(rt, j);
+	munmap((void *)rt->rt_bt.bt_tags,
+	    gc_roots_memsz(rt->rt_bt.bt_nslots));
+	gc_state_c->gs_roots[i] =
+	    gc_state_c->gs_roots[--gc_state_c->gs_nroots];
+	gc_debug("removed root range %s", gc_cap_str(range));
+	return (GC_SUCC);
+}
+
+/*
+ * Handles a write to a page protected by gc_roots_tags: a page may lie
+ * in several ranges, of several heaps, and is marked dirty in all of
+ * them, including those that took it for natively read-only. The
+ * handler only reads the heap and root tables, and may run while the
+ * collector holds gs_lock; the mprotect is a plain system call, without
+ * which the write couldn't complete. Other faults, and a failed
+ * mprotect, go to the previous action.
+ */
+static void
+gc_roots_fault(int sig, siginfo_t *si, void *uap)
+{
+	_gc_cap struct gc_heap_tbl *ht;
+	_gc_cap struct gc_state *gs;
+	_gc_cap struct gc_root *rt;
+	uint64_t addr;
+	size_t h, i, j;
+	int handled;
+
+	addr = (uint64_t)(uintptr_t)si->si_addr;
+	handled = 0;
+	ht = gc_state_c->gs_heaps;
+	for (h = 0; h < ht->ht_n; h++) {
+		gs = ht->ht_heap[h];
+		for (i = 0; i < gs->gs_nroots; i++) {
+			rt = &gs->gs_roots[i];
+			if (!gc_btbl_contains(&rt->rt_bt, addr))
+				continue;
+			j = (addr - gc_cheri_getbase(rt->rt_bt.bt_base)) /
+			    GC_PAGESZ;
+			__sync_fetch_and_or((uint64_t *)(void *)
+			    &rt->rt_dirty[j / 64], 1ULL << (j % 64));
+			if (GC_BIT_ISSET(rt->rt_wp, j))
+				handled = 1;
+		}
+	}
+	if (handled && mprotect((void *)(uintptr_t)GC_ALIGN_PAGESZ(addr),
+	    GC_PAGESZ, PROT_READ | PROT_WRITE) == 0)
+		return;
+	if (gc_roots_oldact.sa_flags & SA_SIGINFO)
+		gc_roots_oldact.sa_sigaction(sig, si, uap);
+	else if (gc_roots_oldact.sa_handler != SIG_DFL &&
+	    gc_roots_oldact.sa_handler != SIG_IGN)
+		gc_roots_oldact.sa_handler(sig);
+	else
+		/* Fault again, with the default action. */
+		sigaction(SIGSEGV, &gc_roots_oldact, NULL);
+}
+
+int
+gc_set_root_wp(int on)
+{
+	struct sigaction sa;
+	size_t i, j;
+	int old;
+
+	GC_LOCK();
+	old = gc_state_c->gs_root_wp;
+	on = on != 0;
+	if (on && !old && gc_roots_nwp == 0) {
+		/* The first heap to protect its roots installs the handler. */
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = gc_roots_fault;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGSEGV, &sa, &gc_roots_oldact) != 0) {
+			gc_error("sigaction(SIGSEGV)");
+			on = 0;
+		}
+	} else if (!on && old) {
+		for (i = 0; i < gc_state_c->gs_nroots; i++) {
+			gc_roots_sync(&gc_state_c->gs_roots[i]);
+			for (j = 0; j < gc_state_c->gs_roots[i].rt_bt.bt_nslots;
+			    j++)
+				gc_roots_unprotect(&gc_state_c->gs_roots[i], j);
+		}
+		/* The last one removes it. */
+		if (gc_roots_nwp == 1)
+			sigaction(SIGSEGV, &gc_roots_oldact, NULL);
+	}
+	gc_roots_nwp += on - old;
+	gc_state_c->gs_root_wp = on;
+	GC_UNLOCK();
+	return (old);
+}
+
+/*
+ * Returns the tags of page i of a range, which must be readable, from
+ * the cache if the page cannot have been written since they were read.
+ */
+static struct gc_tags
+gc_roots_tags(_gc_cap struct gc_root *rt, size_t i,
+    _gc_cap struct gc_vm_ent *ve)
+{
+	_gc_cap struct gc_btbl *bt;
+	char *page;
+	int wr;
+
+	bt = &rt->rt_bt;
+	/* The VM info shows the pages we protected as read-only. */
+	wr = (ve->ve_prot & GC_VE_PROT_WR) || GC_BIT_ISSET(rt->rt_wr, i);
+	if (wr && !GC_BIT_ISSET(rt->rt_wp, i))
+		gc_roots_drop(rt, i);
+	if (bt->bt_tags[i].tg_v)
+		return (bt->bt_tags[i]);
+
+	page = (char *)gc_cheri_getbase(bt->bt_base) + i * GC_PAGESZ;
+	/* Protect first, so that no write can slip in after the read. */
+	if (wr && gc_state_c->gs_root_wp) {
+		if (mprotect(page, GC_PAGESZ, PROT_READ) == 0) {
+			GC_BIT_SET(rt->rt_wp, i);
+			GC_BIT_SET(rt->rt_wr, i);
+		} else
+			gc_error("mprotect(%p)", page);
+	}
+	bt->bt_tags[i] = gc_get_page_tags(gc_cheri_ptr(page, GC_PAGESZ));
+	gc_btbl_set_notags(bt, i);
+	return (bt->bt_tags[i]);
+}
+
+/* Clears the tags of the words of a page outside [lo, hi) or at self. */
+static void
+gc_roots_clip(struct gc_tags *tags, uint64_t page, uint64_t lo,
+    uint64_t hi, uint64_t self)
+{
+	uint64_t addr;
+	size_t j;
+
+	if (lo <= page && page + GC_PAGESZ <= hi &&
+	    (self < page || self >= page + GC_PAGESZ))
+		return;
+	for (j = 0; j < GC_PAGESZ / GC_TAG_GRAN; j++) {
+		addr = page + j * GC_TAG_GRAN;
+		if (addr >= lo && addr < hi &&
+		    (self < addr || self >= addr + GC_TAG_GRAN))
+			continue;
+		if (j < 64)
+			tags->tg_lo &= ~(1ULL << j);
+		else
+			tags->tg_hi &= ~(1ULL << (j - 64));
+	}
+}
+
+static void
+gc_roots_push_range(_gc_cap struct gc_root *rt)
+{
+	_gc_cap struct gc_btbl *bt;
+	_gc_cap struct gc_vm_ent *ve;
+	struct gc_tags tags;
+	uint64_t lo, hi, page, self;
+	size_t i;
+
+	gc_debug("root: range: %s", gc_cap_str(rt->rt_range));
+	gc_roots_sync(rt);
+	bt = &rt->rt_bt;
+	lo = gc_cheri_getbase(rt->rt_range);
+	hi = lo + gc_cheri_getlen(rt->rt_range);
+	self = (uint64_t)(uintptr_t)&gc_state_c;
+	for (i = 0; i < bt->bt_nslots; i++) {
+		/* Skip protected pages known to hold no tags. */
+		if (i % 64 == 0 &&
+		    (rt->rt_wp[i / 64] & bt->bt_notags[i / 64]) == ~0ULL) {
+			i += 63;
+			continue;
+		}
+		if (GC_BIT_ISSET(rt->rt_wp, i) &&
+		    GC_BIT_ISSET(bt->bt_notags, i))
+			continue;
+		page = gc_cheri_getbase(bt->bt_base) + i * GC_PAGESZ;
+		ve = gc_vm_tbl_find(&gc_state_c->gs_vt, page);
+		if (ve == NULL || !(ve->ve_prot & GC_VE_PROT_RD)) {
+			/* Unmapped (maybe for now): forget the page. */
+			GC_BIT_CLR(rt->rt_wp, i);
+			GC_BIT_CLR(rt->rt_wr, i);
+			gc_roots_drop(rt, i);
+			continue;
+		}
+		tags = gc_roots_tags(rt, i, ve);
+		gc_roots_clip(&tags, page, lo, hi, self);
+		gc_scan_tags(gc_cheri_ptr((void *)page, GC_PAGESZ), tags);
+	}
+}
+
+void
+gc_roots_push(void)
+{
+	size_t i;
+
+	for (i = 0; i < gc_state_c->gs_nroots; i++)
+		gc_roots_push_range(&gc_state_c->gs_roots[i]);
+}
+
+void
+gc_roots_scan_wp(gc_revoke_fn *fn)
+{
+	_gc_cap struct gc_root *rt;
+	struct gc_tags tags;
+	uint64_t page;
+	size_t i, j;
+
+	for (i = 0; i < gc_state_c->gs_nroots; i++) {
+		rt = &gc_state_c->gs_roots[i];
+		gc_roots_sync(rt);
+		for (j = 0; j < rt->rt_bt.bt_nslots; j++) {
+			if (!GC_BIT_ISSET(rt->rt_wp, j))
+				continue;
+			tags = rt->rt_bt.bt_tags[j];
+			if (tags.tg_lo == 0 && tags.tg_hi == 0)
+				continue;
+			/* A write here faults, marking the page dirty. */
+			page = gc_cheri_getbase(rt->rt_bt.bt_base) +
+			    j * GC_PAGESZ;
+			gc_revoke_scan_page(gc_cheri_ptr((void *)page,
+			    GC_PAGESZ), &tags, fn);
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef _GC_ROOTS_H_
+#define _GC_ROOTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gc.h"
+#include "gc_cheri.h"
+#include "gc_revoke.h"
+
+/*
+ * Root ranges.
+ *
+ * Besides the saved registers, the trusted stack and the stack, each
+ * collection scans the ranges registered with gc_add_roots. The
+ * writable segments found by gc_get_static_regions (gs_static) are
+ * registered by gc_init, once: the segments of objects loaded later
+ * with dlopen(3) are not scanned unless the program registers them
+ * with gc_add_roots (and removes them before dlclose(3)).
+ *
+ * A range is scanned page by page, like an unmanaged object, except
+ * that its tags come from its own btbl (rt_bt, of one slot per page),
+ * whose bt_tags and bt_notags are kept between collections for the
+ * pages that cannot have been written since their tags were read:
+ *
+ * - Pages mapped read-only, such as relocated read-only data and
+ *   capability tables, keep their tags while the VM info says so.
+ * - With gc_set_root_wp(1), writable pages are write-protected once
+ *   their tags have been read. The first write to such a page, by the
+ *   mutator or by the collector (e.g., gc_revoke_commit), faults; the
+ *   SIGSEGV handler then sets the page's rt_dirty bit (atomically)
+ *   and lifts the protection, so that the write can complete. It
+ *   neither takes gs_lock nor touches anything else: the collector
+ *   consumes rt_dirty, dropping the page's tags and rt_wp bit, under
+ *   gs_lock the next time it looks at the range. Off by default: a
+ *   system call that writes into a protected page fails with EFAULT
+ *   rather than faulting.
+ *
+ * The handler is process-wide: it is installed when the first heap
+ * turns gc_set_root_wp on and removed when the last one turns it off
+ * (or is destroyed), and it marks the faulting page dirty in the
+ * ranges of every heap, as the static segments are registered by each.
+ * A page stays protected while a range of any heap has its rt_wp bit
+ * set; the ranges of other heaps then see it as read-only, and rely on
+ * the dirty bit alone.
+ *
+ * Other pages are read again by every collection. The word holding
+ * gc_state_c is never scanned, so that the collector's own state is
+ * not traced as an unmanaged object.
+ */
+struct gc_root {
+	_gc_cap void		*rt_range;	/* as registered */
+	struct gc_btbl		 rt_bt;		/* tags of the pages spanned */
+	_gc_cap uint64_t	*rt_wp;		/* page write-protected bits */
+	_gc_cap uint64_t	*rt_wr;		/* page writable (was protected) */
+	_gc_cap uint64_t	*rt_dirty;	/* page written while protected */
+};
+
+/* Initial number of entries in gs_roots; the table grows by doubling. */
+#define	GC_ROOTS_TBLSZ		64
+
+/* gc_add_roots and gc_remove_roots, without taking gs_lock. */
+int	gc_roots_add(_gc_cap void *_range);
+int	gc_roots_remove(_gc_cap void *_range);
+/* Pushes the children of every registered range to the mark stack. */
+void	gc_roots_push(void);
+/*
+ * Calls fn on the tagged words of the pages that the collector has
+ * write-protected, which gc_revoke_scan_vm skips as read-only.
+ */
+void	gc_roots_scan_wp(gc_revoke_fn *_fn);
+
+#endif /* !_GC_ROOTS_H_ */
@@ -1,3 +1,5 @@
+#include <sys/mman.h>
+
 #include "gc_stack.h"
 #include "gc.h"
 #include <stdio.h>
@@ -10,6 +12,15 @@ gc_stack_init(_gc_cap struct gc_stack *stack, size_t sz)
 	return (0);
 }
 
+void
+gc_stack_free(_gc_cap struct gc_stack *stack)
+{
+
+	munmap((void *)gc_cheri_setoffset(stack->data, 0),
+	    gc_cheri_getlen(stack->data));
+	stack->data = NULL;
+}
+
 int
 gc_stack_push(_gc_cap struct gc_stack *stack, _gc_cap void *obj)
 {
@@ -21,6 +32,21 @@ gc_stack_push(_gc_cap struct gc_stack *stack, _gc_cap void *obj)
 	return (0);
 }
 
+int
+gc_stack_push_n(_gc_cap struct gc_stack *stack, _gc_cap void * _gc_cap *objs,
+    size_t n)
+{
+	size_t i;
+
+	if (gc_cheri_getlen(stack->data) - gc_cheri_getoffset(stack->data) <
+	    n * sizeof(_gc_cap void *))
+		return (1);
+	for (i = 0; i < n; i++)
+		stack->data[i] = objs[i];
+	stack->data += n;
+	return (0);
+}
+
 int
 gc_stack_pop(_gc_cap struct gc_stack *stack, _gc_cap void * _gc_cap *obj)
 {
@@ -36,3 +62,17 @@ gc_stack_pop(_gc_cap struct gc_stack *stack, _gc_cap void * _gc_cap *obj)
 	return (0);
 }
 
+
+int
+gc_stack_empty(_gc_cap struct gc_stack *stack)
+{
+
+	return (gc_cheri_getoffset(stack->data) == 0);
+}
+
+size_t
+gc_stack_depth(_gc_cap struct gc_stack *stack)
+{
+
+	return (gc_cheri_getoffset(stack->data) / sizeof(_gc_cap void *));
+}
@@ -10,8 +10,15 @@ struct gc_stack {
 };
 
 int	gc_stack_init(_gc_cap struct gc_stack *_stack, size_t _sz);
+void	gc_stack_free(_gc_cap struct gc_stack *_stack);
 int	gc_stack_push(_gc_cap struct gc_stack *_stack, _gc_cap void *_obj);
+/* Pushes _n objects, or none if they don't all fit. */
+int	gc_stack_push_n(_gc_cap struct gc_stack *_stack,
+	    _gc_cap void * _gc_cap *_objs, size_t _n);
 int	gc_stack_pop(_gc_cap struct gc_stack *_stack,
 	    _gc_cap void * _gc_cap *_obj);
+int	gc_stack_empty(_gc_cap struct gc_stack *_stack);
+/* Returns the number of entries on the stack. */
+size_t	gc_stack_depth(_gc_cap struct gc_stack *_stack);
 
 #endif /* !_GC_STACK_H_ */
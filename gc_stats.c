@@ -0,0 +1,212 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gc.h"
+#include "gc_debug.h"
+#include "gc_event.h"
+#include "gc_stats.h"
+
+/* Set by the signal handler; see gc_set_stats_signal. */
+static volatile sig_atomic_t	gc_stats_req;
+
+static void
+gc_stats_btbl(_gc_cap struct gc_btbl *btbl, struct gc_stats *st,
+    struct gc_stats_btbl *bs)
+{
+	_gc_cap struct gc_blk *blk;
+	size_t i, run, npages, nslot, hdrbits, logsz;
+	uint64_t fmask;
+	uint8_t type;
+
+	memset(bs, 0, sizeof(*bs));
+	if (!btbl->bt_valid)
+		return;
+	bs->bs_valid = 1;
+	bs->bs_slotsz = btbl->bt_slotsz;
+	bs->bs_nslots = btbl->bt_nslots;
+	run = 0;
+	for (i = 0; i < btbl->bt_nslots; i++) {
+		type = GC_BTBL_GETTYPE(btbl->bt_map[GC_BTBL_MAPINDX(i)], i);
+		if ((type & GC_BTBL_TYPE_MASK) == GC_BTBL_FREE) {
+			bs->bs_nfree++;
+			if (++run > bs->bs_maxfree)
+				bs->bs_maxfree = run;
+			continue;
+		}
+		run = 0;
+		bs->bs_nused++;
+		if (!(btbl->bt_flags & GC_BTBL_FLAG_SMALL) ||
+		    (type & GC_BTBL_TYPE_MASK) == GC_BTBL_CONT)
+			continue;
+		/* A small block: count its objects by size class. */
+		blk = gc_cheri_ptr((char *)gc_cheri_getbase(btbl->bt_base) +
+		    i * btbl->bt_slotsz, btbl->bt_slotsz);
+		logsz = GC_LOG2(blk->bk_objsz);
+		nslot = GC_PAGESZ / blk->bk_objsz;
+		hdrbits = (GC_BLK_HDRSZ + blk->bk_objsz - 1) / blk->bk_objsz;
+		fmask = nslot < 64 ? (1ULL << nslot) - 1 : ~0ULL;
+		fmask &= ~((1ULL << hdrbits) - 1);
+		st->st_class[logsz].sc_nblk++;
+		st->st_class[logsz].sc_nslot += nslot - hdrbits;
+		st->st_class[logsz].sc_nfree +=
+		    __builtin_popcountll(blk->bk_free & fmask);
+	}
+	if (btbl->bt_decommit != NULL) {
+		npages = (btbl->bt_slotsz * btbl->bt_nslots) / GC_PAGESZ;
+		for (i = 0; i < GC_BIT_NWORDS(npages); i++)
+			bs->bs_nrelease +=
+			    __builtin_popcountll(btbl->bt_decommit[i]);
+	}
+}
+
+void
+gc_stats_get(struct gc_stats *st)
+{
+
+	memset(st, 0, sizeof(*st));
+#ifdef GC_COLLECT_STATS
+	st->st_nalloc = gc_state_c->gs_nalloc;
+	st->st_nallocbytes = gc_state_c->gs_nallocbytes;
+	st->st_nmark = gc_state_c->gs_nmark;
+	st->st_nmarkbytes = gc_state_c->gs_nmarkbytes;
+	st->st_nsweep = gc_state_c->gs_nsweep;
+	st->st_nsweepbytes = gc_state_c->gs_nsweepbytes;
+	st->st_ntcollect = gc_state_c->gs_ntcollect;
+	st->st_ntminor = gc_state_c->gs_ntminor;
+	memcpy(st->st_ntalloc, (void *)gc_state_c->gs_ntalloc,
+	    sizeof(st->st_ntalloc));
+	st->st_ntbigalloc = gc_state_c->gs_ntbigalloc;
+	st->st_nrelease = gc_state_c->gs_nrelease;
+#endif
+	st->st_mark_state = gc_state_c->gs_mark_state;
+	st->st_gen_mode = gc_state_c->gs_gen_mode;
+	st->st_allocbytes = gc_state_c->gs_allocbytes;
+	st->st_ncollect = gc_state_c->gs_ev.el_seq;
+	st->st_npause = gc_state_c->gs_ev.el_npause;
+	st->st_pause_p50 = gc_ev_pause_pct(50.0);
+	st->st_pause_p99 = gc_ev_pause_pct(99.0);
+	st->st_pause_p999 = gc_ev_pause_pct(99.9);
+	st->st_rv_bytes = gc_state_c->gs_rv_bytes;
+	gc_stats_btbl(&gc_state_c->gs_btbl_small, st,
+	    &st->st_btbl[GC_STATS_SMALL]);
+	gc_stats_btbl(&gc_state_c->gs_btbl_big, st,
+	    &st->st_btbl[GC_STATS_BIG]);
+	gc_stats_btbl(&gc_state_c->gs_btbl_nursery, st,
+	    &st->st_btbl[GC_STATS_NURSERY]);
+}
+
+int
+gc_get_stats(struct gc_stats *st)
+{
+
+	GC_LOCK();
+	gc_stats_get(st);
+	GC_UNLOCK();
+	return (GC_SUCC);
+}
+
+int
+gc_stats_write(int fd)
+{
+	static const char *btbl_names[GC_STATS_NBTBL] =
+	    {"small", "big", "nursery"};
+	struct gc_stats st;
+	struct gc_stats_btbl *bs;
+	struct gc_stats_class *sc;
+	int i, first;
+
+	gc_stats_get(&st);
+	dprintf(fd, "{\"nalloc\":%zu,\"nallocbytes\":%zu,"
+	    "\"nmark\":%zu,\"nmarkbytes\":%zu,"
+	    "\"nsweep\":%zu,\"nsweepbytes\":%zu,"
+	    "\"ntcollect\":%zu,\"ntminor\":%zu,\"ntbigalloc\":%zu,"
+	    "\"nrelease\":%zu,",
+	    st.st_nalloc, st.st_nallocbytes, st.st_nmark, st.st_nmarkbytes,
+	    st.st_nsweep, st.st_nsweepbytes, st.st_ntcollect, st.st_ntminor,
+	    st.st_ntbigalloc, st.st_nrelease);
+	dprintf(fd, "\"ntalloc\":[");
+	for (i = 0; i < GC_LOG_BIGSZ; i++)
+		dprintf(fd, "%s%zu", i != 0 ? "," : "", st.st_ntalloc[i]);
+	dprintf(fd, "],\"mark_state\":%d,\"gen_mode\":%d,"
+	    "\"allocbytes\":%zu,\"ncollect\":%" PRIu64 ","
+	    "\"npause\":%" PRIu64 ",\"pause_p50_ns\":%" PRIu64 ","
+	    "\"pause_p99_ns\":%" PRIu64 ",\"pause_p999_ns\":%" PRIu64 ","
+	    "\"revoke_pending_bytes\":%zu,",
+	    st.st_mark_state, st.st_gen_mode, st.st_allocbytes,
+	    st.st_ncollect, st.st_npause, st.st_pause_p50, st.st_pause_p99,
+	    st.st_pause_p999, st.st_rv_bytes);
+	dprintf(fd, "\"classes\":[");
+	for (i = 0, first = 1; i < GC_LOG_BIGSZ; i++) {
+		sc = &st.st_class[i];
+		if (sc->sc_nblk == 0)
+			continue;
+		dprintf(fd, "%s{\"objsz\":%zu,\"nblk\":%zu,\"nslot\":%zu,"
+		    "\"nfree\":%zu}", first ? "" : ",", (size_t)1 << i,
+		    sc->sc_nblk, sc->sc_nslot, sc->sc_nfree);
+		first = 0;
+	}
+	dprintf(fd, "],\"btbls\":{");
+	for (i = 0, first = 1; i < GC_STATS_NBTBL; i++) {
+		bs = &st.st_btbl[i];
+		if (!bs->bs_valid)
+			continue;
+		/* Fragmentation: share of free slots outside the longest run. */
+		dprintf(fd, "%s\"%s\":{\"slotsz\":%zu,\"nslots\":%zu,"
+		    "\"nused\":%zu,\"nfree\":%zu,\"maxfree\":%zu,"
+		    "\"nrelease\":%zu,\"util\":%.4f,\"frag\":%.4f}",
+		    first ? "" : ",", btbl_names[i], bs->bs_slotsz,
+		    bs->bs_nslots, bs->bs_nused, bs->bs_nfree, bs->bs_maxfree,
+		    bs->bs_nrelease,
+		    bs->bs_nslots != 0 ?
+		    (double)bs->bs_nused / bs->bs_nslots : 0.0,
+		    bs->bs_nfree != 0 ?
+		    1.0 - (double)bs->bs_maxfree / bs->bs_nfree : 0.0);
+		first = 0;
+	}
+	dprintf(fd, "}}\n");
+	return (GC_SUCC);
+}
+
+int
+gc_stats_json(int fd)
+{
+	int rc;
+
+	GC_LOCK();
+	rc = gc_stats_write(fd);
+	GC_UNLOCK();
+	return (rc);
+}
+
+static void
+gc_stats_sighnd(int sig)
+{
+
+	gc_stats_req = 1;
+}
+
+int
+gc_set_stats_signal(int sig, int fd)
+{
+
+	GC_LOCK();
+	gc_state_c->gs_stats_fd = fd;
+	GC_UNLOCK();
+	if (signal(sig, gc_stats_sighnd) == SIG_ERR) {
+		gc_error("signal(%d)", sig);
+		return (GC_ERROR);
+	}
+	return (GC_SUCC);
+}
+
+void
+gc_stats_poll(void)
+{
+
+	if (!gc_stats_req)
+		return;
+	gc_stats_req = 0;
+	(void)gc_stats_write(gc_state_c->gs_stats_fd);
+}
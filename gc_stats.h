@@ -0,0 +1,83 @@
+#ifndef _GC_STATS_H_
+#define _GC_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gc.h"
+
+/*
+ * Statistics snapshots.
+ *
+ * gc_get_stats fills in a struct gc_stats from the collector's
+ * counters and a walk of the block table maps; the walk touches only
+ * the maps and the small block headers, never object data.
+ * gc_stats_json writes the same snapshot as a single JSON object. The
+ * cumulative counters (st_nalloc to st_nrelease) are only maintained
+ * with GC_COLLECT_STATS, and are zero otherwise.
+ *
+ * gc_set_stats_signal installs a handler that only records the
+ * request; the snapshot is written where the collector's state is
+ * consistent: by the next allocation or collection, or before the
+ * command-line monitor reads its next command. A program that does
+ * none of these never writes it.
+ */
+
+/* Occupancy of one small size class (1 << index bytes). */
+struct gc_stats_class {
+	size_t		sc_nblk;	/* blocks */
+	size_t		sc_nslot;	/* object slots in those blocks */
+	size_t		sc_nfree;	/* free object slots */
+};
+
+/* Utilisation of one block table. */
+struct gc_stats_btbl {
+	int		bs_valid;	/* btbl is in use */
+	size_t		bs_slotsz;	/* bytes per slot */
+	size_t		bs_nslots;	/* slots */
+	size_t		bs_nused;	/* used slots, incl. continuations */
+	size_t		bs_nfree;	/* free slots */
+	size_t		bs_maxfree;	/* longest run of free slots */
+	size_t		bs_nrelease;	/* pages returned to the OS */
+};
+
+/* Block tables in st_btbl. */
+#define	GC_STATS_SMALL		0
+#define	GC_STATS_BIG		1
+#define	GC_STATS_NURSERY	2
+#define	GC_STATS_NBTBL		3
+
+struct gc_stats {
+	/* Cumulative counters (GC_COLLECT_STATS). */
+	size_t		st_nalloc;
+	size_t		st_nallocbytes;
+	size_t		st_nmark;
+	size_t		st_nmarkbytes;
+	size_t		st_nsweep;
+	size_t		st_nsweepbytes;
+	size_t		st_ntcollect;
+	size_t		st_ntminor;
+	size_t		st_ntalloc[GC_LOG_BIGSZ];
+	size_t		st_ntbigalloc;
+	size_t		st_nrelease;
+	/* Always available. */
+	int		st_mark_state;	/* GC_MS_* */
+	int		st_gen_mode;	/* GC_GEN_* */
+	size_t		st_allocbytes;	/* since the last collection */
+	uint64_t	st_ncollect;	/* collections started */
+	uint64_t	st_npause;	/* stop-the-world pauses */
+	uint64_t	st_pause_p50;	/* pause percentiles (ns) */
+	uint64_t	st_pause_p99;
+	uint64_t	st_pause_p999;
+	size_t		st_rv_bytes;	/* bytes awaiting gc_revoke_commit */
+	struct gc_stats_class	st_class[GC_LOG_BIGSZ];
+	struct gc_stats_btbl	st_btbl[GC_STATS_NBTBL];
+};
+
+/* gc_get_stats and gc_stats_json, without taking gs_lock. */
+void	gc_stats_get(struct gc_stats *_st);
+int	gc_stats_write(int _fd);
+/* Writes a pending signal-requested snapshot; requires gs_lock. */
+void	gc_stats_poll(void);
+
+#endif /* !_GC_STATS_H_ */
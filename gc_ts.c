@@ -15,3 +15,20 @@ gc_cheri_put_ts(_gc_cap struct gc_ts *buf)
 	
 	return (sysarch(CHERI_SET_STACK, (void *)&buf->gts_cs));
 }
+
+_gc_cap void * _gc_cap *
+gc_ts_frames(_gc_cap struct gc_ts *buf, size_t *nframe)
+{
+	size_t tsp, tsize;
+
+	tsp = buf->gts_cs.cs_tsp;
+	tsize = buf->gts_cs.cs_tsize;
+	/* Don't trust the kernel's offsets beyond the buffer. */
+	if (tsize > sizeof(buf->gts_cs.cs_frames))
+		tsize = sizeof(buf->gts_cs.cs_frames);
+	if (tsp > tsize)
+		tsp = tsize;
+	*nframe = (tsize - tsp) / sizeof(struct cheri_stack_frame);
+	return (gc_cheri_ptr((char *)(void *)&buf->gts_cs.cs_frames + tsp,
+	    *nframe * sizeof(struct cheri_stack_frame)));
+}
@@ -15,7 +15,20 @@ struct gc_ts
 {
 	struct cheri_stack gts_cs;
 };
+
+/* Capabilities saved in each trusted stack frame. */
+#define	GC_TS_FRAME_NCAP						\
+	(sizeof(struct cheri_stack_frame) / sizeof(_gc_cap void *))
+
 int	gc_cheri_get_ts(_gc_cap struct gc_ts *_buf);
 int	gc_cheri_put_ts(_gc_cap struct gc_ts *_buf);
+/*
+ * Returns the live frames of the buffer as an array of capabilities,
+ * GC_TS_FRAME_NCAP per frame, and their number in *_nframe. The stack
+ * grows down from cs_tsize, so these are the frames at byte offsets
+ * [cs_tsp, cs_tsize); frames below cs_tsp are stale.
+ */
+_gc_cap void * _gc_cap	*gc_ts_frames(_gc_cap struct gc_ts *_buf,
+			    size_t *_nframe);
 
 #endif /* !_GC_TS_H_ */
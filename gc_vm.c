@@ -9,6 +9,10 @@
 #include <unistd.h>
 #endif
 
+#include <sys/mman.h>
+
+#include <string.h>
+
 #include "gc.h"
 #include "gc_debug.h"
 #include "gc_vm.h"
@@ -32,6 +36,20 @@ gc_vm_tbl_alloc(_gc_cap struct gc_vm_tbl *vt, size_t sz)
 	return (0);
 }
 
+void
+gc_vm_tbl_free(_gc_cap struct gc_vm_tbl *vt)
+{
+	uint64_t top;
+
+	munmap((void *)vt->vt_ent, sizeof(*vt->vt_ent) * vt->vt_sz);
+	munmap((void *)vt->vt_bt, sizeof(*vt->vt_bt) * vt->vt_sz);
+	/* gc_vm_tbl_new_bt has moved vt_bt_hp up through the pool. */
+	top = gc_cheri_getbase(vt->vt_bt_hp) + gc_cheri_getlen(vt->vt_bt_hp);
+	munmap((void *)(top - GC_BT_HP_SZ), GC_BT_HP_SZ);
+	vt->vt_sz = 0;
+	vt->vt_nent = 0;
+}
+
 int
 gc_vm_tbl_update(_gc_cap struct gc_vm_tbl *vt)
 {
@@ -124,29 +142,41 @@ gc_vm_tbl_new_bt(_gc_cap struct gc_vm_tbl *vt,
     _gc_cap struct gc_vm_ent *ve)
 {
 	uint64_t base, len;
-	size_t npages, mapsz, tagsz;
+	size_t npages, mapsz, tagsz, scansz;
 
 	base = ve->ve_start;
 	len = ve->ve_end - base;
 	npages = len / GC_PAGESZ;
 	/* Round up npages to next multiple of 2. */
 	npages = (npages + (size_t)1) & ~(size_t)1;
-	mapsz = npages / 2;
+	/* Keep the tags and scanned bits that follow the map aligned. */
+	mapsz = (npages / 2 + sizeof(uint64_t) - 1) &
+	    ~(sizeof(uint64_t) - 1);
 	tagsz = npages * sizeof(*ve->ve_bt->bt_tags);
+	scansz = GC_BIT_NWORDS(npages) * sizeof(uint64_t);
 
 	ve->ve_bt->bt_base = gc_cheri_ptr((void *)base, len);
 	ve->ve_bt->bt_slotsz = GC_PAGESZ;
 	ve->ve_bt->bt_nslots = npages;
 	ve->ve_bt->bt_flags = 0;
+	ve->ve_bt->bt_decommit = NULL;
+	ve->ve_bt->bt_cards = NULL;
+	ve->ve_bt->bt_notags = NULL;
+	ve->ve_bt->bt_leaf = NULL;
+	ve->ve_bt->bt_sweep = npages;
 	ve->ve_bt->bt_valid = 1;
 	
-	/* Allocate tags and map contiguously from pool. */
-	if (gc_cheri_getlen(vt->vt_bt_hp) < mapsz + tagsz)
+	/* Allocate map, tags and scanned bits contiguously from pool. */
+	if (gc_cheri_getlen(vt->vt_bt_hp) < mapsz + tagsz + scansz)
 			return (GC_ERROR);
-	ve->ve_bt->bt_map = gc_cheri_setlen(vt->vt_bt_hp, mapsz);
+	ve->ve_bt->bt_map = gc_cheri_setlen(vt->vt_bt_hp, npages / 2);
 	vt->vt_bt_hp = gc_cheri_incbase(vt->vt_bt_hp, mapsz);
 	ve->ve_bt->bt_tags = gc_cheri_setlen(vt->vt_bt_hp, tagsz);
 	vt->vt_bt_hp = gc_cheri_incbase(vt->vt_bt_hp, tagsz);
+	ve->ve_bt->bt_scanned = gc_cheri_setlen(vt->vt_bt_hp, scansz);
+	vt->vt_bt_hp = gc_cheri_incbase(vt->vt_bt_hp, scansz);
+	memset((void *)ve->ve_bt->bt_scanned, 0, scansz);
+	ve->ve_bt->bt_scan_epoch = gc_state_c->gs_scan_epoch;
 
 	/* Set entire region as used and unmarked. */
 	gc_btbl_set_map(ve->ve_bt, 0, npages - 1, GC_BTBL_USED);
@@ -49,6 +49,7 @@ struct gc_vm_tbl {
 /* Returns GC_SUCC, GC_ERROR or GC_TOO_SMALL. */
 int	gc_vm_tbl_update(_gc_cap struct gc_vm_tbl *_vt);
 int	gc_vm_tbl_alloc(_gc_cap struct gc_vm_tbl *_vt, size_t _sz);
+void	gc_vm_tbl_free(_gc_cap struct gc_vm_tbl *_vt);
 _gc_cap struct gc_vm_ent	*gc_vm_tbl_find_btbl(
 				    _gc_cap struct gc_vm_tbl *_vt,
 				    _gc_cap struct gc_btbl *_bt);
@@ -15,6 +15,7 @@ static __capability void	*cheri_gc_type;
 struct cheri_gc {
 	CHERI_SYSTEM_OBJECT_FIELDS;	/* saved c0 */
 	int cg_perm;	/* method number permissions */
+	__capability struct gc_state *cg_heap;	/* own heap */
 };
 
 static __attribute__ ((constructor)) void
@@ -35,6 +36,11 @@ cheri_gc_new(int perm, struct cheri_object *cop)
 	}
 	CHERI_SYSTEM_OBJECT_INIT(cgp);	/* store c0 */
 	cgp->cg_perm = perm;
+	cgp->cg_heap = gc_heap_new();
+	if (cgp->cg_heap == NULL) {
+		free(cgp);
+		return (-1);
+	}
 
 	cop->co_codecap = cheri_setoffset(cheri_getpcc(),
 	    (register_t)CHERI_CLASS_ENTRY(cheri_gc));
@@ -71,6 +77,8 @@ cheri_gc_destroy(struct cheri_object co)
 	__capability struct cheri_gc *cgp;
 
 	cgp = cheri_unseal(co.co_datacap, cheri_gc_type);
+	/* Everything the sandbox allocated goes at once. */
+	gc_heap_destroy(cgp->cg_heap);
 	free((void *)cgp);
 }
 
@@ -78,6 +86,7 @@ static int
 _cheri_gc_alloc_c(__capability void * __capability *out_ptr, size_t sz)
 {
 	__capability struct cheri_gc *cgp;
+	__capability struct gc_state *old;
 
 	/* Check permission to allocate hasn't been revoked. */
 	cgp = cheri_getidc();
@@ -91,8 +100,13 @@ _cheri_gc_alloc_c(__capability void * __capability *out_ptr, size_t sz)
 		return (-1);
 	}
 
-	/* Forward to GC. */
+	/* Forward to GC, on the sandbox's own heap. */
+	old = gc_heap_switch(cgp->cg_heap);
+	if (old == NULL) {
+		return (-1);
+	}
 	*out_ptr = gc_malloc(sz);
+	gc_heap_switch(old);
 	printf("_cheri_gc_alloc_c: returning 0\n");
 	return (0);
 }
@@ -101,6 +115,7 @@ static int
 _cheri_gc_revoke_c(__capability void *ptr)
 {
 	__capability struct cheri_gc *cgp;
+	__capability struct gc_state *old;
 
 	/* Check permission to revoke hasn't been revoked. */
 	cgp = cheri_getidc();
@@ -108,8 +123,13 @@ _cheri_gc_revoke_c(__capability void *ptr)
 		return (-1);
 	}
 
-	/* Forward to GC. */
+	/* Forward to GC, on the sandbox's own heap. */
+	old = gc_heap_switch(cgp->cg_heap);
+	if (old == NULL) {
+		return (-1);
+	}
 	gc_revoke(ptr);
+	gc_heap_switch(old);
 	return (0);
 }
 
@@ -117,6 +137,7 @@ static int
 _cheri_gc_reuse_c(__capability void *ptr)
 {
 	__capability struct cheri_gc *cgp;
+	__capability struct gc_state *old;
 
 	/* Check permission to reuse hasn't been revoked. */
 	cgp = cheri_getidc();
@@ -124,8 +145,13 @@ _cheri_gc_reuse_c(__capability void *ptr)
 		return (-1);
 	}
 
-	/* Forward to GC. */
+	/* Forward to GC, on the sandbox's own heap. */
+	old = gc_heap_switch(cgp->cg_heap);
+	if (old == NULL) {
+		return (-1);
+	}
 	gc_reuse(ptr);
+	gc_heap_switch(old);
 	return (0);
 }
 
@@ -133,6 +159,8 @@ static int
 _cheri_gc_status_c(__capability void *ptr)
 {
 	__capability struct cheri_gc *cgp;
+	__capability struct gc_state *old;
+	int rc;
 
 	/* Check permission to get status hasn't been revoked. */
 	cgp = cheri_getidc();
@@ -140,8 +168,14 @@ _cheri_gc_status_c(__capability void *ptr)
 		return (-1);
 	}
 
-	/* Forward to GC. */
-	return (gc_get_obj(ptr, gc_cap_addr(&ptr), NULL, NULL, NULL, NULL));
+	/* Forward to GC, on the sandbox's own heap. */
+	old = gc_heap_switch(cgp->cg_heap);
+	if (old == NULL) {
+		return (-1);
+	}
+	rc = gc_get_obj(ptr, gc_cap_addr(&ptr), NULL, NULL, NULL, NULL);
+	gc_heap_switch(old);
+	return (rc);
 }
 
 int
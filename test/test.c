@@ -9,7 +9,10 @@
 #include <unistd.h>
 #endif /* GC_USE_LIBPROCSTAT */
 
+#include <sys/mman.h>
+
 #include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +20,8 @@
 #include <gc.h>
 #include <gc_cmdln.h>
 #include <gc_debug.h>
+#include <gc_heap.h>
+#include <gc_stats.h>
 
 #include "framework.h"
 #include "test_sb.h"
@@ -28,16 +33,83 @@ testfn		test_procstat;
 #endif
 testfn		test_gc_malloc;
 testfn		test_ll;
+testfn		test_trace;
 testfn		test_store;
+testfn		test_release;
+testfn		test_super;
+testfn		test_gen;
+testfn		test_gen_switch;
+testfn		test_gen_full;
+testfn		test_lazy_sweep;
+testfn		test_notags;
+testfn		test_revoke;
+testfn		test_revoke_store;
+testfn		test_revoke_first;
+testfn		test_quarantine;
+testfn		test_reuse;
+testfn		test_atomic;
+testfn		test_buckets;
+testfn		test_poison;
+testfn		test_evacuate;
+testfn		test_prof;
+testfn		test_event;
+testfn		test_stats;
+testfn		test_reserve;
+testfn		test_lazy_init;
+testfn		test_roots;
+testfn		test_unmanaged;
+testfn		test_ts;
+testfn		test_heaps;
+testfn		test_heaps_wp;
+#ifdef GC_USE_PTHREAD
+testfn		test_conc;
+#endif
 
 struct tf_test	tests[] = {
 	{.t_fn = test_gc_init, .t_desc = "gc initialization"},
+	{.t_fn = test_trace, .t_desc = "trace ring", .t_dofork = 0},
 #ifdef GC_USE_LIBPROCSTAT
 	/*{.t_fn = test_procstat, .t_desc = "libprocstat", .t_dofork = 0},*/
 #endif
 	//{.t_fn = test_ll, .t_desc = "linked list", .t_dofork = 0},
 	//{.t_fn = test_store, .t_desc = "ptr store", .t_dofork = 0},
 	/*{.t_fn = test_gc_malloc, .t_desc = "gc malloc", .t_dofork = 0},*/
+	{.t_fn = test_release, .t_desc = "page release", .t_dofork = 0},
+	{.t_fn = test_super, .t_desc = "superpage reservation", .t_dofork = 0},
+	{.t_fn = test_gen, .t_desc = "generational", .t_dofork = 0},
+	{.t_fn = test_gen_switch, .t_desc = "generational mode changes",
+	    .t_dofork = 0},
+	{.t_fn = test_gen_full, .t_desc = "promoted nursery", .t_dofork = 0},
+	{.t_fn = test_lazy_sweep, .t_desc = "lazy sweep", .t_dofork = 0},
+	{.t_fn = test_notags, .t_desc = "tag summary", .t_dofork = 0},
+	{.t_fn = test_revoke, .t_desc = "batched revocation", .t_dofork = 0},
+	{.t_fn = test_revoke_store, .t_desc = "store after revocation",
+	    .t_dofork = 0},
+	{.t_fn = test_revoke_first, .t_desc = "revoking the first big object",
+	    .t_dofork = 0},
+	{.t_fn = test_quarantine, .t_desc = "gc_free quarantine",
+	    .t_dofork = 0},
+	{.t_fn = test_reuse, .t_desc = "reuse hint", .t_dofork = 0},
+	{.t_fn = test_atomic, .t_desc = "pointer-free allocation",
+	    .t_dofork = 0},
+	{.t_fn = test_poison, .t_desc = "poisoning modes", .t_dofork = 0},
+	{.t_fn = test_buckets, .t_desc = "occupancy buckets", .t_dofork = 0},
+	{.t_fn = test_evacuate, .t_desc = "evacuation", .t_dofork = 0},
+	{.t_fn = test_prof, .t_desc = "heap profile", .t_dofork = 0},
+	{.t_fn = test_event, .t_desc = "collection events", .t_dofork = 0},
+	{.t_fn = test_stats, .t_desc = "statistics", .t_dofork = 0},
+	{.t_fn = test_reserve, .t_desc = "heap reservation", .t_dofork = 0},
+	{.t_fn = test_lazy_init, .t_desc = "lazy initialization",
+	    .t_dofork = 0},
+	{.t_fn = test_roots, .t_desc = "static roots", .t_dofork = 0},
+	{.t_fn = test_unmanaged, .t_desc = "unmanaged pages", .t_dofork = 0},
+	{.t_fn = test_ts, .t_desc = "trusted stack frames", .t_dofork = 0},
+	{.t_fn = test_heaps, .t_desc = "multiple heaps", .t_dofork = 0},
+	{.t_fn = test_heaps_wp, .t_desc = "root protection in several heaps",
+	    .t_dofork = 0},
+#ifdef GC_USE_PTHREAD
+	{.t_fn = test_conc, .t_desc = "concurrent marking", .t_dofork = 0},
+#endif
 	{.t_fn = test_sb, .t_desc = "sandboxing", .t_dofork = 0},
 	{.t_fn = NULL},
 };
@@ -85,6 +157,25 @@ test_gc_init(struct tf_test *thiz)
 	return (rc);
 }
 
+int
+test_trace(struct tf_test *thiz)
+{
+	struct gc_trace_ent *te;
+	uint64_t seq;
+
+	seq = gc_trace_seq;
+	gc_trace_mask = 1U << GC_TRACE_COLLECT;
+	gc_extern_collect();
+	gc_trace_mask = 0;
+	thiz->t_assert(gc_trace_seq > seq);
+	te = &gc_trace_buf[seq & (GC_TRACESZ - 1)];
+	thiz->t_assert(te->te_seq == seq);
+	thiz->t_assert(te->te_ev == GC_TRACE_COLLECT);
+	gc_trace_dump(GC_TRACESZ);
+
+	return (TF_SUCC);
+}
+
 int
 test_gc_malloc(struct tf_test *thiz)
 {
@@ -299,3 +390,1177 @@ test_store(struct tf_test *thiz)
 		if (n->n->v[i] != 22) printf("n->n->v[%zu] = 0x%x is not 22!\n", i, n->n->v[i]);
 	return (TF_SUCC);
 }
+
+int
+test_release(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	_gc_cap uint8_t *obj;
+	size_t old, objsz;
+	int i, nmax;
+
+	/* Configurable */
+	nmax = 4;
+	objsz = 4 * GC_PAGESZ;
+
+	old = gc_set_release_min(1);
+	for (i = 0; i < nmax; i++) {
+		obj = gc_malloc(objsz);
+		thiz->t_assert(obj != NULL);
+	}
+	obj = NULL;
+	gc_extern_collect();
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_btbl[GC_STATS_BIG].bs_nrelease > 0);
+	/* Released pages come back when they are allocated again. */
+	for (i = 0; i < nmax; i++) {
+		obj = gc_malloc(objsz);
+		thiz->t_assert(obj != NULL);
+		memset((void *)obj, i, objsz);
+		thiz->t_assert(obj[objsz - 1] == (uint8_t)i);
+	}
+	gc_set_release_min(old);
+
+	return (TF_SUCC);
+}
+
+int
+test_super(struct tf_test *thiz)
+{
+	_gc_cap uint8_t *p;
+	size_t sz;
+
+	/* Configurable */
+	sz = GC_SUPERPAGESZ + GC_PAGESZ;
+
+	p = gc_alloc_super(sz);
+	thiz->t_assert(p != NULL);
+	thiz->t_assert((gc_cheri_getbase(p) & (GC_SUPERPAGESZ - 1)) == 0);
+	thiz->t_assert(gc_cheri_getlen(p) == sz);
+	/* The whole rounded reservation is mapped. */
+	p[sz - 1] = 1;
+	thiz->t_assert(munmap((void *)p, GC_SUPER_ROUND(sz)) == 0);
+
+	return (TF_SUCC);
+}
+
+int
+test_gen(struct tf_test *thiz)
+{
+	_gc_cap struct node *hd, *t;
+	int i, mode, nmax, junkn;
+
+	/* Configurable */
+	nmax = 50;
+	junkn = 200;
+
+	for (mode = GC_GEN_NURSERY; mode <= GC_GEN_STICKY; mode++) {
+		thiz->t_assert(gc_set_gen_mode(mode) == GC_SUCC);
+
+		/* Build a list, interleaved with enough garbage to collect. */
+		hd = NULL;
+		for (i = 0; i < nmax; i++) {
+			t = gc_malloc(sizeof(struct node));
+			thiz->t_assert(t != NULL);
+			GC_STORE_CAP(&t->n, hd);
+			t->v[0] = i;
+			hd = t;
+			gc_malloc(junkn);
+		}
+		/* Old list head, young tail: only the barrier keeps it alive. */
+		gc_extern_collect();
+		for (i = 0; i < nmax; i++) {
+			t = gc_malloc(sizeof(struct node));
+			thiz->t_assert(t != NULL);
+			t->v[0] = 0xFF;
+			GC_STORE_CAP(&t->n, hd->n);
+			GC_STORE_CAP(&hd->n, t);
+			gc_malloc(junkn);
+		}
+		for (i = 0, t = hd->n; i < nmax; i++, t = t->n) {
+			thiz->t_assert(t != NULL);
+			thiz->t_assert(t->v[0] == 0xFF);
+		}
+		for (i = nmax - 2; i >= 0; i--, t = t->n) {
+			thiz->t_assert(t != NULL);
+			thiz->t_assert(t->v[0] == i);
+		}
+
+		thiz->t_assert(gc_set_gen_mode(GC_GEN_NONE) == GC_SUCC);
+	}
+	return (TF_SUCC);
+}
+
+int
+test_gen_switch(struct tf_test *thiz)
+{
+	_gc_cap struct node * _gc_cap *um;
+	_gc_cap struct node *old, *t;
+	int i, junkn, junksz;
+
+	/* Configurable */
+	junkn = 4096;
+	junksz = 200;
+
+	um = gc_cheri_ptr(mmap(NULL, GC_PAGESZ, PROT_READ | PROT_WRITE,
+	    MAP_ANON, -1, 0), GC_PAGESZ);
+	thiz->t_assert((void *)um != MAP_FAILED);
+
+	/* A young object, then a store into an old one with no barrier. */
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NURSERY) == GC_SUCC);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 1;
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NONE) == GC_SUCC);
+	old = gc_malloc(sizeof(struct node));
+	thiz->t_assert(old != NULL);
+	old->n = t;
+	/* A young object referenced only from unmanaged memory. */
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NURSERY) == GC_SUCC);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 2;
+	GC_STORE_CAP(&um[0], t);
+	t = NULL;
+	/* Enough garbage for several minor collections. */
+	for (i = 0; i < junkn; i++)
+		gc_malloc(junksz);
+	thiz->t_assert(gc_cheri_gettag(old->n));
+	thiz->t_assert(old->n->v[0] == 1);
+	thiz->t_assert(gc_cheri_gettag(um[0]));
+	thiz->t_assert(um[0]->v[0] == 2);
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NONE) == GC_SUCC);
+	munmap((void *)um, GC_PAGESZ);
+
+	return (TF_SUCC);
+}
+
+int
+test_gen_full(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	_gc_cap struct node *hd, *t;
+	size_t nminor, ncollect;
+	int i, nmax, nmore;
+
+	/* Configurable */
+	nmax = 4 * GC_NURSERY_NSLOTS * (GC_PAGESZ / GC_MINSZ);
+	nmore = 8;
+
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NURSERY) == GC_SUCC);
+	gc_get_stats(&st);
+	nminor = st.st_ntminor;
+	/* Fill the nursery with survivors, up to the minor collection. */
+	hd = NULL;
+	for (i = 0; i < nmax && st.st_ntminor == nminor; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		GC_STORE_CAP(&t->n, hd);
+		hd = t;
+		gc_get_stats(&st);
+	}
+	thiz->t_assert(st.st_ntminor != nminor);
+	/* Nothing young is left; no more minor collections. */
+	nminor = st.st_ntminor;
+	for (i = 0; i < nmore; i++)
+		thiz->t_assert(gc_malloc(sizeof(struct node)) != NULL);
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_ntminor == nminor);
+	/*
+	 * Once the promoted blocks are garbage, overflowing a nursery's
+	 * worth into the old generation brings a full collection that
+	 * frees them for young objects again.
+	 */
+	hd = t = NULL;
+	ncollect = st.st_ntcollect;
+	for (i = 0; i < nmax && st.st_ntcollect == ncollect; i++) {
+		thiz->t_assert(gc_malloc(sizeof(struct node)) != NULL);
+		gc_get_stats(&st);
+	}
+	thiz->t_assert(st.st_ntcollect != ncollect);
+	thiz->t_assert(gc_nursery_young());
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NONE) == GC_SUCC);
+
+	return (TF_SUCC);
+}
+
+int
+test_lazy_sweep(struct tf_test *thiz)
+{
+	_gc_cap struct node *hd, *t;
+	int i, nmax, junkn;
+
+	/* Configurable */
+	nmax = 50;
+	junkn = 400;
+
+	thiz->t_assert(gc_set_concurrent(GC_CONC_SWEEP) == GC_SUCC);
+	/* Nursery blocks, half garbage, promoted onto the gs_heap lists. */
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NURSERY) == GC_SUCC);
+	hd = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		GC_STORE_CAP(&t->n, hd);
+		t->v[0] = i;
+		hd = t;
+		gc_malloc(sizeof(struct node));
+	}
+	thiz->t_assert(gc_set_gen_mode(GC_GEN_NONE) == GC_SUCC);
+	/* The allocator sweeps the blocks it passes. */
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->v[0] = 0xFF;
+	}
+	for (i = nmax - 1, t = hd; i >= 0; i--, t = t->n) {
+		thiz->t_assert(t != NULL);
+		thiz->t_assert(t->v[0] == i);
+	}
+	thiz->t_assert(gc_set_concurrent(0) == GC_SUCC);
+
+	return (TF_SUCC);
+}
+
+int
+test_notags(struct tf_test *thiz)
+{
+	_gc_cap struct node * _gc_cap *big;
+	_gc_cap struct node *t;
+	size_t bigsz, n;
+	int i, junkn;
+
+	/* Configurable */
+	bigsz = 8 * GC_PAGESZ;
+	junkn = 200;
+
+	/* Only the last page of a big object holds a capability. */
+	big = gc_malloc(bigsz);
+	thiz->t_assert(big != NULL);
+	memset((void *)big, 0, bigsz);
+	n = bigsz / sizeof(*big);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 1;
+	GC_STORE_CAP(&big[n - 1], t);
+	gc_extern_collect();
+	/* A middle page found tag-free by that collection gains one. */
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 2;
+	GC_STORE_CAP(&big[n / 2], t);
+	t = NULL;
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->v[0] = 0xFF;
+	}
+	thiz->t_assert(gc_cheri_gettag(big[n - 1]));
+	thiz->t_assert(big[n - 1]->v[0] == 1);
+	thiz->t_assert(gc_cheri_gettag(big[n / 2]));
+	thiz->t_assert(big[n / 2]->v[0] == 2);
+
+	return (TF_SUCC);
+}
+
+int
+test_revoke(struct tf_test *thiz)
+{
+	_gc_cap struct node *hd, *t;
+	_gc_cap struct node *keep;
+	int i, nmax;
+
+	/* Configurable */
+	nmax = 100;
+
+	/* Nodes with even values are revoked; the list is cut there. */
+	hd = NULL;
+	keep = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->n = hd;
+		t->v[0] = i;
+		hd = t;
+		if (i == 1)
+			keep = t;
+	}
+	for (t = hd; t != NULL; t = t->n)
+		if (t->v[0] % 2 == 0)
+			thiz->t_assert(gc_revoke(t) == GC_BTBL_USED);
+	gc_revoke_commit();
+	thiz->t_assert(gc_cheri_gettag(hd));
+	thiz->t_assert(!gc_cheri_gettag(hd->n));
+	thiz->t_assert(gc_cheri_gettag(keep));
+	thiz->t_assert(!gc_cheri_gettag(keep->n));
+
+	return (TF_SUCC);
+}
+
+int
+test_revoke_store(struct tf_test *thiz)
+{
+	_gc_cap struct node * _gc_cap *box;
+	_gc_cap struct node *t;
+	int i, junkn;
+
+	/* Configurable */
+	junkn = 200;
+
+	/* A page with no capabilities, seen by a commit. */
+	box = gc_malloc(GC_PAGESZ);
+	thiz->t_assert(box != NULL);
+	memset((void *)box, 0, GC_PAGESZ);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	thiz->t_assert(gc_revoke(t) == GC_BTBL_USED);
+	gc_revoke_commit();
+	/* The only reference to a new object goes into that page. */
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 1;
+	GC_STORE_CAP(&box[0], t);
+	t = NULL;
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->v[0] = 0xFF;
+	}
+	thiz->t_assert(gc_cheri_gettag(box[0]));
+	thiz->t_assert(box[0]->v[0] == 1);
+
+	return (TF_SUCC);
+}
+
+int
+test_revoke_first(struct tf_test *thiz)
+{
+	_gc_cap struct gc_state *heap, *old;
+	_gc_cap void *p;
+	int bigsz;
+
+	/* Configurable */
+	bigsz = 2 * GC_BIGSZ;
+
+	/*
+	 * In a new heap, the first big object starts where the big btbl's
+	 * bump pointer does; revoking it must leave the latter alone.
+	 */
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	p = gc_malloc(bigsz);
+	thiz->t_assert(p != NULL);
+	thiz->t_assert(gc_cheri_getbase(p) ==
+	    gc_cheri_getbase(heap->gs_btbl_big.bt_base));
+	thiz->t_assert(gc_revoke(p) == GC_BTBL_USED);
+	p = NULL;
+	gc_revoke_commit();
+	thiz->t_assert(gc_cheri_gettag(heap->gs_btbl_big.bt_base));
+	p = gc_malloc(bigsz);
+	thiz->t_assert(p != NULL);
+	memset((void *)p, 1, bigsz);
+	p = NULL;
+	thiz->t_assert(gc_heap_switch(old) == heap);
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+
+	return (TF_SUCC);
+}
+
+int
+test_quarantine(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	_gc_cap struct node *box, *t;
+	uint64_t addr;
+	size_t old;
+	int i, nmax, nfree, reused;
+
+	/* Configurable */
+	nmax = 4096;
+	nfree = 8;
+
+	old = gc_set_quarantine(nfree * sizeof(struct node));
+	box = gc_malloc(sizeof(struct node));
+	thiz->t_assert(box != NULL);
+	box->p = gc_malloc(sizeof(struct node));
+	thiz->t_assert(box->p != NULL);
+	addr = gc_cheri_getbase(box->p);
+	/* gc_revoke doesn't fill the quarantine. */
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	thiz->t_assert(gc_revoke(t) == GC_BTBL_USED);
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_rv_bytes == 0);
+	/* gc_free does, until it commits; box->p then dangles. */
+	gc_free(box->p);
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_rv_bytes != 0);
+	thiz->t_assert(gc_cheri_gettag(box->p));
+	for (i = 0; i < nmax && st.st_rv_bytes != 0; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		gc_free(t);
+		gc_get_stats(&st);
+	}
+	thiz->t_assert(i > 1 && i < nmax);
+	thiz->t_assert(!gc_cheri_gettag(box->p));
+	/* The slot goes back to the allocator. */
+	reused = 0;
+	for (i = 0; i < nmax && !reused; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		reused = gc_cheri_getbase(t) == addr;
+	}
+	thiz->t_assert(reused);
+	gc_set_quarantine(old);
+
+	return (TF_SUCC);
+}
+
+int
+test_reuse(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	_gc_cap uint8_t *keep, *drop;
+	size_t nused, objsz;
+
+	/* Configurable */
+	objsz = 2 * GC_BIGSZ;
+
+	keep = gc_malloc(objsz);
+	thiz->t_assert(keep != NULL);
+	memset((void *)keep, 1, objsz);
+	drop = gc_malloc(objsz);
+	thiz->t_assert(drop != NULL);
+	gc_get_stats(&st);
+	nused = st.st_btbl[GC_STATS_BIG].bs_nused;
+	/* A wrong hint is ignored; a right one frees the object. */
+	gc_reuse(keep);
+	gc_reuse(drop);
+	drop = NULL;
+	gc_extern_collect();
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_btbl[GC_STATS_BIG].bs_nused < nused);
+	thiz->t_assert(keep[0] == 1 && keep[objsz - 1] == 1);
+
+	return (TF_SUCC);
+}
+
+int
+test_atomic(struct tf_test *thiz)
+{
+	_gc_cap struct node *hd, *t;
+	int i, nmax, bigsz;
+
+	/* Configurable */
+	nmax = 50;
+	bigsz = 2 * GC_BIGSZ;
+
+	/* Buffers hanging off a list survive without being scanned. */
+	hd = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->n = hd;
+		t->p = gc_malloc_atomic(i % 2 ? 16 : bigsz);
+		thiz->t_assert(t->p != NULL);
+		memset((void *)t->p, i, i % 2 ? 16 : bigsz);
+		hd = t;
+	}
+	gc_extern_collect();
+	for (i = nmax - 1, t = hd; t != NULL; i--, t = t->n) {
+		thiz->t_assert(gc_cheri_gettag(t->p));
+		thiz->t_assert(((_gc_cap uint8_t *)t->p)[0] == (uint8_t)i);
+	}
+
+	return (TF_SUCC);
+}
+
+int
+test_poison(struct tf_test *thiz)
+{
+	static const int modes[] = {
+		GC_POISON_NONE, GC_POISON_ZERO, GC_POISON_PATTERN
+	};
+	_gc_cap uint32_t *p;
+	uint64_t addr;
+	size_t minpages;
+	int i, k, n, old, bigsz;
+
+	/* Configurable */
+	bigsz = 2 * GC_BIGSZ;
+
+	/* Keep swept pages mapped so their contents can be read back. */
+	minpages = gc_set_release_min((size_t)-1);
+	old = gc_set_poison(GC_POISON_NONE);
+	n = bigsz / sizeof(uint32_t);
+	for (i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); i++) {
+		gc_set_poison(modes[i]);
+
+		/* Fresh memory. */
+		p = gc_malloc(bigsz);
+		thiz->t_assert(p != NULL);
+		for (k = 0; k < n; k++) {
+			if (modes[i] == GC_POISON_ZERO)
+				thiz->t_assert(p[k] == 0);
+			else if (modes[i] == GC_POISON_PATTERN)
+				thiz->t_assert(p[k] == GC_MAGIC_INIT_USE);
+		}
+
+		/* Freed memory. */
+		memset((void *)p, 0x5A, bigsz);
+		addr = gc_cheri_getbase(p);
+		p = NULL;
+		gc_extern_collect();
+		p = gc_cheri_ptr((void *)addr, bigsz);
+		for (k = 0; k < n; k++) {
+			if (modes[i] == GC_POISON_PATTERN)
+				thiz->t_assert(p[k] == GC_MAGIC_INIT_FREE);
+			else
+				thiz->t_assert(p[k] == 0x5A5A5A5A);
+		}
+		p = NULL;
+	}
+	thiz->t_assert(gc_set_poison(old) == GC_POISON_PATTERN);
+	gc_set_release_min(minpages);
+
+	return (TF_SUCC);
+}
+
+#define	TEST_BUCKETS_OBJSZ	256
+#define	TEST_BUCKETS_NOBJ	(3 * GC_PAGESZ / TEST_BUCKETS_OBJSZ)
+
+int
+test_buckets(struct tf_test *thiz)
+{
+	_gc_cap void *objs[TEST_BUCKETS_NOBJ];
+	_gc_cap struct gc_state *heap, *old;
+	struct gc_stats st;
+	_gc_cap void *p;
+	uint64_t sparse, prev;
+	size_t logsz, nblk;
+	int i;
+
+	/* A heap of its own, so that no other blocks of the class exist. */
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	logsz = GC_LOG2(TEST_BUCKETS_OBJSZ);
+	for (i = 0; i < TEST_BUCKETS_NOBJ; i++) {
+		objs[i] = gc_malloc(TEST_BUCKETS_OBJSZ);
+		thiz->t_assert(objs[i] != NULL);
+	}
+	/*
+	 * Keep one object of the last block, and all but one object of
+	 * each of the others, which are then fuller.
+	 */
+	sparse = gc_cheri_getbase(objs[TEST_BUCKETS_NOBJ - 1]) &
+	    ~(uint64_t)(GC_PAGESZ - 1);
+	prev = 0;
+	for (i = TEST_BUCKETS_NOBJ - 2; i >= 0; i--) {
+		p = objs[i];
+		if ((gc_cheri_getbase(p) & ~(uint64_t)(GC_PAGESZ - 1)) ==
+		    sparse || (gc_cheri_getbase(p) &
+		    ~(uint64_t)(GC_PAGESZ - 1)) != prev)
+			objs[i] = NULL;
+		prev = gc_cheri_getbase(p) & ~(uint64_t)(GC_PAGESZ - 1);
+	}
+	p = NULL;
+	gc_extern_collect();
+	gc_get_stats(&st);
+	nblk = st.st_class[logsz].sc_nblk;
+	thiz->t_assert(nblk >= 2);
+	/* Allocation fills the fuller blocks and leaves the sparse one. */
+	for (i = 0; i < (int)nblk - 1; i++) {
+		p = gc_malloc(TEST_BUCKETS_OBJSZ);
+		thiz->t_assert(p != NULL);
+		thiz->t_assert((gc_cheri_getbase(p) &
+		    ~(uint64_t)(GC_PAGESZ - 1)) != sparse);
+	}
+	p = NULL;
+	/* So it drains, and is released once its last object dies. */
+	objs[TEST_BUCKETS_NOBJ - 1] = NULL;
+	gc_extern_collect();
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_class[logsz].sc_nblk == nblk - 1);
+	thiz->t_assert(gc_heap_switch(old) == heap);
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+
+	return (TF_SUCC);
+}
+
+int
+test_prof(struct tf_test *thiz)
+{
+	_gc_cap struct node *hd, *t;
+	FILE *fp;
+	size_t old, nlive, livebytes, nalloc, allocbytes;
+	int i, nmax, junksz;
+
+	/* Configurable */
+	nmax = 100;
+	junksz = 200;
+
+	old = gc_set_prof_rate(GC_PAGESZ);
+	hd = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		GC_STORE_CAP(&t->n, hd);
+		hd = t;
+		gc_malloc(junksz);
+	}
+	gc_extern_collect();
+	fp = tmpfile();
+	thiz->t_assert(fp != NULL);
+	thiz->t_assert(gc_prof_dump(fileno(fp)) == 0);
+	rewind(fp);
+	thiz->t_assert(fscanf(fp, "heap profile: %zu: %zu [%zu: %zu]",
+	    &nlive, &livebytes, &nalloc, &allocbytes) == 4);
+	fclose(fp);
+	/* Some samples were taken, and the garbage ones were dropped. */
+	thiz->t_assert(nalloc > 0);
+	thiz->t_assert(nlive < nalloc);
+	thiz->t_assert(livebytes < allocbytes);
+	gc_set_prof_rate(old);
+
+	return (TF_SUCC);
+}
+
+/* Events seen by test_event_fn. */
+static struct gc_event	test_event_last;
+static int		test_event_n;
+
+static void
+test_event_fn(const struct gc_event *ev, void *arg)
+{
+
+	test_event_last = *ev;
+	test_event_n++;
+}
+
+int
+test_event(struct tf_test *thiz)
+{
+	struct gc_event ev;
+	struct gc_event *e;
+
+	/* Record any earlier event still in progress. */
+	gc_extern_collect();
+	test_event_n = 0;
+	gc_set_event_fn(test_event_fn, NULL);
+	gc_extern_collect();
+	gc_set_event_fn(NULL, NULL);
+	thiz->t_assert(test_event_n == 1);
+	e = &test_event_last;
+	thiz->t_assert(e->ev_kind == GC_EV_FULL);
+	thiz->t_assert(e->ev_start <= e->ev_roots);
+	thiz->t_assert(e->ev_roots <= e->ev_mark);
+	thiz->t_assert(e->ev_mark <= e->ev_sweep);
+	thiz->t_assert(e->ev_maxpause <= e->ev_pause);
+	thiz->t_assert(e->ev_pages > 0);
+	/* The ring ends with the same event. */
+	thiz->t_assert(gc_get_events(&ev, 1) == 1);
+	thiz->t_assert(ev.ev_seq == e->ev_seq);
+	thiz->t_assert(gc_pause_pct(50) <= gc_pause_pct(99.9));
+
+	return (TF_SUCC);
+}
+
+int
+test_stats(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	FILE *fp;
+	uint64_t ncollect;
+	int c;
+
+	thiz->t_assert(gc_get_stats(&st) == 0);
+	ncollect = st.st_ncollect;
+	/* A signal-requested snapshot is written by the collection. */
+	fp = tmpfile();
+	thiz->t_assert(fp != NULL);
+	thiz->t_assert(gc_set_stats_signal(SIGUSR2, fileno(fp)) == 0);
+	raise(SIGUSR2);
+	gc_extern_collect();
+	signal(SIGUSR2, SIG_DFL);
+	rewind(fp);
+	c = fgetc(fp);
+	fclose(fp);
+	thiz->t_assert(c == '{');
+	thiz->t_assert(gc_get_stats(&st) == 0);
+	thiz->t_assert(st.st_ncollect == ncollect + 1);
+	thiz->t_assert(st.st_btbl[GC_STATS_SMALL].bs_valid);
+	thiz->t_assert(st.st_btbl[GC_STATS_SMALL].bs_nused +
+	    st.st_btbl[GC_STATS_SMALL].bs_nfree ==
+	    st.st_btbl[GC_STATS_SMALL].bs_nslots);
+
+	return (TF_SUCC);
+}
+
+int
+test_evacuate(struct tf_test *thiz)
+{
+	_gc_cap struct node * _gc_cap *ro;
+	_gc_cap struct node *hd, *t, *c;
+	int i, nmax, keep, junkn;
+
+	/* Configurable */
+	nmax = 512;
+	keep = 16;
+	junkn = 200;
+
+	hd = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->n = hd;
+		t->v[0] = i;
+		hd = t;
+	}
+	/* Drop most of the list, leaving its blocks sparse. */
+	for (t = hd; t != NULL; t = t->n) {
+		while (t->n != NULL && t->n->v[0] % keep != 0)
+			t->n = t->n->n;
+	}
+	/* A survivor also referenced from a read-only page stays put. */
+	ro = gc_cheri_ptr(mmap(NULL, GC_PAGESZ, PROT_READ | PROT_WRITE,
+	    MAP_ANON, -1, 0), GC_PAGESZ);
+	thiz->t_assert((void *)ro != MAP_FAILED);
+	ro[0] = hd->n;
+	thiz->t_assert(mprotect((void *)ro, GC_PAGESZ, PROT_READ) == 0);
+	gc_set_evacuate(1);
+	gc_extern_collect();
+	gc_set_evacuate(0);
+	thiz->t_assert(gc_cheri_gettag(ro[0]));
+	thiz->t_assert(gc_cheri_getbase(ro[0]) == gc_cheri_getbase(hd->n));
+	/* The survivors may have moved, but the list must be intact. */
+	for (i = nmax - 1, t = hd; t != NULL; t = t->n) {
+		thiz->t_assert(gc_cheri_gettag(t));
+		thiz->t_assert(t->v[0] == (uint8_t)i);
+		i = i == nmax - 1 ? (nmax - 1) / keep * keep : i - keep;
+	}
+	/* Stores made after the fix-up pass are seen by the next mark. */
+	for (t = hd; t != NULL; t = t->n) {
+		c = gc_malloc(sizeof(struct node));
+		thiz->t_assert(c != NULL);
+		c->v[0] = 0xAA;
+		GC_STORE_CAP(&t->p, c);
+	}
+	c = NULL;
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		c = gc_malloc(sizeof(struct node));
+		thiz->t_assert(c != NULL);
+		c->v[0] = 0xFF;
+	}
+	for (t = hd; t != NULL; t = t->n) {
+		thiz->t_assert(gc_cheri_gettag(t->p));
+		thiz->t_assert(t->p->v[0] == 0xAA);
+	}
+	thiz->t_assert(ro[0] == hd->n);
+	munmap((void *)ro, GC_PAGESZ);
+
+	return (TF_SUCC);
+}
+
+int
+test_reserve(struct tf_test *thiz)
+{
+	_gc_cap void *small, *big;
+	uint64_t addr;
+
+	small = gc_malloc(sizeof(struct node));
+	thiz->t_assert(small != NULL);
+	big = gc_malloc(2 * GC_BIGSZ);
+	thiz->t_assert(big != NULL);
+	/* Both btbls were committed from the one reservation. */
+	if (!gc_state_c->gs_hp_spill) {
+		addr = gc_cheri_getbase(small);
+		thiz->t_assert(addr >= gc_state_c->gs_hp_base &&
+		    addr < gc_state_c->gs_hp_top);
+		addr = gc_cheri_getbase(big);
+		thiz->t_assert(addr >= gc_state_c->gs_hp_base &&
+		    addr < gc_state_c->gs_hp_top);
+	}
+	thiz->t_assert(gc_get_managed_btbl(gc_cheri_getbase(small)) ==
+	    &gc_state_c->gs_btbl_small);
+	thiz->t_assert(gc_get_managed_btbl(gc_cheri_getbase(big)) ==
+	    &gc_state_c->gs_btbl_big);
+	/* Unmanaged memory is in no btbl, and isn't marked. */
+	thiz->t_assert(gc_get_managed_btbl((uint64_t)(uintptr_t)&addr) ==
+	    NULL);
+	thiz->t_assert(gc_ty_is_unmanaged(gc_get_obj(
+	    gc_cheri_ptr(&addr, sizeof(addr)), NULL, NULL, NULL, NULL,
+	    NULL)));
+
+	return (TF_SUCC);
+}
+
+int
+test_lazy_init(struct tf_test *thiz)
+{
+	_gc_cap struct gc_state *heap, *old;
+	_gc_cap struct node *t;
+
+	/* A new heap is set up with gc_init_lazy: nothing committed. */
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	thiz->t_assert(!heap->gs_ready);
+	thiz->t_assert(!heap->gs_btbl_small.bt_valid);
+	thiz->t_assert(!heap->gs_btbl_big.bt_valid);
+	/* The first allocation commits it. */
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 1;
+	thiz->t_assert(heap->gs_ready);
+	thiz->t_assert(heap->gs_btbl_small.bt_valid);
+	thiz->t_assert(gc_get_managed_btbl(gc_cheri_getbase(t)) ==
+	    &heap->gs_btbl_small);
+	thiz->t_assert(gc_heap_switch(old) == heap);
+	t = NULL;
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+
+	/* So does any other entry point, before it looks at the stack. */
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	gc_extern_collect();
+	thiz->t_assert(heap->gs_ready);
+	thiz->t_assert(gc_heap_switch(old) == heap);
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+
+	return (TF_SUCC);
+}
+
+/* Only reachable from the data segment. */
+static _gc_cap struct node	*test_roots_hd;
+
+static void
+test_roots_push(int n)
+{
+	_gc_cap struct node *t;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		t = gc_malloc(sizeof(struct node));
+		t->n = test_roots_hd;
+		t->v[0] = i;
+		test_roots_hd = t;
+	}
+}
+
+int
+test_roots(struct tf_test *thiz)
+{
+	_gc_cap struct node *t;
+	uint64_t addr, base;
+	int i, nmax, junkn, found;
+
+	/* Configurable */
+	nmax = 64;
+	junkn = 200;
+
+	/* The data segment is among the static regions. */
+	addr = (uint64_t)(uintptr_t)&test_roots_hd;
+	found = 0;
+	for (i = 0; i < (int)gc_state_c->gs_nstatic; i++) {
+		base = gc_cheri_getbase(gc_state_c->gs_static[i]);
+		if (addr >= base && addr <
+		    base + gc_cheri_getlen(gc_state_c->gs_static[i]))
+			found = 1;
+	}
+	thiz->t_assert(found);
+	gc_set_root_wp(1);
+	test_roots_push(nmax);
+	gc_extern_collect();
+	/* Cached tags are reused... */
+	gc_extern_collect();
+	/* ...until the page is written. */
+	test_roots_push(nmax);
+	gc_extern_collect();
+	gc_set_root_wp(0);
+	/* Anything freed by mistake is handed out again. */
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->n = NULL;
+		t->v[0] = 0xFF;
+	}
+	for (i = 0, t = test_roots_hd; t != NULL; t = t->n, i++) {
+		thiz->t_assert(gc_cheri_gettag(t));
+		thiz->t_assert(t->v[0] == (uint8_t)((nmax - 1) - i % nmax));
+	}
+	thiz->t_assert(i == 2 * nmax);
+	test_roots_hd = NULL;
+
+	return (TF_SUCC);
+}
+
+int
+test_unmanaged(struct tf_test *thiz)
+{
+	_gc_cap struct node * _gc_cap *lo;
+	_gc_cap struct node * _gc_cap *hi;
+	_gc_cap void * _gc_cap *pa;
+	_gc_cap void * _gc_cap *pb;
+	_gc_cap struct node *t;
+	void *um;
+	size_t n;
+	int i, junkn;
+
+	/* Configurable */
+	junkn = 200;
+
+	/* Two unmanaged objects on one page, each holding a reference. */
+	um = mmap(NULL, GC_PAGESZ, PROT_READ | PROT_WRITE, MAP_ANON, -1, 0);
+	thiz->t_assert(um != MAP_FAILED);
+	n = GC_PAGESZ / 2 / sizeof(*lo);
+	lo = gc_cheri_ptr(um, GC_PAGESZ / 2);
+	hi = gc_cheri_ptr((char *)um + GC_PAGESZ / 2, GC_PAGESZ / 2);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 1;
+	GC_STORE_CAP(&lo[0], t);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 2;
+	GC_STORE_CAP(&hi[n - 1], t);
+	t = NULL;
+	/* The page is scanned once, for both, in each collection. */
+	gc_extern_collect();
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 3;
+	GC_STORE_CAP(&hi[0], t);
+	t = NULL;
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->v[0] = 0xFF;
+	}
+	thiz->t_assert(gc_cheri_gettag(lo[0]) && lo[0]->v[0] == 1);
+	thiz->t_assert(gc_cheri_gettag(hi[n - 1]) && hi[n - 1]->v[0] == 2);
+	thiz->t_assert(gc_cheri_gettag(hi[0]) && hi[0]->v[0] == 3);
+	munmap(um, GC_PAGESZ);
+
+	/*
+	 * Unmanaged pages that reference themselves and each other: the
+	 * trace must come back, and still reach what they hold.
+	 */
+	um = mmap(NULL, 2 * GC_PAGESZ, PROT_READ | PROT_WRITE, MAP_ANON, -1,
+	    0);
+	thiz->t_assert(um != MAP_FAILED);
+	pa = gc_cheri_ptr(um, GC_PAGESZ);
+	pb = gc_cheri_ptr((char *)um + GC_PAGESZ, GC_PAGESZ);
+	GC_STORE_CAP(&pa[0], pa);
+	GC_STORE_CAP(&pa[1], pb);
+	GC_STORE_CAP(&pb[0], pa);
+	t = gc_malloc(sizeof(struct node));
+	thiz->t_assert(t != NULL);
+	t->v[0] = 4;
+	GC_STORE_CAP(&pb[1], t);
+	t = NULL;
+	pb = NULL;
+	gc_extern_collect();
+	for (i = 0; i < junkn; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		t->v[0] = 0xFF;
+	}
+	pb = pa[1];
+	t = pb[1];
+	thiz->t_assert(gc_cheri_gettag(t) && t->v[0] == 4);
+	munmap(um, 2 * GC_PAGESZ);
+
+	return (TF_SUCC);
+}
+
+int
+test_ts(struct tf_test *thiz)
+{
+	struct gc_ts ts;
+	_gc_cap void * _gc_cap *cap;
+	uint64_t frames;
+	size_t fsz, nframe;
+
+	fsz = sizeof(struct cheri_stack_frame);
+	frames = (uint64_t)(uintptr_t)&ts.gts_cs.cs_frames;
+	memset(&ts, 0, sizeof(ts));
+	/* Two live frames on top of two stale ones. */
+	ts.gts_cs.cs_tsize = 4 * fsz;
+	ts.gts_cs.cs_tsp = 2 * fsz;
+	cap = gc_ts_frames(gc_cheri_ptr(&ts, sizeof(ts)), &nframe);
+	thiz->t_assert(nframe == 2);
+	thiz->t_assert(gc_cheri_getbase(cap) == frames + 2 * fsz);
+	thiz->t_assert(gc_cheri_getlen(cap) == 2 * fsz);
+	/* An empty stack. */
+	ts.gts_cs.cs_tsp = ts.gts_cs.cs_tsize;
+	(void)gc_ts_frames(gc_cheri_ptr(&ts, sizeof(ts)), &nframe);
+	thiz->t_assert(nframe == 0);
+	/* Offsets beyond the buffer are clamped to it. */
+	ts.gts_cs.cs_tsize = ~(uint64_t)0;
+	ts.gts_cs.cs_tsp = 0;
+	(void)gc_ts_frames(gc_cheri_ptr(&ts, sizeof(ts)), &nframe);
+	thiz->t_assert(nframe == sizeof(ts.gts_cs.cs_frames) / fsz);
+	ts.gts_cs.cs_tsp = ~(uint64_t)0;
+	(void)gc_ts_frames(gc_cheri_ptr(&ts, sizeof(ts)), &nframe);
+	thiz->t_assert(nframe == 0);
+
+	return (TF_SUCC);
+}
+
+int
+test_heaps(struct tf_test *thiz)
+{
+	_gc_cap struct gc_state *heap, *old;
+	_gc_cap struct node *t, *o;
+	void *p, *resv;
+	size_t resvsz;
+	int i, nmax;
+
+	/* Configurable */
+	nmax = 64;
+
+	o = gc_malloc(sizeof(struct node));
+	thiz->t_assert(o != NULL);
+	test_roots_hd = NULL;
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	test_roots_push(nmax);
+	gc_extern_collect();
+	for (i = 0, t = test_roots_hd; t != NULL; t = t->n, i++)
+		thiz->t_assert(gc_cheri_gettag(t));
+	thiz->t_assert(i == nmax);
+	/* Other heaps' objects and every gc_state are left alone. */
+	thiz->t_assert(!gc_heap_skip(gc_cheri_getbase(test_roots_hd)));
+	thiz->t_assert(gc_heap_skip(gc_cheri_getbase(o)));
+	thiz->t_assert(gc_heap_skip(gc_cheri_getbase(heap)));
+	thiz->t_assert(gc_heap_skip(gc_cheri_getbase(old)));
+	/* The current heap cannot go. */
+	thiz->t_assert(gc_heap_destroy(heap) != 0);
+	gc_heap_switch(old);
+	test_roots_hd = NULL;
+	resv = (void *)heap->gs_hp_base;
+	resvsz = heap->gs_hp_top - heap->gs_hp_base;
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+	/* Nor can the default heap. */
+	thiz->t_assert(gc_heap_destroy(old) != 0);
+	/* The old reservation isn't handed out again. */
+	if (resv != NULL) {
+		p = mmap(resv, resvsz, PROT_READ | PROT_WRITE, MAP_ANON, -1,
+		    0);
+		thiz->t_assert(p != MAP_FAILED);
+		thiz->t_assert(p != resv);
+		munmap(p, resvsz);
+	}
+
+	return (TF_SUCC);
+}
+
+int
+test_heaps_wp(struct tf_test *thiz)
+{
+	_gc_cap struct gc_state *heap, *old;
+	_gc_cap struct node *t;
+	int i, nmax, wp;
+
+	/* Configurable */
+	nmax = 64;
+
+	/* Both heaps protect the data segment. */
+	test_roots_hd = NULL;
+	wp = gc_set_root_wp(1);
+	gc_extern_collect();
+	heap = gc_heap_new();
+	thiz->t_assert(heap != NULL);
+	old = gc_heap_switch(heap);
+	thiz->t_assert(old != NULL);
+	thiz->t_assert(gc_set_root_wp(1) == 0);
+	test_roots_push(nmax);
+	gc_extern_collect();
+	/* Turning it off in one heap leaves the other's pages handled. */
+	gc_heap_switch(old);
+	gc_set_root_wp(0);
+	test_roots_hd = test_roots_hd->n;
+	gc_heap_switch(heap);
+	gc_extern_collect();
+	for (i = 0, t = test_roots_hd; t != NULL; t = t->n, i++) {
+		thiz->t_assert(gc_cheri_gettag(t));
+		thiz->t_assert(t->v[0] == (uint8_t)(nmax - 2 - i));
+	}
+	thiz->t_assert(i == nmax - 1);
+	/* Destroying the last heap that protects them unprotects them. */
+	gc_heap_switch(old);
+	thiz->t_assert(gc_heap_destroy(heap) == 0);
+	test_roots_hd = NULL;
+	gc_set_root_wp(wp);
+
+	return (TF_SUCC);
+}
+
+#ifdef GC_USE_PTHREAD
+int
+test_conc(struct tf_test *thiz)
+{
+	struct gc_stats st;
+	_gc_cap struct node *hd, *t, *holder;
+	uint64_t ncollect;
+	int i, nmax, junkn, junksz;
+
+	/* Configurable */
+	nmax = 50;
+	junkn = 8192;
+	junksz = 200;
+
+	thiz->t_assert(gc_set_concurrent(GC_CONC_MARK) == GC_SUCC);
+	holder = gc_malloc(sizeof(struct node));
+	thiz->t_assert(holder != NULL);
+	hd = NULL;
+	for (i = 0; i < nmax; i++) {
+		t = gc_malloc(sizeof(struct node));
+		thiz->t_assert(t != NULL);
+		GC_STORE_CAP(&t->n, hd);
+		t->v[0] = i;
+		hd = t;
+	}
+	/*
+	 * Move the list between the stack and an old object while the
+	 * collector thread marks; the barrier only sees the heap side.
+	 */
+	gc_get_stats(&st);
+	ncollect = st.st_ncollect;
+	for (i = 0; i < junkn; i++) {
+		if (i % 2 == 0) {
+			GC_STORE_CAP(&holder->n, hd);
+			hd = NULL;
+		} else {
+			hd = holder->n;
+			GC_STORE_CAP(&holder->n, NULL);
+		}
+		gc_malloc(junksz);
+	}
+	gc_get_stats(&st);
+	thiz->t_assert(st.st_ncollect != ncollect);
+	thiz->t_assert(gc_set_concurrent(0) == GC_SUCC);
+	gc_extern_collect();
+	for (i = nmax - 1, t = hd; i >= 0; i--, t = t->n) {
+		thiz->t_assert(t != NULL);
+		thiz->t_assert(t->v[0] == i);
+	}
+
+	return (TF_SUCC);
+}
+#endif /* GC_USE_PTHREAD */